@@ -0,0 +1,59 @@
+#include "arena.h"
+#include <sys/mman.h>
+
+std::atomic<unsigned long long> arenaHugeAlignedBytes(0);
+
+static size_t mappedLength(size_t bytes)
+{
+    // the same rounding on map and unmap, so nothing has to remember it
+    size_t unit = (bytes >= ARENA_HUGE_MIN) ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    return (bytes + unit - 1)/unit*unit;
+}
+
+void * arenaMap(size_t bytes)
+{
+    if(bytes == 0){
+        bytes = 1;
+    }
+    size_t length = mappedLength(bytes);
+    if(length < HUGE_PAGE_SIZE){
+        void * p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED){
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    // reserved huge pages, fails unless vm.nr_hugepages has some free
+    void * p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(p != MAP_FAILED){
+        arenaHugeAlignedBytes += length;
+        return p;
+    }
+
+    // over-map, trim to a huge page boundary so khugepaged (or the fault path) can use whole huge pages
+    char * raw = (char *)mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED){
+        throw std::bad_alloc();
+    }
+    char * aligned = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if(aligned > raw){
+        munmap(raw, aligned - raw);
+    }
+    munmap(aligned + length, raw + HUGE_PAGE_SIZE - aligned);
+    madvise(aligned, length, MADV_HUGEPAGE);
+    arenaHugeAlignedBytes += length;
+    return aligned;
+}
+
+void arenaUnmap(void * p, size_t bytes)
+{
+    if(bytes == 0){
+        bytes = 1;
+    }
+    size_t length = mappedLength(bytes);
+    if(length >= HUGE_PAGE_SIZE){
+        arenaHugeAlignedBytes -= length;
+    }
+    munmap(p, length);
+}
@@ -0,0 +1,39 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "parameters.h"
+#include "types.h"
+
+// Page aligned anonymous memory for the packet buffer. Large requests are
+// rounded to whole huge pages: MAP_HUGETLB when the kernel has a pool,
+// otherwise a huge page aligned mapping with transparent huge pages asked for
+void * arenaMap(size_t bytes);
+void arenaUnmap(void * p, size_t bytes);
+
+// Bytes currently mapped in huge page aligned regions, for statistics. Only the
+// MAP_HUGETLB ones are certain to be huge pages, madvise is just a hint
+extern std::atomic<unsigned long long> arenaHugeAlignedBytes;
+
+// Standard allocator over the arena, for the per-slot arrays
+template <class T>
+class ArenaAllocator
+{
+    public:
+        typedef T value_type;
+
+        ArenaAllocator() {}
+        template <class U> ArenaAllocator(const ArenaAllocator<U> &) {}
+
+        T * allocate(size_t n) { return (T *)arenaMap(n*sizeof(T)); }
+        void deallocate(T * p, size_t n) { arenaUnmap(p, n*sizeof(T)); }
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return true; }
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return false; }
+
+template <class T>
+using SlotArray = vector<T, ArenaAllocator<T> >;
+
+#endif
@@ -0,0 +1,449 @@
+#include "batch.h"
+
+/*************** Manifest Source ***************/
+ManifestSource::ManifestSource(const string & path, struct stat & st, FileSource * input)
+{
+    this->input = input;
+    manifestPos = 0;
+
+    manifest_header_t header;
+    header.pathLength = htons(path.size());
+    header.mode = htonl(st.st_mode);
+    header.size = htobe64(S_ISREG(st.st_mode) ? st.st_size : 0);
+    manifest.resize(sizeof(header) + path.size());
+    memcpy(&manifest[0], &header, sizeof(header));
+    memcpy(&manifest[sizeof(header)], path.data(), path.size());
+}
+
+ManifestSource::~ManifestSource()
+{
+    delete input;
+}
+
+size_t ManifestSource::read(char * buf, size_t len)
+{
+    size_t total = 0;
+    if(manifestPos < manifest.size()){
+        total = min(len, manifest.size() - manifestPos);
+        memcpy(buf, &manifest[manifestPos], total);
+        manifestPos += total;
+    }
+    return total + input->read(buf + total, len - total);
+}
+
+/*************** Batch Provider ***************/
+BatchProvider::BatchProvider(const char * path)
+{
+    files = 0;
+    directories = 0;
+    skipped = 0;
+
+    struct stat st;
+    if(stat(path, &st) < 0){
+        perror(path);
+        exit(1);
+    }
+
+    // a directory is walked, anything else lists one path per line
+    fromList = (S_ISDIR(st.st_mode) == false);
+    if(fromList){
+        list.open(path);
+        if(!list){
+            fprintf(stderr, "Unable to open file list %s\n", path);
+            exit(1);
+        }
+        return;
+    }
+
+    root = path;
+    DIR * dir = opendir(path);
+    if(dir == NULL){
+        perror(path);
+        exit(1);
+    }
+    walk.push_back(make_pair(dir, string("")));
+}
+
+BatchProvider::~BatchProvider()
+{
+    for(pair<DIR *, string> & level : walk) {
+        closedir(level.first);
+    }
+}
+
+bool BatchProvider::nextPath(string & path, string & name)
+{
+    if(fromList){
+        string line;
+        while(getline(list, line)){
+            // names go as listed, less any leading slashes and ./
+            size_t start = 0;
+            while(start < line.size()){
+                if(line[start] == '/'){
+                    start++;
+                }else if(line.compare(start, 2, "./") == 0){
+                    start += 2;
+                }else{
+                    break;
+                }
+            }
+            if(start == line.size()) continue;
+
+            path = line;
+            name = line.substr(start);
+            return true;
+        }
+        return false;
+    }
+
+    while(walk.empty() == false){
+        struct dirent * entry = readdir(walk.back().first);
+        if(entry == NULL){
+            closedir(walk.back().first);
+            walk.pop_back();
+            continue;
+        }
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        name = walk.back().second + entry->d_name;
+        path = root + "/" + name;
+        return true;
+    }
+    return false;
+}
+
+StreamSource * BatchProvider::open(FileSource *& digest)
+{
+    string path, name;
+    while(nextPath(path, name)){
+        struct stat st;
+        if(lstat(path.c_str(), &st) < 0){
+            perror(path.c_str());
+            skipped++;
+            continue;
+        }
+        if(name.size() > BATCH_MAX_PATH){
+            fprintf(stderr, "Skipping %s, path too long\n", path.c_str());
+            skipped++;
+            continue;
+        }
+
+        // a directory goes ahead of its contents, so even an empty one is recreated
+        if(S_ISDIR(st.st_mode)){
+            if(fromList == false){
+                DIR * dir = opendir(path.c_str());
+                if(dir == NULL){
+                    perror(path.c_str());
+                    skipped++;
+                    continue;
+                }
+                walk.push_back(make_pair(dir, name + "/"));
+            }
+            directories++;
+            digest = new FileSource(-1, 0);
+            return new ManifestSource(name, st, digest);
+        }
+
+        // links, devices and sockets are not sent
+        if(S_ISREG(st.st_mode) == false){
+            skipped++;
+            continue;
+        }
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0){
+            perror(path.c_str());
+            skipped++;
+            continue;
+        }
+        files++;
+        digest = new FileSource(fd, st.st_size);
+        return new ManifestSource(name, st, digest);
+    }
+    return NULL;
+}
+
+void BatchProvider::close(FileSource * digest)
+{
+    if(digest->fd >= 0){
+        ::close(digest->fd);
+    }
+}
+
+/*************** Manifest Sink ***************/
+ManifestSink::ManifestSink(BatchAcceptor * owner) : FileSink(-1)
+{
+    this->owner = owner;
+    manifestHave = 0;
+    valid = false;
+    memset(&header, 0, sizeof(header));
+}
+
+void ManifestSink::write(const char * buf, size_t len)
+{
+    // the manifest may span packets
+    if(manifestHave < sizeof(manifest_header_t)){
+        size_t n = min(len, sizeof(manifest_header_t) - manifestHave);
+        memcpy((char *)&header + manifestHave, buf, n);
+        manifestHave += n;
+        buf += n;
+        len -= n;
+        if(manifestHave < sizeof(manifest_header_t)) return;
+
+        header.pathLength = ntohs(header.pathLength);
+        header.mode = ntohl(header.mode);
+        header.size = be64toh(header.size);
+    }
+    size_t manifestLength = sizeof(manifest_header_t) + header.pathLength;
+    if(manifestHave < manifestLength){
+        size_t n = min(len, manifestLength - manifestHave);
+        path.append(buf, n);
+        manifestHave += n;
+        buf += n;
+        len -= n;
+        if(manifestHave < manifestLength) return;
+        start();
+    }
+    if(len == 0) return;
+
+    if(fd >= 0){
+        FileSink::write(buf, len);
+        return;
+    }
+
+    // held for the file thread, or dropped if there is nowhere to put it; the digest covers it either way
+    digest = crc32c(digest, buf, len);
+    digestLength += len;
+    if(valid){
+        pending.insert(pending.end(), buf, buf + len);
+    }
+}
+
+void ManifestSink::start()
+{
+    // only paths inside the root
+    valid = (path.empty() == false && path[0] != '/');
+    size_t begin = 0;
+    while(valid && begin <= path.size()){
+        size_t end = path.find('/', begin);
+        if(end == string::npos) end = path.size();
+        valid = (path.compare(begin, end - begin, "..") != 0);
+        begin = end + 1;
+    }
+    if(valid == false){
+        fprintf(stderr, "Refusing unsafe path %s\n", path.c_str());
+        return;
+    }
+
+    batch_job_t job;
+    job.path = path;
+    job.mode = header.mode;
+    job.fd = -1;
+    if(S_ISDIR(header.mode)){
+        job.kind = BATCH_JOB_DIR;
+        owner->submit(job);
+    }else if(header.size > BATCH_INLINE_MAX){
+        // too large to hold, the writer waits once for the file to exist and writes it directly
+        fd = owner->openNow(path, header.mode);
+        valid = (fd >= 0);
+    }else{
+        pending.reserve(header.size);
+    }
+}
+
+/*************** Batch Acceptor ***************/
+BatchAcceptor::BatchAcceptor(const char * root)
+{
+    this->root = root;
+    if(mkdir(root, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) < 0 && errno != EEXIST){
+        perror(root);
+        exit(1);
+    }
+
+    files = 0;
+    directories = 0;
+    failures = 0;
+    queuedBytes = 0;
+    submitted = 0;
+    completed = 0;
+    openedFd = -1;
+    stopping = false;
+    fileThread = thread(&BatchAcceptor::fileMain, this);
+}
+
+BatchAcceptor::~BatchAcceptor()
+{
+    {
+        unique_lock<mutex> held(queueLock);
+        stopping = true;
+    }
+    queueCV.notify_one();
+    fileThread.join();
+}
+
+StreamSink * BatchAcceptor::accept(uint32_t /* id */, FileSink *& digest)
+{
+    ManifestSink * sink = new ManifestSink(this);
+    digest = sink;
+    return sink;
+}
+
+void BatchAcceptor::close(uint32_t id, FileSink * digest, bool verified)
+{
+    ManifestSink * sink = (ManifestSink *)digest;
+    if(verified == false){
+        fprintf(stderr, "Stream %u digest mismatch, %s is corrupt\n", id, sink->path.c_str());
+    }
+    if(sink->valid == false){
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if(S_ISDIR(sink->header.mode)){
+        directories++;
+        return;
+    }
+    files++;
+
+    // the file thread finishes it, the sink is deleted once this returns
+    batch_job_t job;
+    job.path = sink->path;
+    job.mode = sink->header.mode;
+    job.fd = sink->fd;
+    if(sink->fd >= 0){
+        job.kind = BATCH_JOB_CLOSE;
+        sink->fd = -1;
+    }else{
+        job.kind = BATCH_JOB_WRITE;
+        job.data.swap(sink->pending);
+    }
+    submit(job);
+}
+
+bool BatchAcceptor::finish()
+{
+    unique_lock<mutex> held(queueLock);
+    doneCV.wait(held, [&]{ return completed == submitted; });
+    return __atomic_load_n(&failures, __ATOMIC_RELAXED) == 0;
+}
+
+void BatchAcceptor::submit(batch_job_t & job)
+{
+    // bounded, the writer slows down rather than holding an unlimited backlog of small files
+    unique_lock<mutex> held(queueLock);
+    doneCV.wait(held, [&]{ return queuedBytes < BATCH_MAX_QUEUED || completed == submitted; });
+    queuedBytes += job.data.size();
+    queue.push_back(std::move(job));
+    submitted++;
+    queueCV.notify_one();
+}
+
+int BatchAcceptor::openNow(const string & path, uint32_t mode)
+{
+    batch_job_t job;
+    job.kind = BATCH_JOB_OPEN;
+    job.path = path;
+    job.mode = mode;
+    job.fd = -1;
+
+    // jobs run in order, so the directories queued ahead of it exist by then
+    unique_lock<mutex> held(queueLock);
+    queue.push_back(std::move(job));
+    unsigned long long ticket = ++submitted;
+    queueCV.notify_one();
+    doneCV.wait(held, [&]{ return completed >= ticket; });
+    return openedFd;
+}
+
+void BatchAcceptor::fileMain()
+{
+    while(true){
+        batch_job_t job;
+        {
+            unique_lock<mutex> held(queueLock);
+            queueCV.wait(held, [&]{ return queue.empty() == false || stopping; });
+            if(queue.empty()){
+                break;
+            }
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        runJob(job);
+
+        {
+            unique_lock<mutex> held(queueLock);
+            queuedBytes -= job.data.size();
+            completed++;
+        }
+        doneCV.notify_all();
+    }
+}
+
+void BatchAcceptor::runJob(batch_job_t & job)
+{
+    string full = root + "/" + job.path;
+    mode_t permissions = job.mode & 07777;
+
+    if(job.kind == BATCH_JOB_CLOSE){
+        if(::close(job.fd) < 0){
+            perror(full.c_str());
+            __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+
+    if(makeParents(full) == false){
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+        openedFd = -1;
+        return;
+    }
+
+    if(job.kind == BATCH_JOB_DIR){
+        // owner access always, or its own contents could not be created
+        if(mkdir(full.c_str(), permissions | S_IRWXU) < 0 && errno != EEXIST){
+            perror(full.c_str());
+            __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+
+    int fd = open(full.c_str(), O_WRONLY | O_CREAT | O_TRUNC, permissions);
+    if(job.kind == BATCH_JOB_OPEN){
+        if(fd < 0){
+            perror(full.c_str());
+        }
+        openedFd = fd;
+        return;
+    }
+
+    size_t done = 0;
+    while(fd >= 0 && done < job.data.size()){
+        ssize_t n = ::write(fd, &job.data[done], job.data.size() - done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) break;
+        done += n;
+    }
+    if(fd < 0 || done < job.data.size() || ::close(fd) < 0){
+        perror(full.c_str());
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+    }
+}
+
+bool BatchAcceptor::makeParents(const string & path)
+{
+    // files usually come a directory at a time
+    string parent = path.substr(0, path.rfind('/'));
+    if(parent == lastParent){
+        return true;
+    }
+
+    for(size_t i = root.size() + 1; i <= parent.size(); i++) {
+        if(i < parent.size() && parent[i] != '/') continue;
+        string dir = parent.substr(0, i);
+        if(mkdir(dir.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) < 0 && errno != EEXIST){
+            perror(dir.c_str());
+            return false;
+        }
+    }
+    lastParent = parent;
+    return true;
+}
@@ -0,0 +1,120 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "parameters.h"
+#include "types.h"
+#include "stream.h"
+#include "crc32c.h"
+#include <dirent.h>
+
+// A file or directory's manifest, then its bytes
+class ManifestSource : public StreamSource
+{
+    public:
+        ManifestSource(const string & path, struct stat & st, FileSource * input);
+        ~ManifestSource();
+
+        size_t read(char * buf, size_t len);
+
+    private:
+        FileSource * input;
+        vector<char> manifest;                  // manifest_header_t and the path
+        size_t manifestPos;
+};
+
+// Every file and directory under a root, or every path in a list file, one stream each
+class BatchProvider : public StreamProvider
+{
+    public:
+        BatchProvider(const char * path);
+        ~BatchProvider();
+
+        StreamSource * open(FileSource *& digest);
+        void close(FileSource * digest);
+        bool manifests() { return true; }
+
+        // statistics
+        unsigned long long files, directories, skipped;
+
+    private:
+        bool nextPath(string & path, string & name);
+
+        // directory walk, depth first; names are relative to the root
+        string root;
+        vector<pair<DIR *, string> > walk;
+
+        // or the list file, names are the paths as listed
+        ifstream list;
+        bool fromList;
+};
+
+// One queued file system operation for the receiver's file thread
+typedef struct {
+    uint8_t kind;                               // BATCH_JOB_*
+    string path;                                // relative to the root
+    uint32_t mode;
+    vector<char> data;                          // BATCH_JOB_WRITE: the whole file
+    int fd;                                     // BATCH_JOB_CLOSE
+} batch_job_t;
+
+class BatchAcceptor;
+
+// Reads a stream's manifest, then holds a small file's bytes for the file thread or
+// writes a large one straight to the fd the file thread opened for it
+class ManifestSink : public FileSink
+{
+    public:
+        ManifestSink(BatchAcceptor * owner);
+
+        void write(const char * buf, size_t len);
+
+        manifest_header_t header;
+        string path;
+        bool valid;                             // whole manifest, a safe relative path
+        vector<char> pending;                   // file bytes for a BATCH_JOB_WRITE
+
+    private:
+        void start();
+
+        BatchAcceptor * owner;
+        size_t manifestHave;
+};
+
+// Recreates the sender's tree under a root; a file thread does the mkdir, open and close
+// calls in stream order while the writer keeps delivering packets
+class BatchAcceptor : public StreamAcceptor
+{
+    public:
+        BatchAcceptor(const char * root);
+        ~BatchAcceptor();
+
+        StreamSink * accept(uint32_t id, FileSink *& digest);
+        void close(uint32_t id, FileSink * digest, bool verified);
+        bool finish();
+
+        // the file thread's queue; openNow waits for the file to exist
+        void submit(batch_job_t & job);
+        int openNow(const string & path, uint32_t mode);
+
+        // statistics
+        unsigned long long files, directories, failures;
+
+    private:
+        void fileMain();
+        void runJob(batch_job_t & job);
+        bool makeParents(const string & path);
+
+        string root;
+        string lastParent;                      // file thread: most recent directory known to exist
+
+        thread fileThread;
+        mutex queueLock;
+        condition_variable queueCV, doneCV;
+        deque<batch_job_t> queue;
+        unsigned long long queuedBytes;
+        unsigned long long submitted, completed;
+        int openedFd;                           // result of the last BATCH_JOB_OPEN
+        bool stopping;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Compares two bench/matrix.sh result files cell by cell (mean over runs) and
+# flags cells where goodput fell or CPU time rose by more than the threshold,
+# or where the new build failed runs the old one passed. Exits 1 on regression.
+#
+# usage: bench/compare.sh baseline.csv candidate.csv [threshold_pct]
+
+if [ $# -lt 2 ]; then
+    sed -n 6p "$0"
+    exit 1
+fi
+
+awk -F, -v threshold="${3:-10}" '
+FNR == 1 { file++; next }
+{
+    cell = $1 "," $2 "," $3 "," $4
+    cells[cell] = 1
+    runs[file, cell]++
+    if ($6 != "ok") failed[file, cell]++
+    goodput[file, cell] += $8
+    cpu[file, cell] += $11 + $12
+    ratio[file, cell] += $9
+}
+END {
+    printf "%-32s %12s %12s %8s %10s %10s %8s  %s\n", "size,rtt_ms,loss_pct,rate_mbit", "goodput_a", "goodput_b", "delta%", "cpu_a", "cpu_b", "delta%", ""
+    regressions = 0
+    for (cell in cells) {
+        if (!runs[1, cell] || !runs[2, cell]) continue
+        ga = goodput[1, cell] / runs[1, cell]; gb = goodput[2, cell] / runs[2, cell]
+        ca = cpu[1, cell] / runs[1, cell];     cb = cpu[2, cell] / runs[2, cell]
+        gd = (ga > 0) ? (gb - ga) * 100 / ga : 0
+        cd = (ca > 0) ? (cb - ca) * 100 / ca : 0
+
+        flag = ""
+        if (failed[2, cell] > failed[1, cell]) flag = flag " FAILURES"
+        if (gd < -threshold) flag = flag " GOODPUT"
+        if (cd > threshold) flag = flag " CPU"
+        if (flag != "") regressions++
+
+        printf "%-32s %12.2f %12.2f %+8.1f %10.3f %10.3f %+8.1f %s\n", cell, ga, gb, gd, ca, cb, cd, flag
+    }
+    printf "%d regressed cell(s) at %s%% threshold\n", regressions, threshold
+    exit (regressions > 0)
+}' "$1" "$2"
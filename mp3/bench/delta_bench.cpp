@@ -0,0 +1,122 @@
+/*
+ *
+ * Delta transfer benchmark
+ *
+ * Builds a random basis file, changes a percentage of it, and measures how
+ * many bytes the delta stream puts on the wire and how fast it encodes and
+ * decodes compared to sending the whole file.
+ *
+ */
+
+#include "../delta.h"
+
+#define BENCH_FILE_SIZE             (64*1024*1024)
+#define BENCH_EDIT_RUN              (4096)            // bytes touched per edit
+#define BENCH_INSERT_EVERY          (10)              // every nth edit shifts the data instead of overwriting
+
+double secondsSince(struct timeval & start)
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    return (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec)/(double)US_PER_SEC;
+}
+
+void writeFile(const char * path, vector<char> & contents)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    FileSink sink(fd);
+    sink.write(&contents[0], contents.size());
+    close(fd);
+}
+
+// Appends into memory so the decoded copy can be compared
+class VectorSink : public StreamSink
+{
+    public:
+        void write(const char * buf, size_t len) { contents.insert(contents.end(), buf, buf + len); }
+        vector<char> contents;
+};
+
+void runChangeRate(vector<char> & basis, int percent, unsigned int seed)
+{
+    const char * basisPath = "delta_bench.basis";
+    const char * sourcePath = "delta_bench.source";
+
+    // scatter edits until the requested share of the file is touched
+    vector<char> source = basis;
+    srand(seed);
+    size_t edits = (source.size()*percent/100)/BENCH_EDIT_RUN;
+    for(size_t e = 0; e < edits; e++) {
+        size_t at = ((size_t)rand()*RAND_MAX + rand()) % (source.size() - BENCH_EDIT_RUN);
+        vector<char> run(BENCH_EDIT_RUN);
+        for(size_t i = 0; i < run.size(); i++) run[i] = rand();
+
+        if(e % BENCH_INSERT_EVERY == 0){
+            source.insert(source.begin() + at, run.begin(), run.begin() + BENCH_EDIT_RUN/4);
+        }else{
+            std::copy(run.begin(), run.end(), source.begin() + at);
+        }
+    }
+    writeFile(basisPath, basis);
+    writeFile(sourcePath, source);
+
+    // receiver: signatures
+    struct timeval start;
+    vector<block_sig_t> sigs;
+    uint32_t blockSize = deltaBlockSize(basis.size());
+    int basisfd = open(basisPath, O_RDONLY);
+    gettimeofday(&start, 0);
+    computeSignatures(basisfd, basis.size(), blockSize, sigs);
+    double sigTime = secondsSince(start);
+
+    // sender: encode
+    int sourcefd = open(sourcePath, O_RDONLY);
+    DeltaEncoder * encoder = new DeltaEncoder(new FileSource(sourcefd, source.size()), blockSize, sigs);
+    vector<char> encoded, chunk(PAYLOAD);
+    size_t n;
+    gettimeofday(&start, 0);
+    while((n = encoder->read(&chunk[0], chunk.size())) > 0){
+        encoded.insert(encoded.end(), chunk.begin(), chunk.begin() + n);
+    }
+    double encodeTime = secondsSince(start);
+
+    // receiver: rebuild, fed packet by packet
+    VectorSink * rebuilt = new VectorSink();
+    DeltaDecoder decoder(basisfd, blockSize, rebuilt);
+    gettimeofday(&start, 0);
+    for(size_t i = 0; i < encoded.size(); i += PAYLOAD) {
+        decoder.write(&encoded[i], min((size_t)PAYLOAD, encoded.size() - i));
+    }
+    decoder.finish();
+    double decodeTime = secondsSince(start);
+
+    unsigned long long sigBytes = sigs.size()*sizeof(block_sig_t);
+    unsigned long long wireBytes = encoded.size() + sigBytes;
+    double mb = source.size()/(1024.0*1024.0);
+
+    printf("%6d%% %10u %12llu %12zu %12llu %9.2f%% %10.1f %10.1f %10.1f  %s\n",
+        percent, blockSize, encoder->literalBytes, encoded.size(), sigBytes,
+        100.0*wireBytes/source.size(), mb/sigTime, mb/encodeTime, mb/decodeTime,
+        rebuilt->contents == source ? "ok" : "MISMATCH");
+
+    delete encoder;
+    close(sourcefd);
+    unlink(basisPath);
+    unlink(sourcePath);
+}
+
+int main(int argc, char** argv) {
+    size_t fileSize = (argc > 1) ? atoll(argv[1]) : BENCH_FILE_SIZE;
+    int rates[] = {1, 10, 50};
+
+    vector<char> basis(fileSize);
+    srand(438);
+    for(size_t i = 0; i < basis.size(); i++) basis[i] = rand();
+
+    printf("file size %zu bytes, edits of %d bytes\n", fileSize, BENCH_EDIT_RUN);
+    printf("%7s %10s %12s %12s %12s %10s %10s %10s %10s\n",
+        "change", "block", "literal", "encoded", "signatures", "wire", "sig MB/s", "enc MB/s", "dec MB/s");
+    for(int percent : rates) {
+        runChangeRate(basis, percent, percent);
+    }
+}
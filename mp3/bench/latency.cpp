@@ -0,0 +1,247 @@
+/*
+ *
+ * Latency benchmark
+ *
+ * Compares blocking sockets with the busy-poll mode on loopback or a LAN:
+ * a UDP ping-pong through the same NetIO the transport uses, and complete
+ * small file transfers (handshake, data, teardown) with the real sender
+ * and receiver. Every sample is a round trip or a whole transfer; lines
+ * report p50/p99/max in microseconds.
+ *
+ */
+
+#include <sys/wait.h>
+#include <signal.h>
+#include "../tcp.h"
+
+double nowUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e6 + ts.tv_nsec/1e3;
+}
+
+void report(const char * test, bool busyPoll, unsigned long long size, vector<double> & samples)
+{
+    if(samples.empty()){
+        printf("test=%s io=%s n=0\n", test, busyPoll ? "busy_poll" : "blocking");
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    printf("test=%s io=%s n=%zu size=%llu p50_us=%.1f p99_us=%.1f max_us=%.1f\n", test, busyPoll ? "busy_poll" : "blocking",
+        samples.size(), size, samples[samples.size()/2], samples[(samples.size()*99)/100], samples.back());
+    fflush(stdout);
+}
+
+int bindLoopback(int port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+        perror("bind");
+        exit(1);
+    }
+    return fd;
+}
+
+void pinTo(int cpu)
+{
+    if(cpu < 0) return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if(sched_setaffinity(0, sizeof(cpus), &cpus) < 0){
+        perror("sched_setaffinity");
+        exit(1);
+    }
+}
+
+// One datagram out, the echo back, per sample
+void pingPong(bool busyPoll, int count, int size, int port, int cpu)
+{
+    NetIO * io = busyPoll ? (NetIO *)&busyPollIO : (NetIO *)&systemIO;
+
+    pid_t echo = fork();
+    if(echo == 0){
+        int fd = bindLoopback(port + 1);
+        if(busyPoll){
+            busyPollIO.attach(fd);
+        }
+        vector<char> packet(size);
+        struct sockaddr_storage from;
+        for(int i = 0; i < count; i++) {
+            socklen_t fromLen = sizeof(from);
+            ssize_t numbytes = io->recvFrom(fd, &packet[0], size, (struct sockaddr *)&from, &fromLen);
+            if(numbytes > 0){
+                io->sendTo(fd, &packet[0], numbytes, (struct sockaddr *)&from, fromLen);
+            }
+        }
+        _exit(0);
+    }
+
+    pinTo(cpu);
+    int fd = bindLoopback(port);
+    if(busyPoll){
+        busyPollIO.attach(fd);
+    }
+    struct timeval timeout = {1, 0};
+    io->setRecvTimeout(fd, timeout);
+
+    struct sockaddr_in peer;
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_port = htons(port + 1);
+    peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    usleep(100000);
+
+    vector<char> packet(size, 'p');
+    vector<double> samples;
+    for(int i = 0; i < count; i++) {
+        double start = nowUs();
+        io->sendTo(fd, &packet[0], size, (struct sockaddr *)&peer, sizeof(peer));
+        if(io->recvFrom(fd, &packet[0], size, NULL, NULL) < 0){
+            continue;
+        }
+        samples.push_back(nowUs() - start);
+    }
+    close(fd);
+    kill(echo, SIGKILL);
+    waitpid(echo, NULL, 0);
+
+    report("pingpong", busyPoll, size, samples);
+}
+
+// Whole transfers; both sides are fresh processes since the transport keeps statics
+void smallFiles(bool busyPoll, bool fastOpen, int count, unsigned long long size, int port, int cpu)
+{
+    char sourcePath[64], destPath[64], portText[16];
+    snprintf(sourcePath, sizeof(sourcePath), "latency.%d.source", getpid());
+    snprintf(destPath, sizeof(destPath), "latency.%d.dest", getpid());
+    snprintf(portText, sizeof(portText), "%d", port);
+
+    int fd = open(sourcePath, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    vector<char> data(size);
+    for(unsigned long long i = 0; i < size; i++) {
+        data[i] = (char)(i*2654435761ULL >> 24);
+    }
+    if(fd < 0 || write(fd, &data[0], size) != (ssize_t)size){
+        perror(sourcePath);
+        exit(1);
+    }
+    close(fd);
+
+    vector<double> samples;
+    for(int i = 0; i < count; i++) {
+        unlink(destPath);
+        unlink((string(destPath) + CHECKPOINT_SUFFIX).c_str());
+
+        // the receiver says when its socket is bound so the first SYN is never lost
+        int ready[2], result[2];
+        if(pipe(ready) < 0 || pipe(result) < 0){
+            perror("pipe");
+            exit(1);
+        }
+        pid_t receiverPid = fork();
+        if(receiverPid == 0){
+            freopen("/dev/null", "w", stderr);
+            TCP receiver(portText);
+            receiver.options.busyPoll = busyPoll;
+            if(write(ready[1], "r", 1) < 0){
+                _exit(1);
+            }
+            _exit(receiver.reliableReceive(destPath) ? 0 : 1);
+        }
+        char byte;
+        if(read(ready[0], &byte, 1) != 1){
+            fprintf(stderr, "receiver did not start\n");
+            exit(1);
+        }
+
+        pid_t senderPid = fork();
+        if(senderPid == 0){
+            freopen("/dev/null", "w", stderr);
+            TCP sender((char *)"127.0.0.1", portText);
+            sender.options.busyPoll = busyPoll;
+            sender.options.probeMtu = false;
+            sender.options.fastOpen = fastOpen;
+            sender.options.cpu = cpu;
+            double start = nowUs();
+            bool sent = sender.reliableSend(sourcePath, size);
+            double elapsed = sent ? nowUs() - start : -1.0;
+            _exit(write(result[1], &elapsed, sizeof(elapsed)) == sizeof(elapsed) ? 0 : 1);
+        }
+
+        double elapsed = -1.0;
+        if(read(result[0], &elapsed, sizeof(elapsed)) != sizeof(elapsed)){
+            elapsed = -1.0;
+        }
+        waitpid(senderPid, NULL, 0);
+        waitpid(receiverPid, NULL, 0);
+        close(ready[0]); close(ready[1]);
+        close(result[0]); close(result[1]);
+
+        if(elapsed >= 0){
+            samples.push_back(elapsed);
+        }
+    }
+    unlink(sourcePath);
+    unlink(destPath);
+    unlink((string(destPath) + CHECKPOINT_SUFFIX).c_str());
+
+    report(fastOpen ? "file_fastopen" : "file", busyPoll, size, samples);
+}
+
+void usage(char * name)
+{
+    fprintf(stderr, "usage: %s [-n pings] [-z ping_bytes] [-f files] [-s file_bytes] [-p port] [-C cpu] [-m blocking|busy_poll] [-F]\n", name);
+    fprintf(stderr, "  runs both modes unless -m picks one; -C pins the measuring thread; -F adds fast open file transfers\n");
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    int pings = 2000, pingSize = 64, files = 100, port = 4970, cpu = -1;
+    unsigned long long fileSize = 16384;
+    bool modes[2] = {true, true};
+    bool fastOpen = false;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:z:f:s:p:C:m:F")) != -1){
+        switch(opt){
+            case 'n': pings = atoi(optarg); break;
+            case 'z': pingSize = atoi(optarg); break;
+            case 'f': files = atoi(optarg); break;
+            case 's': fileSize = atoll(optarg); break;
+            case 'p': port = atoi(optarg); break;
+            case 'C': cpu = atoi(optarg); break;
+            case 'F': fastOpen = true; break;
+            case 'm':
+                modes[0] = strcmp(optarg, "blocking") == 0;
+                modes[1] = strcmp(optarg, "busy_poll") == 0;
+                if(!modes[0] && !modes[1]) usage(argv[0]);
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if(pingSize < 1 || fileSize < 1){
+        usage(argv[0]);
+    }
+
+    for(int busyPoll = 0; busyPoll < 2; busyPoll++) {
+        if(modes[busyPoll] == false) continue;
+        if(pings > 0){
+            pingPong(busyPoll, pings, pingSize, port, cpu);
+        }
+        if(files > 0){
+            smallFiles(busyPoll, false, files, fileSize, port, cpu);
+            if(fastOpen){
+                smallFiles(busyPoll, true, files, fileSize, port, cpu);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#!/bin/bash
+# Goodput matrix: runs reliable_sender -> impairment_proxy -> reliable_receiver on
+# 127.0.0.1 for every combination of file size, RTT, loss and bandwidth and
+# writes one CSV row per run. Compare two result files with bench/compare.sh.
+#
+# usage: bench/matrix.sh [-s "sizes"] [-r "rtts_ms"] [-l "loss_pct"] [-b "mbit"]
+#                        [-n repeats] [-t timeout_s] [-o out.csv] [-- sender options]
+# run from mp3/ after make.
+
+SIZES="1000000 20000000 100000000"
+RTTS="0 20 100"
+LOSSES="0 1 5"
+RATES="100 1000"
+REPEATS=3
+LIMIT=300
+OUT=matrix.csv
+
+while getopts "s:r:l:b:n:t:o:" opt; do
+    case "$opt" in
+        s) SIZES="$OPTARG" ;;
+        r) RTTS="$OPTARG" ;;
+        l) LOSSES="$OPTARG" ;;
+        b) RATES="$OPTARG" ;;
+        n) REPEATS="$OPTARG" ;;
+        t) LIMIT="$OPTARG" ;;
+        o) OUT="$OPTARG" ;;
+        *) sed -n 2,8p "$0"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+SENDER_OPTS="$@"
+
+WORK=$(mktemp -d)
+trap "rm -rf $WORK" EXIT
+
+# stat <key> <file>: value of key= on the stats line
+stat() {
+    grep -o "$1=[0-9]*" "$2" | head -n 1 | cut -d= -f2
+}
+
+echo "size,rtt_ms,loss_pct,rate_mbit,run,status,completion_s,goodput_mbit,retrans_ratio,timeouts,sender_cpu_s,receiver_cpu_s" > "$OUT"
+
+for size in $SIZES; do
+    head -c "$size" /dev/urandom > "$WORK/source"
+    for rtt in $RTTS; do
+        for loss in $LOSSES; do
+            for rate in $RATES; do
+                for run in $(seq 1 $REPEATS); do
+                    rm -f "$WORK/dest" "$WORK/dest.ckpt"
+
+                    # the whole RTT is applied on the data path, ACKs return immediately
+                    ./impairment_proxy -d "$rtt" -l "$loss" -b "$rate" -s "$run" 4960 127.0.0.1 4950 2> "$WORK/proxy" &
+                    PROXY=$!
+                    timeout "$LIMIT" ./reliable_receiver -s 4950 "$WORK/dest" 2> "$WORK/receiver" &
+                    RECEIVER=$!
+                    sleep 0.2
+
+                    timeout "$LIMIT" ./reliable_sender -s $SENDER_OPTS 127.0.0.1 4960 "$WORK/source" "$size" 2> "$WORK/sender"
+                    SENDER_STATUS=$?
+                    wait $RECEIVER
+                    RECEIVER_STATUS=$?
+                    kill $PROXY 2>/dev/null
+                    wait $PROXY 2>/dev/null
+
+                    status=ok
+                    if [ $SENDER_STATUS -ne 0 ] || [ $RECEIVER_STATUS -ne 0 ]; then
+                        status=fail
+                    elif ! cmp -s "$WORK/source" "$WORK/dest"; then
+                        status=corrupt
+                    fi
+
+                    awk -v size="$size" -v rtt="$rtt" -v loss="$loss" -v rate="$rate" -v run="$run" -v status="$status" \
+                        -v elapsed="$(stat elapsed_us "$WORK/sender")" -v packets="$(stat packets "$WORK/sender")" \
+                        -v retrans="$(stat retransmits "$WORK/sender")" -v timeouts="$(stat timeouts "$WORK/sender")" \
+                        -v scpu="$(stat cpu_us "$WORK/sender")" -v rcpu="$(stat cpu_us "$WORK/receiver")" 'BEGIN {
+                        secs = elapsed / 1e6
+                        goodput = (secs > 0) ? size * 8 / secs / 1e6 : 0
+                        ratio = (packets > 0) ? retrans / packets : 0
+                        printf "%s,%s,%s,%s,%s,%s,%.3f,%.2f,%.4f,%d,%.3f,%.3f\n", size, rtt, loss, rate, run, status,
+                            secs, goodput, ratio, timeouts, scpu / 1e6, rcpu / 1e6
+                    }' | tee -a "$OUT"
+                done
+            done
+        done
+    done
+done
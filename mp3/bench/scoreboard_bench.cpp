@@ -0,0 +1,231 @@
+/*
+ *
+ * Scoreboard benchmark
+ *
+ * Replays one lossy packet arrival order through the receiver's SACK
+ * generation (cumulative advance, release and the 64 flag bits) and the
+ * ACKs it produces through the sender's SACK processing, once with a byte
+ * of state per slot as the transport used to keep it and once with the
+ * bitmap scoreboard. Both must produce the same ACKs; lines report
+ * nanoseconds per ACK for window sizes from 128 to 64K slots.
+ *
+ */
+
+#include "../scoreboard.h"
+
+typedef struct {
+    int cumulative;             // highest in order sequence number
+    uint64_t flags;             // bit i is cumulative + 1 + i
+} bench_ack_t;
+
+double nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+// In order with loss; a lost packet arrives again half a window later
+vector<int> arrivalOrder(int packets, int window, double loss, unsigned int seed)
+{
+    srand(seed);
+    vector<int> order;
+    vector<pair<int, int> > resend;
+    for(int seq = 0; seq < packets; seq++) {
+        while(resend.empty() == false && resend.front().first <= seq){
+            order.push_back(resend.front().second);
+            resend.erase(resend.begin());
+        }
+        if(rand() < loss*RAND_MAX){
+            resend.push_back(make_pair(seq + window/2, seq));
+        }else{
+            order.push_back(seq);
+        }
+    }
+    for(pair<int, int> & late : resend) {
+        order.push_back(late.second);
+    }
+    return order;
+}
+
+/*************** Byte per slot ***************/
+void bytesReceiver(vector<int> & order, int window, vector<bench_ack_t> & acks)
+{
+    // windows are powers of two, so the index wraps with a mask as BUFFER_SIZE's modulo compiles to
+    uint32_t wrap = window - 1;
+    vector<packet_state_t> state(window, WAITING);
+    int seqNum = 0;
+    for(int seq : order) {
+        state[seq & wrap] = RECEIVED;
+
+        int next = seqNum;
+        uint32_t j = next & wrap;
+        for(int i = 0; i < window && state[j] != WAITING; i++) {
+            next++;
+            j = (j + 1) & wrap;
+        }
+        for(int s = seqNum; s < next; s++) {
+            state[s & wrap] = WAITING;
+        }
+        seqNum = next;
+
+        uint64_t flags = 0;
+        uint64_t mask = 1;
+        j = seqNum & wrap;
+        for(size_t i = 0; i < FLAG_SIZE; i++) {
+            if(state[j] != WAITING){
+                flags = flags | mask;
+            }
+            mask = mask << 1;
+            j = (j + 1) & wrap;
+        }
+        bench_ack_t ack = {seqNum - 1, flags};
+        acks.push_back(ack);
+    }
+}
+
+unsigned long long bytesSender(vector<bench_ack_t> & acks, int window)
+{
+    uint32_t wrap = window - 1;
+    vector<packet_state_t> state(window, SENT);
+    int expected = 0;
+    unsigned long long released = 0;
+    for(bench_ack_t & ack : acks) {
+        if(ack.cumulative >= expected){
+            for(int s = expected; s <= ack.cumulative; s++) {
+                if(state[s & wrap] == SENT){
+                    state[s & wrap] = AVAILABLE;
+                    released++;
+                }
+                state[s & wrap] = SENT;       // refilled and sent again at once
+            }
+            expected = ack.cumulative + 1;
+        }
+        uint64_t mask = 1;
+        uint32_t j = (ack.cumulative + 1) & wrap;
+        for(size_t i = 0; i < FLAG_SIZE; i++) {
+            if(ack.flags & mask){
+                released += (state[j] == SENT);
+                state[j] = AVAILABLE;
+            }
+            mask = mask << 1;
+            j = (j + 1) & wrap;
+        }
+    }
+    return released;
+}
+
+/*************** Bitmap scoreboard ***************/
+void bitmapReceiver(vector<int> & order, int window, vector<bench_ack_t> & acks)
+{
+    Scoreboard state;
+    state.resize(window, WAITING);
+    int seqNum = 0;
+    for(int seq : order) {
+        state.set(seq % window, RECEIVED);
+
+        int next = seqNum + state.received.runLength(seqNum % window, window);
+        state.received.clearRange(seqNum % window, next - seqNum);
+        seqNum = next;
+
+        bench_ack_t ack = {seqNum - 1, state.received.extract(seqNum % window, FLAG_SIZE)};
+        acks.push_back(ack);
+    }
+}
+
+unsigned long long bitmapSender(vector<bench_ack_t> & acks, int window)
+{
+    Scoreboard state;
+    state.resize(window, AVAILABLE);
+    for(int i = 0; i < window; i++) {
+        state.set(i, SENT);
+    }
+    int expected = 0;
+    unsigned long long released = 0;
+    for(bench_ack_t & ack : acks) {
+        if(ack.cumulative >= expected){
+            int count = ack.cumulative + 1 - expected;
+            for(int done = 0; done < count; done += 64) {
+                int n = min(count - done, 64);
+                released += __builtin_popcountll(state.sent.extract((expected + done) % window, n));
+            }
+            // every slot comes back as a new SENT packet
+            for(int s = expected; s <= ack.cumulative; s++) {
+                state.set(s % window, SENT);
+            }
+            expected = ack.cumulative + 1;
+        }
+        uint32_t first = (ack.cumulative + 1) % window;
+        released += __builtin_popcountll(state.sent.extract(first, FLAG_SIZE) & ack.flags);
+        state.acknowledge(first, ack.flags);
+    }
+    return released;
+}
+
+void report(const char * test, const char * map, int window, size_t acks, double ns)
+{
+    printf("test=%s map=%s window=%d acks=%zu ns_per_ack=%.1f\n", test, map, window, acks, ns/acks);
+    fflush(stdout);
+}
+
+void usage(char * name)
+{
+    fprintf(stderr, "usage: %s [-n packets] [-l loss_percent] [-w max_window]\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    int packets = 2000000, maxWindow = 65536;
+    double loss = 0.01;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:l:w:")) != -1){
+        switch(opt){
+            case 'n': packets = atoi(optarg); break;
+            case 'l': loss = atof(optarg)/100.0; break;
+            case 'w': maxWindow = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if(packets < 1 || loss < 0 || loss >= 1){
+        usage(argv[0]);
+    }
+
+    for(int window = 128; window <= maxWindow; window *= 2) {
+        vector<int> order = arrivalOrder(packets, window, loss, 1);
+
+        vector<bench_ack_t> byteAcks, bitmapAcks;
+        byteAcks.reserve(order.size());
+        bitmapAcks.reserve(order.size());
+
+        double start = nowNs();
+        bytesReceiver(order, window, byteAcks);
+        report("sack_gen", "bytes", window, byteAcks.size(), nowNs() - start);
+
+        start = nowNs();
+        bitmapReceiver(order, window, bitmapAcks);
+        report("sack_gen", "bitmap", window, bitmapAcks.size(), nowNs() - start);
+
+        for(size_t i = 0; i < byteAcks.size(); i++) {
+            if(byteAcks[i].cumulative != bitmapAcks[i].cumulative || byteAcks[i].flags != bitmapAcks[i].flags){
+                fprintf(stderr, "window %d: ACK %zu differs\n", window, i);
+                return 1;
+            }
+        }
+
+        start = nowNs();
+        unsigned long long byteReleased = bytesSender(byteAcks, window);
+        report("sack_proc", "bytes", window, byteAcks.size(), nowNs() - start);
+
+        start = nowNs();
+        unsigned long long bitmapReleased = bitmapSender(bitmapAcks, window);
+        report("sack_proc", "bitmap", window, bitmapAcks.size(), nowNs() - start);
+
+        if(byteReleased != bitmapReleased){
+            fprintf(stderr, "window %d: %llu slots released with bytes, %llu with the bitmap\n", window, byteReleased, bitmapReleased);
+            return 1;
+        }
+    }
+    return 0;
+}
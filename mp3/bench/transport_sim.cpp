@@ -0,0 +1,228 @@
+/*
+ *
+ * Transport simulation benchmark
+ *
+ * Runs the real sender and receiver against a simulated path for every
+ * file size x RTT x loss x bandwidth cell, in virtual time. Each run is a
+ * forked child so function statics and globals start fresh. With -k the
+ * size is split into that many objects sent as multiplexed streams. Rows use the
+ * bench/matrix.sh CSV layout, so bench/compare.sh can diff two builds; the
+ * cpu columns are the CPU time each side actually used.
+ *
+ */
+
+#include "../tcp.h"
+#include "../simulator.h"
+#include <sys/wait.h>
+
+#define SIM_SPURIOUS_RATIO          (0.001)           // retransmissions allowed on a lossless path
+
+typedef struct {
+    int status;                         // 0 ok, 1 digest mismatch, 2 stalled, 3 retransmitted without loss
+    double completion;                  // virtual seconds
+    double senderCpu, receiverCpu;
+    transfer_stats_t counters;
+} sim_result_t;
+
+vector<double> parseList(const char * arg)
+{
+    vector<double> values;
+    string list(arg);
+    for(char * item = strtok(&list[0], ","); item != NULL; item = strtok(NULL, ",")) {
+        values.push_back(atof(item));
+    }
+    return values;
+}
+
+void makeSource(const char * path, unsigned long long size)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    vector<char> chunk(1 << 20);
+    uint64_t x = size + 1;
+    for(unsigned long long done = 0; done < size; done += chunk.size()) {
+        for(size_t i = 0; i < chunk.size(); i++) {
+            x = x*6364136223846793005ULL + 1442695040888963407ULL;
+            chunk[i] = x >> 56;
+        }
+        if(write(fd, &chunk[0], min((unsigned long long)chunk.size(), size - done)) < 0){
+            perror("write");
+            exit(1);
+        }
+    }
+    close(fd);
+}
+
+sim_result_t runCell(const char * sourcePath, unsigned long long size, int objects, sim_link_t forward, sim_link_t reverse,
+    uint64_t seed, unsigned long long limitUs)
+{
+    sim_result_t result;
+    memset(&result, 0, sizeof(result));
+    result.status = 2;
+
+    char destPath[64];
+    snprintf(destPath, sizeof(destPath), "transport_sim.%d.dest", getpid());
+
+    Simulator sim(forward, reverse, seed);
+    TCP receiver((char *)"0");
+    TCP sender((char *)"127.0.0.1", (char *)"9");
+    receiver.io = &sim.endpoints[SIM_RECEIVER];
+    receiver.options.writerThread = false;          // a thread of its own would run outside the simulation
+    sender.io = &sim.endpoints[SIM_SENDER];
+
+    FileListProvider files;
+    for(int i = 0; i < objects; i++) {
+        files.add(sourcePath, size/objects + (i < (int)(size % objects)));
+    }
+
+    bool sent = false, received = false;
+    bool finished = sim.run(
+        [&]{
+            sent = (objects > 1) ? sender.reliableSend(&files) : sender.reliableSend((char *)sourcePath, size);
+            result.completion = sim.now/(double)US_PER_SEC;
+        },
+        [&]{
+            received = receiver.reliableReceive(destPath);
+        },
+        limitUs);
+    result.senderCpu = sim.endpoints[SIM_SENDER].cpuSeconds;
+    result.receiverCpu = sim.endpoints[SIM_RECEIVER].cpuSeconds;
+
+    for(int i = 0; objects > 1 && i < objects; i++) {
+        unlink((string(destPath) + "/" + to_string(i)).c_str());
+    }
+    rmdir(destPath);
+    unlink(destPath);
+    unlink((string(destPath) + CHECKPOINT_SUFFIX).c_str());
+    if(finished){
+        result.status = (sent && received) ? 0 : 1;
+    }
+    result.counters = *sender.counters;
+    return result;
+}
+
+void usage(char * name)
+{
+    fprintf(stderr, "usage: %s [-s sizes] [-r rtts_ms] [-l loss_pct] [-b mbit] [-n runs] [-q queue_ms] [-m mtu] [-k objects] [-a] [-t limit_s] [-o out.csv]\n", name);
+    fprintf(stderr, "  lists are comma separated; -a loses ACKs as well as data; -k sends each size as that many streams\n");
+    fprintf(stderr, "  a run that retransmits on a lossless path is reported as spurious and fails\n");
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    vector<double> sizes = parseList("1000000,20000000");
+    vector<double> rtts = parseList("10,50,200");
+    vector<double> losses = parseList("0,1,5");
+    vector<double> rates = parseList("100");
+    int runs = 3;
+    int objects = 1;
+    double queueMs = 25.0;
+    uint32_t mtu = 1500;
+    bool lossyAcks = false;
+    double limitSec = 3600.0;
+    const char * outPath = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "s:r:l:b:n:q:m:k:at:o:")) != -1){
+        switch(opt){
+            case 's': sizes = parseList(optarg); break;
+            case 'r': rtts = parseList(optarg); break;
+            case 'l': losses = parseList(optarg); break;
+            case 'b': rates = parseList(optarg); break;
+            case 'n': runs = atoi(optarg); break;
+            case 'q': queueMs = atof(optarg); break;
+            case 'm': mtu = atoi(optarg); break;
+            case 'k': objects = max(atoi(optarg), 1); break;
+            case 'a': lossyAcks = true; break;
+            case 't': limitSec = atof(optarg); break;
+            case 'o': outPath = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    FILE * out = outPath ? fopen(outPath, "w") : stdout;
+    if(out == NULL){
+        perror(outPath);
+        return 1;
+    }
+    fprintf(out, "size,rtt_ms,loss_pct,rate_mbit,run,status,completion_s,goodput_mbit,retrans_ratio,timeouts,sender_cpu_s,receiver_cpu_s\n");
+
+    const char * statusNames[4] = {"ok", "corrupt", "fail", "spurious"};
+    double virtualTotal = 0.0, wallTotal = 0.0;
+    int failures = 0;
+
+    for(double size : sizes) {
+        const char * sourcePath = "transport_sim.source";
+        makeSource(sourcePath, (unsigned long long)size);
+
+        for(double rtt : rtts) {
+            for(double loss : losses) {
+                for(double rate : rates) {
+                    for(int run = 1; run <= runs; run++) {
+                        sim_link_t forward = {rtt/2, loss, rate, queueMs, mtu};
+                        sim_link_t reverse = {rtt/2, lossyAcks ? loss : 0.0, 0.0, queueMs, mtu};
+
+                        struct timeval start;
+                        gettimeofday(&start, 0);
+
+                        // a child per run: the transport keeps state in statics and globals
+                        int fds[2];
+                        if(pipe(fds) < 0){
+                            perror("pipe");
+                            return 1;
+                        }
+                        pid_t child = fork();
+                        if(child == 0){
+                            close(fds[0]);
+                            freopen("/dev/null", "w", stderr);
+                            sim_result_t result = runCell(sourcePath, (unsigned long long)size, objects, forward, reverse,
+                                run, (unsigned long long)(limitSec*US_PER_SEC));
+                            if(write(fds[1], &result, sizeof(result)) < 0){
+                                _exit(1);
+                            }
+                            _exit(0);
+                        }
+                        close(fds[1]);
+
+                        sim_result_t result;
+                        memset(&result, 0, sizeof(result));
+                        result.status = 2;
+                        if(read(fds[0], &result, sizeof(result)) != sizeof(result)){
+                            result.status = 2;
+                        }
+                        close(fds[0]);
+                        waitpid(child, NULL, 0);
+
+                        struct timeval end;
+                        gettimeofday(&end, 0);
+                        double wall = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec)/(double)US_PER_SEC;
+                        wallTotal += wall;
+                        virtualTotal += result.completion;
+
+                        double goodput = (result.completion > 0) ? size*8/result.completion/1e6 : 0.0;
+                        double ratio = (result.counters.packetsSent > 0) ?
+                            result.counters.packetsRetransmitted/(double)result.counters.packetsSent : 0.0;
+
+                        // with no loss configured every retransmission is a timer or duplicate ACK firing too early
+                        if(result.status == 0 && loss == 0 && ratio > SIM_SPURIOUS_RATIO){
+                            result.status = 3;
+                        }
+                        fprintf(out, "%.0f,%g,%g,%g,%d,%s,%.3f,%.2f,%.4f,%llu,%.3f,%.3f\n", size, rtt, loss, rate, run,
+                            statusNames[result.status], result.completion, goodput, ratio, result.counters.timeouts,
+                            result.senderCpu, result.receiverCpu);
+                        fflush(out);
+                        failures += (result.status != 0);
+                    }
+                }
+            }
+        }
+        unlink(sourcePath);
+    }
+
+    fprintf(stderr, "simulated %.1f s of transfers in %.1f s wall (%.0fx), %d failed\n",
+        virtualTotal, wallTotal, (wallTotal > 0) ? virtualTotal/wallTotal : 0.0, failures);
+    if(out != stdout){
+        fclose(out);
+    }
+    return failures > 0;
+}
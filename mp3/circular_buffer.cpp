@@ -6,7 +6,36 @@ int ackfd;
 struct sockaddr ackAddr;
 socklen_t ackAddrLen;
 
+// Where the last data packet came from, multipath ACKs follow their subflow
+struct sockaddr_storage replyAddr;
+socklen_t replyAddrLen;
+
+void PacketSlots::resize(size_t count, size_t payload)
+{
+    this->count = count;
+    capacity = sizeof(msg_header_t) + payload;
+    stride = (capacity + CACHE_LINE_SIZE - 1)/CACHE_LINE_SIZE*CACHE_LINE_SIZE;
+    storage.assign(count*stride, 0);
+}
+
 CircularBuffer::~CircularBuffer() {
+    delete source;
+    delete sink;
+    for (outgoing_stream_t & stream : sending) {
+        provider->close(stream.digest);
+        delete stream.source;
+    }
+    for (auto & stream : receiving) {
+        acceptor->close(stream.first, stream.second.digest, false);
+        delete stream.second.sink;
+    }
+    delete acceptor;
+    if (basisfd > 0) {
+        close(basisfd);
+    }
+    if (deltafd > 0) {
+        close(deltafd);
+    }
     if (sourcefd > 0) {
         close(sourcefd);
     }
@@ -20,16 +49,49 @@ void CircularBuffer::setSocketAddrInfo(int sockfd, struct sockaddr senderAddr, s
     ackfd = sockfd;
     ackAddr = senderAddr;
     ackAddrLen = senderAddrLen;
+    memcpy(&replyAddr, &senderAddr, senderAddrLen);
+    replyAddrLen = senderAddrLen;
+}
+
+void CircularBuffer::setReplyAddr(struct sockaddr * addr, socklen_t addrLen)
+{
+    memcpy(&replyAddr, addr, addrLen);
+    replyAddrLen = addrLen;
 }
 
 unsigned long long CircularBuffer::timeSinceStart()
 {
     struct timeval curTime;
-    gettimeofday(&curTime, 0);
+    io->now(&curTime);
 
     return US_PER_SEC*(curTime.tv_sec - start.tv_sec) + curTime.tv_usec - start.tv_usec;
 }
 
+// A file that is renamed, resized or rewritten gets a new id, so a receiver never resumes onto stale bytes
+static uint32_t sourceIdentity(int fd, const char * filename)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return 0;
+    }
+
+    const char * name = strrchr(filename, '/');
+    name = (name != NULL) ? name + 1 : filename;
+    uint64_t fields[] = {(uint64_t)st.st_size, (uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec};
+
+    // FNV-1a over the base name and then the fields
+    uint32_t id = 2166136261u;
+    for (size_t i = 0; name[i] != '\0'; i++) {
+        id = (id ^ (uint8_t)name[i]) * 16777619u;
+    }
+    for (size_t i = 0; i < sizeof(fields); i++) {
+        id = (id ^ ((uint8_t *)fields)[i]) * 16777619u;
+    }
+
+    // 0 is reserved for sources with no identity
+    return (id != 0) ? id : 1;
+}
+
 /*************** Send Buffer ***************/
 CircularBuffer::CircularBuffer(int size, char * filename, unsigned long long int bytesToSend)
 {
@@ -38,46 +100,236 @@ CircularBuffer::CircularBuffer(int size, char * filename, unsigned long long int
         std::cerr << "Unable to open source file\n";
         exit(1);
     }
+    destfd = -1;
+    sourceId = sourceIdentity(sourcefd, filename);
+
+    // the file is the first stage, encoders wrap it once the handshake settles
+    fileSource = new FileSource(sourcefd, bytesToSend);
+    source = fileSource;
+    sink = NULL;
+    fileSink = NULL;
+    uring = NULL;
+    sigBlockSize = 0;
+    basisfd = -1;
+    deltafd = -1;
 
     state.resize(size, AVAILABLE);
     timestamp.resize(size);
     length.resize(size);
-    data.resize(size);
+    data.resize(size, PAYLOAD);
 
     sIdx = 0;
     eIdx = INIT_SWS - 1;
     windowSize = INIT_SWS;
 
     payload = PAYLOAD;
-    seqNum = 0;
+    seqNum = SEQ_START;
+    endSeq = -1;
+    endRto = INIT_RTO;
     fileLoadCompleted = false;
     bytesToTransfer = bytesToSend;
+    provider = NULL;
+    acceptor = NULL;
 
-    gettimeofday(&start, 0);
+    io = &systemIO;
+    counters = NULL;
+    io->now(&start);
+}
+
+CircularBuffer::CircularBuffer(int size, StreamProvider * provider)
+{
+    // streams are opened as packets are filled, bytesToTransfer adds up as they finish
+    sourcefd = -1;
+    destfd = -1;
+    sourceId = 0;
+    fileSource = NULL;
+    source = NULL;
+    sink = NULL;
+    fileSink = NULL;
+    uring = NULL;
+    sigBlockSize = 0;
+    basisfd = -1;
+    deltafd = -1;
+
+    this->provider = provider;
+    acceptor = NULL;
+    compressStreams = false;
+    nextStream = 0;
+    nextStreamId = 0;
+    providerDone = false;
+
+    state.resize(size, AVAILABLE);
+    timestamp.resize(size);
+    length.resize(size);
+    data.resize(size, PAYLOAD);
+
+    sIdx = 0;
+    eIdx = INIT_SWS - 1;
+    windowSize = INIT_SWS;
+
+    payload = PAYLOAD;
+    seqNum = SEQ_START;
+    endSeq = -1;
+    endRto = INIT_RTO;
+    fileLoadCompleted = false;
+    bytesToTransfer = 0;
+
+    io = &systemIO;
+    counters = NULL;
+    io->now(&start);
 }
 
 void CircularBuffer::initialFill()
 {
     for(uint32_t i = 0; i < data.size(); i++) {
-        if(bytesToTransfer <= 0){
+        if(fillSlot(i) == false){
             fileLoadCompleted = true;
             return;
         }
+    }
+}
+
+bool CircularBuffer::fillSlot(uint32_t i)
+{
+    if(provider != NULL){
+        return fillStreamSlot(i);
+    }
+
+    // read data into buffer
+    int packetLength = source->read(data[i].msg, payload);
+    if(packetLength <= 0){
+        endStream(i, 0, (uint32_t)seqNum, (seqNum == SEQ_START) ? -1 : (int)((i + data.size() - 1) % data.size()), fileSource, true);
+        return false;
+    }
+
+    // initialize header
+    data[i].header.type = DATA_HEADER;
+    data[i].header.seqNum = htonl((uint32_t)seqNum++);
+    length[i] = packetLength + sizeof(msg_header_t);
+    data[i].header.crc = 0;
+    data[i].header.crc = htonl(crc32c(0, &data[i], length[i]));
+
+    // book keeping
+    state.set(i, FILLED);
+    return true;
+}
+
+bool CircularBuffer::fillStreamSlot(uint32_t i)
+{
+    while(true){
+        openStreams();
+        if(sending.empty()){
+            // nothing was offered at all, the connection still needs its end
+            endStream(i, NO_STREAM, 0, -1, NULL, true);
+            return false;
+        }
 
-        int packetLength = min((unsigned long long)payload, bytesToTransfer);
+        // packets take turns between the open streams, so a small one is not queued behind a large one
+        nextStream = nextStream % sending.size();
+        outgoing_stream_t & stream = sending[nextStream];
+        int packetLength = stream.source->read(payloadOf(i), payload - sizeof(stream_header_t));
+        if(packetLength > 0){
+            data[i].header.type = DATA_HEADER;
+            data[i].header.seqNum = htonl((uint32_t)seqNum++);
+            streamHeader(i).stream = htonl(stream.id);
+            streamHeader(i).streamSeq = htonl(stream.nextSeq++);
+            length[i] = packetLength + headerLength();
+            data[i].header.crc = 0;
+            data[i].header.crc = htonl(crc32c(0, &data[i], length[i]));
+
+            state.set(i, FILLED);
+            stream.lastSlot = i;
+            nextStream++;
+            return true;
+        }
 
-        // initialize header
-        data[i].header.type = DATA_HEADER;
-        data[i].header.seqNum = htonl(seqNum++);
-        length[i] = packetLength + sizeof(msg_header_t);
+        // exhausted: the stream's end goes out, the last stream to end also ends the connection
+        outgoing_stream_t done = stream;
+        sending.erase(sending.begin() + nextStream);
+        openStreams();
+        bool last = sending.empty();
+        bool filled = endStream(i, done.id, done.nextSeq, done.lastSlot, done.digest, last);
+
+        bytesToTransfer += done.digest->digestLength;
+        provider->close(done.digest);
+        delete done.source;
+
+        if(last){
+            return false;
+        }else if(filled){
+            return true;
+        }
+    }
+}
 
-        // read data into buffer
-        read(sourcefd, data[i].msg, packetLength);
+void CircularBuffer::openStreams()
+{
+    while(providerDone == false && sending.size() < MAX_OPEN_STREAMS){
+        outgoing_stream_t stream;
+        stream.source = provider->open(stream.digest);
+        if(stream.source == NULL){
+            providerDone = true;
+            return;
+        }
+        if(compressStreams){
+            stream.source = new CompressEncoder(stream.source);
+        }
+        stream.id = nextStreamId++;
+        stream.nextSeq = 0;
+        stream.lastSlot = -1;
+        sending.push_back(stream);
+    }
+}
 
-        // book keeping
-        state[i] = FILLED;
-        bytesToTransfer -= packetLength;
+bool CircularBuffer::endStream(uint32_t i, uint32_t stream, uint32_t streamSeq, int lastSlot, FileSource * digest, bool last)
+{
+    // the stream's newest packet carries its end when it has room and is still unsent (and, to end
+    // the connection, is the newest packet of all); otherwise slot i becomes an empty one
+    bool inPlace = lastSlot >= 0 && state.get(lastSlot) == FILLED && length[lastSlot] + sizeof(fin_trailer_t) <= data.capacity
+        && (provider == NULL || (ntohl(streamHeader(lastSlot).stream) == stream && ntohl(streamHeader(lastSlot).streamSeq) + 1 == streamSeq))
+        && (last == false || ntohl(data[lastSlot].header.seqNum) + 1 == (uint32_t)seqNum);
+    uint32_t end = inPlace ? lastSlot : i;
+    if(inPlace == false){
+        data[end].header.seqNum = htonl((uint32_t)seqNum++);
+        if(provider != NULL){
+            streamHeader(end).stream = htonl(stream);
+            streamHeader(end).streamSeq = htonl(streamSeq);
+        }
+        length[end] = headerLength();
+        state.set(end, FILLED);
     }
+    // either way the end is the newest packet, and the header only has the low bits
+    if(last){
+        endSeq = seqNum - 1;
+    }
+
+    // the source is exhausted, so the digest covers the whole file
+    fin_trailer_t trailer;
+    trailer.digest = htonl(digest ? digest->digest : 0);
+    trailer.length = htobe64(digest ? digest->digestLength : 0);
+    trailer.rto = htonl(endRto);
+    memcpy((char *)&data[end] + length[end], &trailer, sizeof(trailer));
+    length[end] += sizeof(fin_trailer_t);
+
+    data[end].header.type = last ? DATA_FIN_HEADER : STREAM_FIN_HEADER;
+    data[end].header.crc = 0;
+    data[end].header.crc = htonl(crc32c(0, &data[end], length[end]));
+    return inPlace == false;
+}
+
+unsigned int CircularBuffer::headerLength()
+{
+    return sizeof(msg_header_t) + ((provider != NULL || acceptor != NULL) ? sizeof(stream_header_t) : 0);
+}
+
+stream_header_t & CircularBuffer::streamHeader(uint32_t i)
+{
+    return *(stream_header_t *)data[i].msg;
+}
+
+char * CircularBuffer::payloadOf(uint32_t i)
+{
+    return (char *)&data[i] + headerLength();
 }
 
 bool CircularBuffer::outsideWindow(uint32_t index)
@@ -92,29 +344,65 @@ bool CircularBuffer::outsideWindow(uint32_t index)
 }
 
 
-void CircularBuffer::fillBuffer()
+void CircularBuffer::seekSource(unsigned long long offset)
 {
-    static uint32_t i = 0;
-    for( ; i < data.size(); i = (i + 1)%BUFFER_SIZE) {
-        if(bytesToTransfer <= 0){
-            fileLoadCompleted = true;
-            return;
-        }
+    offset = min(offset, bytesToTransfer);
+    if (lseek(sourcefd, offset, SEEK_SET) < 0) {
+        perror("lseek");
+        exit(1);
+    }
+    fileSource->remaining = bytesToTransfer - offset;
 
-        if(state[i] == AVAILABLE){
-            int packetLength = min((unsigned long long)payload, bytesToTransfer);
+    // the FIN digest still covers the whole file
+    fileSource->digest = crc32cFile(sourcefd, offset);
+    fileSource->digestLength = offset;
+}
 
-            // initialize header
-            data[i].header.type = DATA_HEADER;
-            data[i].header.seqNum = htonl(seqNum++);
-            length[i] = packetLength + sizeof(msg_header_t);
+void CircularBuffer::useUring(UringIO * ring)
+{
+    uring = ring;
+
+    // a single file is read ahead through registered blocks, streams keep their own reads
+    if(fileSource != NULL && source == fileSource){
+        fileSource = new UringFileSource(ring, sourcefd, fileSource->remaining);
+        delete source;
+        source = fileSource;
+    }
+}
+
+void CircularBuffer::encodeDelta()
+{
+    source = new DeltaEncoder(source, sigBlockSize, signatures);
+}
+
+void CircularBuffer::setPayload(unsigned int newPayload)
+{
+    // only before any packet is stored, slots are re-laid out
+    if(newPayload != payload){
+        payload = newPayload;
+        data.resize(data.size(), payload);
+    }
+}
 
-            // read data into buffer
-            read(sourcefd, data[i].msg, packetLength);
+void CircularBuffer::encodeCompression()
+{
+    // multiplexed streams are wrapped as they open
+    if(provider != NULL){
+        compressStreams = true;
+        return;
+    }
+    source = new CompressEncoder(source);
+}
 
-            // book keeping
-            state[i] = FILLED;
-            bytesToTransfer -= packetLength;
+void CircularBuffer::fillBuffer()
+{
+    static uint32_t i = 0;
+    for( ; i < data.size(); i = (i + 1)%BUFFER_SIZE) {
+        if(state.get(i) == AVAILABLE){
+            if(fillSlot(i) == false){
+                fileLoadCompleted = true;
+                return;
+            }
         }else{
             break;
         }
@@ -124,107 +412,534 @@ void CircularBuffer::fillBuffer()
 /*************** Receive Buffer ***************/
 CircularBuffer::CircularBuffer(int size, char * filename)
 {
-    destfd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (destfd < 0) {
-        std::cerr << "Unable to open dest file\n";
-        exit(1);
+    // the sender's SYN says whether filename is one file (openDest) or a directory of streams (acceptStreams)
+    destfd = -1;
+    sourcefd = -1;
+    basisfd = -1;
+    deltafd = -1;
+    destPath = filename;
+    directIO = false;
+    uring = NULL;
+    io = &systemIO;
+    counters = NULL;
+
+    source = NULL;
+    fileSource = NULL;
+    sink = NULL;
+    fileSink = NULL;
+    provider = NULL;
+    acceptor = NULL;
+    compressStreams = false;
+    streamsFailed = 0;
+    bytesToTransfer = 0;
+
+    // checkpoint holds "<contiguous bytes on disk> <file size of that transfer> <source id>",
+    // one without the id predates it and can't be trusted
+    checkpointPath = string(filename) + CHECKPOINT_SUFFIX;
+    checkpointOffset = 0;
+    checkpointFileSize = 0;
+    checkpointSourceId = 0;
+    ifstream checkpoint(checkpointPath);
+    if (!(checkpoint >> checkpointOffset >> checkpointFileSize >> checkpointSourceId)) {
+        checkpointOffset = 0;
+        checkpointFileSize = 0;
+        checkpointSourceId = 0;
     }
+    bytesWritten = 0;
+    syncingOffset = 0;
+    lastCheckpoint = 0;
+    checkpointEnabled = false;
 
     state.resize(size, WAITING);
-    data.resize(size);
+    data.resize(size, PAYLOAD);
     length.resize(size);
+    payload = PAYLOAD;
 
-    seqNum = 0;
+    seqNum = SEQ_START;
     sIdx = 0;
+    flushedSeq = SEQ_START;
+    accepted = 0;
+    acceptedSeen = 0;
+    highSeq = SEQ_START;
+    advertisedWindow = BUFFER_SIZE;
+    endSeq = -1;
+    endDigest = 0;
+    endLength = 0;
+    endRto = 0;
+    writerRunning = false;
 }
 
 void CircularBuffer::flushBuffer()
 {
-    for(size_t i = 0; i < data.size(); i++) {
-        if(state[sIdx] == RECEIVED){
-            // write to file
-            write(destfd, data[sIdx].msg, length[sIdx]);
-            // recvfile << "Writing to file: " <<  data[sIdx].header.seqNum << "\n";
+    // everything below seqNum is complete and in order; multiplexed streams are also delivered
+    // past it, each as far as its own packets are complete
+    __atomic_store_n(&acceptedSeen, __atomic_load_n(&accepted, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    seq_t ready = __atomic_load_n(&seqNum, __ATOMIC_ACQUIRE);
+    seq_t last = (acceptor != NULL) ? __atomic_load_n(&highSeq, __ATOMIC_ACQUIRE) : ready;
+    if(flushedSeq == last){
+        return;
+    }
+
+    struct timespec flushStart, flushEnd;
+    clock_gettime(CLOCK_MONOTONIC, &flushStart);
 
-            // book keeping
-            state[sIdx] = WAITING;
-            sIdx = (sIdx+1)%BUFFER_SIZE;
-        } else{
+    for(seq_t seq = flushedSeq; seq != last; seq++) {
+        // slots still waiting for their packet are passed over a word at a time
+        seq += state.received.gapLength(seq % BUFFER_SIZE, last - seq);
+        if(seq == last){
             break;
         }
+        uint32_t idx = seq % BUFFER_SIZE;
+        packet_state_t slot = state.get(idx);
+        if(slot == RECEIVED && deliverable(idx)){
+            deliverPacket(idx);
+            slot = DELIVERED;
+        }
+        if(slot != DELIVERED){
+            continue;
+        }
+
+        // hand the slot back to the receiving thread once the cumulative ACK covers it
+        if(seq == flushedSeq && seq < ready){
+            state.set(idx, WAITING);
+            __atomic_store_n(&flushedSeq, flushedSeq + 1, __ATOMIC_RELEASE);
+        }else{
+            state.set(idx, DELIVERED);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &flushEnd);
+    unsigned long long latency = US_PER_SEC*(flushEnd.tv_sec - flushStart.tv_sec) + (flushEnd.tv_nsec - flushStart.tv_nsec)/1000;
+    statSet(counters->flushLatency, latency);
+    statSet(counters->flushLatencyMax, max(latency, counters->flushLatencyMax));
+    statSet(counters->bytesWritten, bytesWritten);
+
+    if(checkpointEnabled && bytesWritten - lastCheckpoint >= CHECKPOINT_INTERVAL){
+        saveCheckpoint();
     }
 }
 
-uint64_t CircularBuffer::createFlags(uint32_t & counter)
+bool CircularBuffer::deliverable(uint32_t idx)
+{
+    if(acceptor == NULL || streamHeader(idx).stream == NO_STREAM){
+        return true;
+    }
+
+    // a stream's packets are numbered in order, it has delivered everything before this one
+    map<uint32_t, incoming_stream_t>::iterator stream = receiving.find(streamHeader(idx).stream);
+    uint32_t next = (stream == receiving.end()) ? 0 : stream->second.nextSeq;
+    return streamHeader(idx).streamSeq == next;
+}
+
+void CircularBuffer::deliverPacket(uint32_t idx)
 {
-    uint64_t flags = 0;
-    uint64_t mask = 1;
-    counter = 0;
+    msg_packet_t & packet = data[idx];
+    bytesWritten += length[idx];
+    if(acceptor == NULL){
+        sink->write(packet.msg, length[idx]);
+        return;
+    }
+    uint32_t id = streamHeader(idx).stream;
+    if(id == NO_STREAM){
+        return;
+    }
 
-    uint32_t j = seqNum%data.size();                // index for expected message
-    for(size_t i = 0; i < FLAG_SIZE; i++) {
-        if(state[j] == RECEIVED){
-            flags = flags | mask;
-            counter++;
+    // the first packet opens the stream; its own 32 bit numbering may wrap later, so a 0 alone is not a start
+    bool opening = receiving.count(id) == 0;
+    incoming_stream_t & stream = receiving[id];
+    if(opening){
+        stream.sink = acceptor->accept(id, stream.digest);
+        if(compressStreams){
+            stream.sink = new CompressDecoder(stream.sink);
         }
-        mask = mask << 1;
-        j = (j + 1)%BUFFER_SIZE;
+        stream.nextSeq = 0;
+    }
+    stream.sink->write(payloadOf(idx), length[idx]);
+    stream.nextSeq++;
+    if(packet.header.type == DATA_HEADER){
+        return;
     }
 
+    // its end carries the digest, storeReceivedPacket left the trailer past the payload
+    fin_trailer_t trailer;
+    memcpy(&trailer, payloadOf(idx) + length[idx], sizeof(trailer));
+    stream.sink->finish();
+    bool verified = stream.digest->digest == ntohl(trailer.digest) && stream.digest->digestLength == be64toh(trailer.length);
+    streamsFailed += (verified == false);
+    bytesToTransfer += stream.digest->digestLength;
+
+    acceptor->close(id, stream.digest, verified);
+    delete stream.sink;
+    receiving.erase(id);
+}
+
+void CircularBuffer::startWriter()
+{
+    writerStop = false;
+    writerIdle = false;
+    writerRunning = true;
+    writer = thread(&CircularBuffer::writerMain, this);
+}
+
+void CircularBuffer::stopWriter()
+{
+    if(!writerRunning){
+        return;
+    }
+
+    // the writer drains whatever is complete before it exits
+    {
+        unique_lock<mutex> held(writerLock);
+        writerStop = true;
+    }
+    writerCV.notify_one();
+    writer.join();
+    writerRunning = false;
+}
+
+void CircularBuffer::wakeWriter()
+{
+    // pairs with writerMain(): either it sees the new seqNum or we see it idle
+    if(__atomic_load_n(&writerIdle, __ATOMIC_SEQ_CST)){
+        unique_lock<mutex> held(writerLock);
+        writerCV.notify_one();
+    }
+}
+
+void CircularBuffer::writerMain()
+{
+    while(true){
+        {
+            unique_lock<mutex> held(writerLock);
+            __atomic_store_n(&writerIdle, true, __ATOMIC_SEQ_CST);
+            writerCV.wait(held, [&]{ return __atomic_load_n(&seqNum, __ATOMIC_SEQ_CST) != flushedSeq || writerStop
+                || (acceptor != NULL && __atomic_load_n(&accepted, __ATOMIC_SEQ_CST) != acceptedSeen); });
+            __atomic_store_n(&writerIdle, false, __ATOMIC_SEQ_CST);
+
+            if(writerStop && __atomic_load_n(&seqNum, __ATOMIC_SEQ_CST) == flushedSeq){
+                break;
+            }
+        }
+
+        flushBuffer();
+
+        // the sender may be holding back on a nearly closed window, tell it the disk caught up
+        if(__atomic_load_n(&advertisedWindow, __ATOMIC_RELAXED) < RWND_UPDATE_THRESHOLD){
+            sendWindowUpdate();
+        }
+    }
+}
+
+uint16_t CircularBuffer::receiveWindow()
+{
+    // slots the writer has released beyond the cumulative ACK; out of order packets sit inside it
+    seq_t next = __atomic_load_n(&seqNum, __ATOMIC_ACQUIRE);
+    return BUFFER_SIZE - (next - __atomic_load_n(&flushedSeq, __ATOMIC_ACQUIRE));
+}
+
+bool CircularBuffer::streamComplete()
+{
+    // endSeq is set before seqNum can move past it
+    seq_t next = __atomic_load_n(&seqNum, __ATOMIC_ACQUIRE);
+    seq_t end = __atomic_load_n(&endSeq, __ATOMIC_RELAXED);
+    return end >= 0 && next > end;
+}
+
+void CircularBuffer::sendWindowUpdate()
+{
+    // once complete only the FIN + ACK may acknowledge the end of stream
+    if(streamComplete()){
+        return;
+    }
+
+    ack_packet_t ack;
+    ack.type = ACK_HEADER;
+    ack.seqNum = htonl((uint32_t)(__atomic_load_n(&seqNum, __ATOMIC_ACQUIRE) - 1));
+    ack.window = htons(receiveWindow());
+    __atomic_store_n(&advertisedWindow, ntohs(ack.window), __ATOMIC_RELAXED);
+    io->sendTo(ackfd, (char *)&ack, sizeof(ack_packet_t), &ackAddr, ackAddrLen);
+}
+
+void CircularBuffer::openDest()
+{
+    // Truncation is deferred to openDestAt() so a checkpointed file or delta basis survives a restart
+    destfd = open(destPath.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (destfd < 0) {
+        std::cerr << "Unable to open dest file\n";
+        exit(1);
+    }
+}
+
+void CircularBuffer::acceptStreams(StreamAcceptor * acceptor)
+{
+    this->acceptor = acceptor;
+}
+
+unsigned long long CircularBuffer::resumeOffsetFor(unsigned long long fileSize, uint32_t sourceId)
+{
+    struct stat st;
+
+    // only resume the same source, and never past what actually reached the disk
+    if(sourceId != 0 && checkpointSourceId == sourceId && checkpointFileSize == fileSize && fstat(destfd, &st) == 0 && (unsigned long long)st.st_size >= checkpointOffset){
+        return min(checkpointOffset, fileSize);
+    }
+
+    return 0;
+}
+
+void CircularBuffer::openDestAt(unsigned long long offset, unsigned long long fileSize, uint32_t sourceId)
+{
+    if(ftruncate(destfd, offset) < 0 || lseek(destfd, offset, SEEK_SET) < 0){
+        perror("resume");
+        exit(1);
+    }
+
+    if(directIO){
+        fileSink = new DirectFileSink(destfd, destPath, offset, fileSize);
+    }else if(uring != NULL){
+        fileSink = new UringFileSink(uring, destfd);
+    }else{
+        fileSink = new FileSink(destfd);
+    }
+    sink = fileSink;
+    checkpointEnabled = true;
+    checkpointFileSize = fileSize;
+    checkpointSourceId = sourceId;
+    bytesWritten = offset;
+    lastCheckpoint = offset;
+
+    // the FIN digest covers the resumed prefix too
+    fileSink->digest = crc32cFile(destfd, offset);
+    fileSink->digestLength = offset;
+}
+
+bool CircularBuffer::prepareDelta()
+{
+    struct stat st;
+
+    basisfd = open(destPath.c_str(), O_RDONLY);
+    if(basisfd < 0 || fstat(basisfd, &st) < 0 || S_ISREG(st.st_mode) == false){
+        return false;
+    }
+
+    // too small to share a single block, a plain transfer is cheaper
+    sigBlockSize = deltaBlockSize(st.st_size);
+    if((unsigned long long)st.st_size < sigBlockSize){
+        close(basisfd);
+        basisfd = -1;
+        return false;
+    }
+
+    computeSignatures(basisfd, st.st_size, sigBlockSize, signatures);
+    return true;
+}
+
+void CircularBuffer::decodeDelta()
+{
+    // the basis is read while the new copy is built beside it
+    string deltaPath = destPath + DELTA_SUFFIX;
+    deltafd = open(deltaPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (deltafd < 0) {
+        std::cerr << "Unable to open delta file\n";
+        exit(1);
+    }
+
+    fileSink = new FileSink(deltafd);
+    sink = new DeltaDecoder(basisfd, sigBlockSize, fileSink);
+    basisfd = -1;
+}
+
+void CircularBuffer::decodeCompression()
+{
+    // multiplexed streams are wrapped as they open
+    if(acceptor != NULL){
+        compressStreams = true;
+        return;
+    }
+    // decompression runs first, ahead of any delta decoding
+    sink = new CompressDecoder(sink);
+}
+
+bool CircularBuffer::verifyDigest(uint32_t digest, unsigned long long length)
+{
+    // multiplexed streams were checked as each one ended, the acceptor may still have files to finish
+    if(acceptor != NULL){
+        bool finished = acceptor->finish();
+        return finished && streamsFailed == 0 && receiving.empty();
+    }
+    sink->finish();
+    return fileSink->digest == digest && fileSink->digestLength == length;
+}
+
+void CircularBuffer::completeTransfer()
+{
+    if(deltafd >= 0){
+        string deltaPath = destPath + DELTA_SUFFIX;
+        rename(deltaPath.c_str(), destPath.c_str());
+    }
+
+    // everything is on disk, nothing left to resume
+    clearCheckpoint();
+}
+
+void CircularBuffer::saveCheckpoint()
+{
+    // a direct sink's partial buffer is not even written, nor are a ring sink's writes in flight
+    unsigned long long onDisk = bytesWritten - min(bytesWritten, (unsigned long long)fileSink->pending());
+
+    // without a writer thread a datasync would stall receiving: the ring runs it, later flushes look in until it is done
+    if(uring != NULL){
+        if(uring->syncDone() == false){
+            return;
+        }
+        if(syncingOffset > 0){
+            if(writeCheckpoint(syncingOffset)){
+                lastCheckpoint = bytesWritten;
+            }
+            syncingOffset = 0;
+            return;
+        }
+        syncingOffset = onDisk;
+        uring->startSync(destfd);
+        return;
+    }
+
+    // data must be durable before the checkpoint claims it
+    fdatasync(destfd);
+    if(writeCheckpoint(onDisk)){
+        lastCheckpoint = bytesWritten;
+    }
+}
+
+bool CircularBuffer::writeCheckpoint(unsigned long long onDisk)
+{
+    string tmpPath = checkpointPath + ".tmp";
+    ofstream checkpoint(tmpPath, std::ios::trunc);
+    checkpoint << onDisk << " " << checkpointFileSize << " " << checkpointSourceId << "\n";
+    checkpoint.close();
+
+    if(checkpoint.good() == false){
+        return false;
+    }
+    rename(tmpPath.c_str(), checkpointPath.c_str());
+    return true;
+}
+
+void CircularBuffer::clearCheckpoint()
+{
+    unlink(checkpointPath.c_str());
+}
+
+uint64_t CircularBuffer::createFlags(uint32_t & counter)
+{
+    // slots at or past this still hold packets the writer has not released
+    seq_t limit = __atomic_load_n(&flushedSeq, __ATOMIC_ACQUIRE) + BUFFER_SIZE;
+
+    // bit i is the expected packet + i
+    int slots = min(limit - seqNum, (seq_t)FLAG_SIZE);
+    uint64_t flags = (slots > 0) ? state.received.extract(seqNum % BUFFER_SIZE, slots) : 0;
+    counter = __builtin_popcountll(flags);
     return flags;
 }
 
 void CircularBuffer::sendAck()
 {
+    seq_t next = seqNum;
+    seq_t limit = __atomic_load_n(&flushedSeq, __ATOMIC_ACQUIRE) + BUFFER_SIZE;
 
-    uint32_t j = seqNum%BUFFER_SIZE;                // index for expected message
-    for(size_t i = 0; i < BUFFER_SIZE; i++) {
-        if(state[j] == RECEIVED){
-            seqNum++;
-            j = (j+1)%BUFFER_SIZE;
-        } else{
-            break;
-        }
+    // the cumulative ACK moves over every stored packet in a row
+    if(next < limit){
+        next += state.received.runLength(next % BUFFER_SIZE, limit - next);
+    }
+    __atomic_store_n(&seqNum, next, __ATOMIC_SEQ_CST);
+
+    // the FIN + ACK goes out once the digest is checked
+    if(streamComplete()){
+        return;
     }
 
     uint32_t counter;
     uint64_t flags = createFlags(counter);
+    uint16_t window = receiveWindow();
+    __atomic_store_n(&advertisedWindow, window, __ATOMIC_RELAXED);
     if(counter >= CS_ACK_THRESHOLD){
         ack_packet_wf_t ack_wf;
         ack_wf.type = ACK_HEADER_W_FLAGS;
-        ack_wf.seqNum = htonl(seqNum - 1);
+        ack_wf.seqNum = htonl((uint32_t)(seqNum - 1));
+        ack_wf.window = htons(window);
         ack_wf.flags = htobe64(flags);
-        sendto(ackfd, (char *)&ack_wf, sizeof(ack_packet_wf_t), 0, &ackAddr, ackAddrLen);
+        io->sendTo(ackfd, (char *)&ack_wf, sizeof(ack_packet_wf_t), (struct sockaddr *)&replyAddr, replyAddrLen);
     }else{
         ack_packet_t ack;
         ack.type = ACK_HEADER;
-        ack.seqNum = htonl(seqNum - 1);
-        sendto(ackfd, (char *)&ack, sizeof(ack_packet_t), 0, &ackAddr, ackAddrLen);
+        ack.seqNum = htonl((uint32_t)(seqNum - 1));
+        ack.window = htons(window);
+        io->sendTo(ackfd, (char *)&ack, sizeof(ack_packet_t), (struct sockaddr *)&replyAddr, replyAddrLen);
     }
 
 }
 
 void CircularBuffer::storeReceivedPacket(msg_packet_t & packet, uint32_t packetLength)
 {
-    ack_packet_t ack;
-    ack.type = ACK_HEADER;
+    // drop anything damaged in flight, the sender will retransmit it
+    uint32_t crc = ntohl(packet.header.crc);
+    packet.header.crc = 0;
+    if(packetLength < headerLength() || packetLength > data.capacity || crc32c(0, &packet, packetLength) != crc){
+        return;
+    }
+
+    // the low 32 bits name the packet nearest the cumulative ACK, everything acceptable is within a window of it
     packet.header.seqNum = ntohl(packet.header.seqNum);
-    size_t bufIdx = packet.header.seqNum % data.size();
+    if(acceptor != NULL){
+        stream_header_t * streamFields = (stream_header_t *)packet.msg;
+        streamFields->stream = ntohl(streamFields->stream);
+        streamFields->streamSeq = ntohl(streamFields->streamSeq);
+    }
+    seq_t seq = seqUnwrap(packet.header.seqNum, seqNum);
+    size_t bufIdx = seq % data.size();
 
-    if(packet.header.seqNum == seqNum - 1){
-        ack.seqNum = htonl(seqNum - 1);
-        sendto(ackfd, (char *)&ack, sizeof(ack_packet_t), 0, &ackAddr, ackAddrLen);
+    // already placed: the ACK that covered it may have been lost, so repeat the cumulative one
+    if(seq < seqNum){
+        sendWindowUpdate();
         return;
-    }else if(packet.header.seqNum < seqNum){
+    }
+
+    // past the advertised window: the slot still belongs to unwritten data
+    seq_t flushed = __atomic_load_n(&flushedSeq, __ATOMIC_ACQUIRE);
+    if(seq >= flushed + BUFFER_SIZE){
         return;
     }
 
-    if(state[bufIdx] == WAITING){
-        state[bufIdx] = RECEIVED;
+    if(state.get(bufIdx) == WAITING){
+        memcpy(&data[bufIdx], &packet, packetLength);
+        length[bufIdx] = packetLength - headerLength();
+        if(packet.header.type != DATA_HEADER){
+            // the trailer stays in the slot past the payload, a stream's end is checked on delivery
+            if(length[bufIdx] < sizeof(fin_trailer_t)){
+                return;
+            }
+            fin_trailer_t trailer;
+            length[bufIdx] -= sizeof(fin_trailer_t);
+            memcpy(&trailer, payloadOf(bufIdx) + length[bufIdx], sizeof(trailer));
+            if(packet.header.type == DATA_FIN_HEADER){
+                endDigest = ntohl(trailer.digest);
+                endLength = be64toh(trailer.length);
+                endRto = ntohl(trailer.rto);
+                __atomic_store_n(&endSeq, seq, __ATOMIC_RELAXED);
+            }
+        }
+        state.set(bufIdx, RECEIVED);
+        if(seq >= highSeq){
+            __atomic_store_n(&highSeq, seq + 1, __ATOMIC_RELEASE);
+        }
+        __atomic_add_fetch(&accepted, 1, __ATOMIC_RELEASE);
         sendAck();
-        data[bufIdx] = packet;
-        length[bufIdx] = packetLength - sizeof(msg_header_t);
+        statSet(counters->bufferOccupancy, accepted - flushed);
     }
 
-    flushBuffer();
+    if(writerRunning){
+        wakeWriter();
+    }else{
+        flushBuffer();
+    }
 }
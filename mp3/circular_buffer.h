@@ -3,6 +3,33 @@
 
 #include "parameters.h"
 #include "types.h"
+#include "stream.h"
+#include "direct.h"
+#include "uring.h"
+#include "delta.h"
+#include "compress.h"
+#include "netio.h"
+#include "stats.h"
+#include "arena.h"
+#include "scoreboard.h"
+
+// Packet storage whose slots follow the connection's payload size, each starting on a cache line
+class PacketSlots
+{
+    public:
+        PacketSlots() : capacity(0), stride(0), count(0) {}
+
+        void resize(size_t count, size_t payload);
+        msg_packet_t & operator[](size_t i) { return *(msg_packet_t *)&storage[i*stride]; }
+        size_t size() const { return count; }
+
+        size_t capacity;                            // largest packet a slot holds, header included
+        size_t stride;                              // capacity rounded up to a cache line
+
+    private:
+        SlotArray<char> storage;
+        size_t count;
+};
 
 class CircularBuffer
 {
@@ -10,21 +37,68 @@ class CircularBuffer
         // Constructor
         CircularBuffer(){}
         CircularBuffer(int size, char * filename, unsigned long long int bytesToSend);
+        CircularBuffer(int size, StreamProvider * provider);
         CircularBuffer(int size, char * filename);
         ~CircularBuffer();
 
         // sender member function
         void initialFill();
         void fillBuffer();
+        bool fillSlot(uint32_t i);
+        bool fillStreamSlot(uint32_t i);
+        void openStreams();
+        bool endStream(uint32_t i, uint32_t stream, uint32_t streamSeq, int lastSlot, FileSource * digest, bool last);
         bool outsideWindow(uint32_t index);
+        void setPayload(unsigned int newPayload);
+        void seekSource(unsigned long long offset);
+        void encodeDelta();
+        // both: file reads or writes go through the ring, call before the first of them
+        void useUring(UringIO * ring);
+        void encodeCompression();
+
+        // both: data packets start with a stream_header_t only when streams were negotiated
+        unsigned int headerLength();
+        stream_header_t & streamHeader(uint32_t i);
+        char * payloadOf(uint32_t i);
 
         // receiver member function
         void storeReceivedPacket(msg_packet_t & packet, uint32_t packetLength);
         void flushBuffer();
+        bool deliverable(uint32_t idx);
+        void deliverPacket(uint32_t idx);
         void sendAck();
         uint64_t createFlags(uint32_t & counter);
+        uint16_t receiveWindow();
+        void sendWindowUpdate();
+        bool streamComplete();
+
+        // receiver disk writer, drains in order packets while the network thread keeps receiving
+        void startWriter();
+        void stopWriter();
+        void wakeWriter();
+        void writerMain();
+
+        bool verifyDigest(uint32_t digest, unsigned long long length);
+        void completeTransfer();
+
+        // receiver destination, a single file or a directory of streams
+        void openDest();
+        void acceptStreams(StreamAcceptor * acceptor);
+
+        // receiver resume checkpointing
+        unsigned long long resumeOffsetFor(unsigned long long fileSize, uint32_t sourceId);
+        void openDestAt(unsigned long long offset, unsigned long long fileSize, uint32_t sourceId);
+        void saveCheckpoint();
+        bool writeCheckpoint(unsigned long long onDisk);
+        void clearCheckpoint();
+
+        // receiver delta basis
+        bool prepareDelta();
+        void decodeDelta();
+        void decodeCompression();
 
         void setSocketAddrInfo(int sockfd, struct sockaddr senderAddr, socklen_t senderAddrLen);
+        void setReplyAddr(struct sockaddr * addr, socklen_t addrLen);
 
         // member variables
         condition_variable openWinCV;
@@ -33,13 +107,29 @@ class CircularBuffer
         unsigned int payload;
 
         // seqNum
-        int seqNum;
+        seq_t seqNum;
+
+        // receiver: packets handed to the sink, stored so far, and the last window sent
+        seq_t flushedSeq;
+        unsigned long long accepted, acceptedSeen;
+        uint16_t advertisedWindow;
+
+        // end of stream: sequence number of the DATA_FIN packet (-1 until seen) and its trailer
+        seq_t endSeq;
+        uint32_t endDigest;
+        unsigned long long endLength;
+        uint32_t endRto;                            // sender: RTO to put in the trailer, microseconds
+
+        thread writer;
+        mutex writerLock;
+        condition_variable writerCV;
+        bool writerRunning, writerStop, writerIdle;
 
         // data
-        vector<packet_state_t> state;
-        vector<struct timeval> timestamp;
-        vector<msg_packet_t> data;
-        vector<uint32_t> length;
+        Scoreboard state;
+        SlotArray<struct timeval> timestamp;
+        PacketSlots data;
+        SlotArray<uint32_t> length;
 
         mutex pktLocks[BUFFER_SIZE];
         condition_variable senderCV;
@@ -47,9 +137,51 @@ class CircularBuffer
 
         // Meta data
         unsigned long long int bytesToTransfer;
+        uint32_t sourceId;                          // sender: name, size and mtime of the source, 0 for streams
         bool fileLoadCompleted;
         int sourcefd;
         int destfd;
+        string destPath;
+        bool directIO;                              // receiver: write a single file with O_DIRECT
+        UringIO * uring;                            // file I/O through this ring, NULL for plain system calls
+
+        // Stream stages between the file and the packets
+        StreamSource * source;
+        FileSource * fileSource;
+        StreamSink * sink;
+        FileSink * fileSink;
+
+        // Multiplexed streams, NULL for a single file; the caller owns the provider, the buffer the acceptor
+        StreamProvider * provider;
+        StreamAcceptor * acceptor;
+        bool compressStreams;
+        vector<outgoing_stream_t> sending;
+        size_t nextStream;                          // turn of the next packet among sending
+        uint32_t nextStreamId;
+        bool providerDone;
+        map<uint32_t, incoming_stream_t> receiving;
+        seq_t highSeq;                              // receiver: one past the highest sequence number stored
+        unsigned long long streamsFailed;
+
+        // Delta transfer
+        vector<block_sig_t> signatures;
+        uint32_t sigBlockSize;
+        int basisfd;
+        int deltafd;
+
+        // Resume checkpoint (receiver)
+        string checkpointPath;
+        unsigned long long checkpointOffset, checkpointFileSize;
+        uint32_t checkpointSourceId;
+        unsigned long long bytesWritten, lastCheckpoint;
+        bool checkpointEnabled;
+        unsigned long long syncingOffset;           // what the ring's datasync in flight will make durable, 0 for none
+
+        // clock and socket calls, the real ones unless simulated
+        NetIO * io;
+
+        // live statistics owned by the connection
+        transfer_stats_t * counters;
 
         // debuging
         unsigned long long timeSinceStart();
@@ -0,0 +1,341 @@
+#include "compress.h"
+
+#define LZ_MIN_MATCH                (4)
+#define LZ_MAX_OFFSET               (65535)
+#define LZ_LAST_LITERALS            (5)                               // a block always ends in literals
+#define LZ_MATCH_LIMIT              (12)                              // no match may start this close to the end
+
+static inline uint32_t read32(const unsigned char * p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lzHash(uint32_t sequence)
+{
+    return (sequence*2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static inline unsigned char * writeLength(unsigned char * op, size_t len)
+{
+    for( ; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/*************** LZ Codec ***************/
+size_t lzCompress(const char * src, size_t len, char * dst, size_t capacity, uint32_t * table)
+{
+    const unsigned char * base = (const unsigned char *)src;
+    const unsigned char * ip = base;
+    const unsigned char * anchor = base;
+    const unsigned char * end = base + len;
+    unsigned char * op = (unsigned char *)dst;
+    unsigned char * oend = op + capacity;
+
+    // table entries are position + 1, zero is empty
+    memset(table, 0, sizeof(uint32_t)*(1 << LZ_HASH_BITS));
+
+    if(len > LZ_MATCH_LIMIT){
+        const unsigned char * matchLimit = end - LZ_MATCH_LIMIT;
+
+        while(ip < matchLimit){
+            uint32_t sequence = read32(ip);
+            uint32_t h = lzHash(sequence);
+            uint32_t candidate = table[h];
+            table[h] = (ip - base) + 1;
+
+            if(candidate == 0 || (size_t)(ip - base) + 1 - candidate > LZ_MAX_OFFSET || read32(base + candidate - 1) != sequence){
+                ip++;
+                continue;
+            }
+
+            // grow the match in both directions
+            const unsigned char * match = base + candidate - 1;
+            const unsigned char * matchEnd = ip + LZ_MIN_MATCH;
+            const unsigned char * m = match + LZ_MIN_MATCH;
+            while(matchEnd < end - LZ_LAST_LITERALS && *matchEnd == *m){
+                matchEnd++;
+                m++;
+            }
+            while(ip > anchor && match > base && ip[-1] == match[-1]){
+                ip--;
+                match--;
+            }
+
+            size_t litLen = ip - anchor;
+            size_t matchLen = matchEnd - ip - LZ_MIN_MATCH;
+            if(op + 1 + litLen + litLen/255 + 1 + 2 + matchLen/255 + 1 > oend){
+                return 0;
+            }
+
+            // token, literals, offset, match length
+            unsigned char * token = op++;
+            *token = (unsigned char)(min(litLen, (size_t)15) << 4);
+            if(litLen >= 15) op = writeLength(op, litLen - 15);
+            memcpy(op, anchor, litLen);
+            op += litLen;
+
+            uint16_t offset = ip - match;
+            *op++ = offset & 0xff;
+            *op++ = offset >> 8;
+
+            *token |= (unsigned char)min(matchLen, (size_t)15);
+            if(matchLen >= 15) op = writeLength(op, matchLen - 15);
+
+            ip = matchEnd;
+            anchor = ip;
+        }
+    }
+
+    // final literals
+    size_t litLen = end - anchor;
+    if(op + 1 + litLen + litLen/255 + 1 > oend){
+        return 0;
+    }
+    *op++ = (unsigned char)(min(litLen, (size_t)15) << 4);
+    if(litLen >= 15) op = writeLength(op, litLen - 15);
+    memcpy(op, anchor, litLen);
+    op += litLen;
+
+    return op - (unsigned char *)dst;
+}
+
+bool lzDecompress(const char * src, size_t len, char * dst, size_t rawLen)
+{
+    const unsigned char * ip = (const unsigned char *)src;
+    const unsigned char * iend = ip + len;
+    unsigned char * op = (unsigned char *)dst;
+    unsigned char * oend = op + rawLen;
+
+    while(ip < iend){
+        unsigned char token = *ip++;
+
+        size_t litLen = token >> 4;
+        if(litLen == 15){
+            unsigned char more;
+            do {
+                if(ip >= iend) return false;
+                more = *ip++;
+                litLen += more;
+            } while(more == 255);
+        }
+        if(litLen > (size_t)(iend - ip) || litLen > (size_t)(oend - op)) return false;
+        memcpy(op, ip, litLen);
+        op += litLen;
+        ip += litLen;
+
+        // the last sequence has no match
+        if(ip == iend) break;
+
+        if(iend - ip < 2) return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if(offset == 0 || offset > (size_t)(op - (unsigned char *)dst)) return false;
+
+        size_t matchLen = token & 15;
+        if(matchLen == 15){
+            unsigned char more;
+            do {
+                if(ip >= iend) return false;
+                more = *ip++;
+                matchLen += more;
+            } while(more == 255);
+        }
+        matchLen += LZ_MIN_MATCH;
+        if(matchLen > (size_t)(oend - op)) return false;
+
+        // byte at a time, the match may overlap what it produces
+        const unsigned char * match = op - offset;
+        for(size_t i = 0; i < matchLen; i++) {
+            op[i] = match[i];
+        }
+        op += matchLen;
+    }
+
+    return op == oend;
+}
+
+/*************** Compress Encoder ***************/
+CompressEncoder::CompressEncoder(StreamSource * input)
+{
+    this->input = input;
+    inputDone = false;
+
+    chunk.resize(COMPRESS_CHUNK);
+    out.resize(COMPRESS_FRAME_HEADER + COMPRESS_CHUNK);
+    outPos = outLen = 0;
+    table.resize(1 << LZ_HASH_BITS);
+
+    skip = 0;
+    backoff = 1;
+    rawBytes = storedBytes = 0;
+    compressedChunks = bypassedChunks = 0;
+}
+
+CompressEncoder::~CompressEncoder()
+{
+    delete input;
+}
+
+size_t CompressEncoder::read(char * buf, size_t len)
+{
+    size_t total = 0;
+
+    while(total < len){
+        if(outPos == outLen && encodeChunk() == false){
+            break;
+        }
+
+        size_t n = min(len - total, outLen - outPos);
+        memcpy(buf + total, &out[outPos], n);
+        outPos += n;
+        total += n;
+    }
+
+    return total;
+}
+
+bool CompressEncoder::encodeChunk()
+{
+    // gather a whole chunk, earlier stages may hand out less than asked
+    size_t len = 0;
+    while(len < chunk.size() && !inputDone){
+        size_t n = input->read(&chunk[len], chunk.size() - len);
+        if(n == 0){
+            inputDone = true;
+        }
+        len += n;
+    }
+    if(len == 0){
+        return false;
+    }
+
+    uint8_t kind = COMPRESS_RAW;
+    size_t stored = 0;
+    if(worthCompressing(&chunk[0], len)){
+        stored = lzCompress(&chunk[0], len, &out[COMPRESS_FRAME_HEADER], len - 1, &table[0]);
+        if(stored > 0){
+            kind = COMPRESS_LZ;
+        }
+    }
+    if(kind == COMPRESS_RAW){
+        memcpy(&out[COMPRESS_FRAME_HEADER], &chunk[0], len);
+        stored = len;
+        bypassedChunks++;
+    }else{
+        compressedChunks++;
+    }
+
+    // kind:u8 rawLen:u32 storedLen:u32
+    uint32_t rawLenN = htonl(len);
+    uint32_t storedLenN = htonl(stored);
+    out[0] = kind;
+    memcpy(&out[1], &rawLenN, sizeof(rawLenN));
+    memcpy(&out[5], &storedLenN, sizeof(storedLenN));
+
+    outPos = 0;
+    outLen = COMPRESS_FRAME_HEADER + stored;
+    rawBytes += len;
+    storedBytes += outLen;
+    return true;
+}
+
+bool CompressEncoder::worthCompressing(const char * chunk, size_t len)
+{
+    if(skip > 0){
+        skip--;
+        return false;
+    }
+
+    // compress a slice from the middle of the chunk and see how it does
+    size_t probeLen = min(len, (size_t)COMPRESS_PROBE);
+    const char * probe = chunk + (len - probeLen)/2;
+    size_t probeOut = lzCompress(probe, probeLen, &out[COMPRESS_FRAME_HEADER], probeLen, &table[0]);
+
+    if(probeOut == 0 || probeOut > probeLen*COMPRESS_PROBE_RATIO){
+        skip = backoff;
+        backoff = min(backoff*2, (uint32_t)COMPRESS_MAX_BACKOFF);
+        return false;
+    }
+
+    backoff = 1;
+    return true;
+}
+
+/*************** Compress Decoder ***************/
+CompressDecoder::CompressDecoder(StreamSink * output)
+{
+    this->output = output;
+    headerLen = 0;
+    kind = COMPRESS_RAW;
+    rawLen = storedLen = storedHave = 0;
+}
+
+CompressDecoder::~CompressDecoder()
+{
+    delete output;
+}
+
+void CompressDecoder::write(const char * buf, size_t len)
+{
+    while(len > 0){
+        // frame headers may straddle packets
+        if(headerLen < COMPRESS_FRAME_HEADER){
+            size_t n = min(len, COMPRESS_FRAME_HEADER - headerLen);
+            memcpy(header + headerLen, buf, n);
+            headerLen += n;
+            buf += n;
+            len -= n;
+            if(headerLen < COMPRESS_FRAME_HEADER) break;
+
+            kind = header[0];
+            memcpy(&rawLen, header + 1, sizeof(rawLen));
+            memcpy(&storedLen, header + 5, sizeof(storedLen));
+            rawLen = ntohl(rawLen);
+            storedLen = ntohl(storedLen);
+            storedHave = 0;
+
+            if((kind != COMPRESS_RAW && kind != COMPRESS_LZ) || rawLen > COMPRESS_CHUNK || storedLen > rawLen){
+                fprintf(stderr, "compress: corrupt frame\n");
+                exit(1);
+            }
+            frame.resize(storedLen);
+            raw.resize(rawLen);
+        }
+
+        size_t n = min(len, (size_t)(storedLen - storedHave));
+        if(kind == COMPRESS_RAW){
+            // nothing to undo, pass it straight on
+            output->write(buf, n);
+        }else{
+            memcpy(&frame[storedHave], buf, n);
+        }
+        storedHave += n;
+        buf += n;
+        len -= n;
+
+        if(storedHave == storedLen){
+            if(kind == COMPRESS_LZ){
+                if(lzDecompress(&frame[0], storedLen, &raw[0], rawLen) == false){
+                    fprintf(stderr, "compress: corrupt frame\n");
+                    exit(1);
+                }
+                output->write(&raw[0], rawLen);
+            }
+            headerLen = 0;
+        }
+    }
+}
+
+void CompressDecoder::finish()
+{
+    if(headerLen != 0){
+        fprintf(stderr, "compress: stream ended mid frame\n");
+        exit(1);
+    }
+    output->finish();
+}
@@ -0,0 +1,62 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "parameters.h"
+#include "types.h"
+#include "stream.h"
+
+// LZ77 block codec in the style of LZ4: byte-aligned sequences, 64KB window
+// table must hold (1 << LZ_HASH_BITS) entries, returns 0 if dst is too small
+size_t lzCompress(const char * src, size_t len, char * dst, size_t capacity, uint32_t * table);
+bool lzDecompress(const char * src, size_t len, char * dst, size_t rawLen);
+
+// Splits the source stream into chunks and compresses the ones a sample says are worth it
+class CompressEncoder : public StreamSource
+{
+    public:
+        CompressEncoder(StreamSource * input);
+        ~CompressEncoder();
+
+        size_t read(char * buf, size_t len);
+
+        // statistics
+        unsigned long long rawBytes, storedBytes;
+        unsigned long long compressedChunks, bypassedChunks;
+
+    private:
+        bool encodeChunk();
+        bool worthCompressing(const char * chunk, size_t len);
+
+        StreamSource * input;
+        bool inputDone;
+
+        vector<char> chunk;
+        vector<char> out;                          // frame header followed by the stored bytes
+        size_t outPos, outLen;
+        vector<uint32_t> table;
+
+        // incompressible data is probed less and less often
+        uint32_t skip, backoff;
+};
+
+// Reassembles frames and hands the original bytes to the next stage
+class CompressDecoder : public StreamSink
+{
+    public:
+        CompressDecoder(StreamSink * output);
+        ~CompressDecoder();
+
+        void write(const char * buf, size_t len);
+        void finish();
+
+    private:
+        StreamSink * output;
+
+        char header[COMPRESS_FRAME_HEADER];        // partially received frame header
+        size_t headerLen;
+        uint8_t kind;
+        uint32_t rawLen, storedLen, storedHave;
+        vector<char> frame, raw;
+};
+
+#endif
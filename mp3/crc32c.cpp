@@ -0,0 +1,119 @@
+#include "crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#define CRC32C_POLY                 (0x82f63b78)      // reflected Castagnoli polynomial
+
+/*************** Table Fallback ***************/
+static uint32_t crcTable[8][256];
+
+static void buildTables()
+{
+    for(uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for(int k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crcTable[0][n] = crc;
+    }
+    for(uint32_t n = 0; n < 256; n++) {
+        for(int t = 1; t < 8; t++) {
+            crcTable[t][n] = (crcTable[t - 1][n] >> 8) ^ crcTable[0][crcTable[t - 1][n] & 0xff];
+        }
+    }
+}
+
+// slicing-by-8, for CPUs without CRC instructions
+static uint32_t crc32cTable(uint32_t crc, const unsigned char * p, size_t len)
+{
+    for( ; len >= 8; p += 8, len -= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = crcTable[7][lo & 0xff] ^ crcTable[6][(lo >> 8) & 0xff] ^
+              crcTable[5][(lo >> 16) & 0xff] ^ crcTable[4][lo >> 24] ^
+              crcTable[3][hi & 0xff] ^ crcTable[2][(hi >> 8) & 0xff] ^
+              crcTable[1][(hi >> 16) & 0xff] ^ crcTable[0][hi >> 24];
+    }
+    for( ; len > 0; p++, len--) {
+        crc = crcTable[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+/*************** Hardware ***************/
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char * p, size_t len)
+{
+    uint64_t crc64 = crc;
+    for( ; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for( ; len > 0; p++, len--) {
+        crc = _mm_crc32_u8(crc, *p);
+    }
+    return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char * p, size_t len)
+{
+    for( ; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+    }
+    for( ; len > 0; p++, len--) {
+        crc = __crc32cb(crc, *p);
+    }
+    return crc;
+}
+#endif
+
+typedef uint32_t (*crc_impl_t)(uint32_t, const unsigned char *, size_t);
+
+static crc_impl_t pickImplementation()
+{
+#if defined(__x86_64__)
+    if(__builtin_cpu_supports("sse4.2")){
+        return crc32cHardware;
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    return crc32cHardware;
+#endif
+    buildTables();
+    return crc32cTable;
+}
+
+uint32_t crc32c(uint32_t crc, const void * buf, size_t len)
+{
+    static crc_impl_t impl = pickImplementation();
+    return ~impl(~crc, (const unsigned char *)buf, len);
+}
+
+uint32_t crc32cFile(int fd, unsigned long long len)
+{
+    vector<char> buf(DELTA_COPY_CHUNK);
+    unsigned long long offset = 0;
+    uint32_t crc = 0;
+
+    while(offset < len){
+        ssize_t n = pread(fd, &buf[0], min((unsigned long long)buf.size(), len - offset), offset);
+        if(n <= 0){
+            perror("pread");
+            exit(1);
+        }
+        crc = crc32c(crc, &buf[0], n);
+        offset += n;
+    }
+
+    return crc;
+}
@@ -0,0 +1,14 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include "parameters.h"
+#include "types.h"
+
+// Castagnoli CRC, chainable: crc32c(crc32c(0, a), b) == crc32c(0, a + b)
+// Uses the SSE4.2 or ARMv8 CRC instructions when the CPU has them
+uint32_t crc32c(uint32_t crc, const void * buf, size_t len);
+
+// CRC of the first len bytes of an open file
+uint32_t crc32cFile(int fd, unsigned long long len);
+
+#endif
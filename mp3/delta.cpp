@@ -0,0 +1,356 @@
+#include "delta.h"
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint32_t filterHash(uint32_t weak)
+{
+    return (weak ^ (weak >> 16)) & 0xffff;
+}
+
+/*************** Signatures ***************/
+uint32_t weakChecksum(const char * buf, size_t len)
+{
+    uint32_t a = 0, b = 0;
+    for(size_t i = 0; i < len; i++) {
+        a += (unsigned char)buf[i];
+        b += (len - i)*(unsigned char)buf[i];
+    }
+    return ((b & 0xffff) << 16) | (a & 0xffff);
+}
+
+uint64_t strongHash(const char * buf, size_t len)
+{
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len*c2);
+    uint64_t k;
+    size_t i = 0;
+
+    for( ; i + 8 <= len; i += 8) {
+        memcpy(&k, buf + i, 8);
+        k *= c1; k = rotl64(k, 31); k *= c2;
+        h ^= k;
+        h = rotl64(h, 27)*5 + 0x52dce729;
+    }
+
+    k = 0;
+    memcpy(&k, buf + i, len - i);
+    k *= c1; k = rotl64(k, 31); k *= c2;
+    h ^= k;
+
+    // final avalanche
+    h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint32_t deltaBlockSize(unsigned long long basisSize)
+{
+    // sqrt(size) balances signature volume against match granularity, as rsync does
+    unsigned long long blockSize = (unsigned long long)sqrt((double)basisSize);
+    blockSize = (blockSize + 63) & ~63ULL;
+    return min(max(blockSize, (unsigned long long)DELTA_MIN_BLOCK), (unsigned long long)DELTA_MAX_BLOCK);
+}
+
+void computeSignatures(int fd, unsigned long long size, uint32_t blockSize, vector<block_sig_t> & sigs)
+{
+    size_t numBlocks = size/blockSize;                // a short tail block is always sent as a literal
+    size_t blocksPerRead = max((size_t)1, (size_t)DELTA_COPY_CHUNK/blockSize);
+    vector<char> buf(blocksPerRead*blockSize);
+
+    sigs.resize(numBlocks);
+    for(size_t block = 0; block < numBlocks; block += blocksPerRead) {
+        size_t count = min(blocksPerRead, numBlocks - block);
+        ssize_t n = pread(fd, &buf[0], count*blockSize, (off_t)block*blockSize);
+        if(n != (ssize_t)(count*blockSize)){
+            perror("pread");
+            exit(1);
+        }
+
+        for(size_t i = 0; i < count; i++) {
+            sigs[block + i].weak = weakChecksum(&buf[i*blockSize], blockSize);
+            sigs[block + i].strong = strongHash(&buf[i*blockSize], blockSize);
+        }
+    }
+}
+
+/*************** Delta Encoder ***************/
+DeltaEncoder::DeltaEncoder(StreamSource * input, uint32_t blockSize, vector<block_sig_t> & sigs)
+{
+    this->input = input;
+    this->blockSize = blockSize;
+    this->sigs = sigs;
+
+    filter.resize(65536/64, 0);
+    index.reserve(sigs.size());
+    for(uint32_t i = 0; i < sigs.size(); i++) {
+        index.push_back(make_pair(sigs[i].weak, i));
+        filter[filterHash(sigs[i].weak)/64] |= 1ULL << (filterHash(sigs[i].weak)%64);
+    }
+    std::sort(index.begin(), index.end());
+
+    window.resize(2*(DELTA_MAX_LITERAL + blockSize) + DELTA_COPY_CHUNK);
+    windowEnd = pos = litStart = 0;
+    a = b = 0;
+    rolling = inputDone = done = false;
+
+    outPos = 0;
+    runStart = runCount = 0;
+    literalBytes = matchedBytes = 0;
+}
+
+DeltaEncoder::~DeltaEncoder()
+{
+    delete input;
+}
+
+size_t DeltaEncoder::read(char * buf, size_t len)
+{
+    size_t total = 0;
+
+    while(total < len){
+        if(outPos == out.size()){
+            out.clear();
+            outPos = 0;
+            if(done) break;
+            encodeMore();
+            if(out.empty()) break;
+        }
+
+        size_t n = min(len - total, out.size() - outPos);
+        memcpy(buf + total, &out[outPos], n);
+        outPos += n;
+        total += n;
+    }
+
+    return total;
+}
+
+void DeltaEncoder::refill()
+{
+    // slide the pending literal to the front to make room
+    if(litStart > 0){
+        memmove(&window[0], &window[litStart], windowEnd - litStart);
+        windowEnd -= litStart;
+        pos -= litStart;
+        litStart = 0;
+    }
+
+    while(windowEnd < window.size() && !inputDone){
+        size_t n = input->read(&window[windowEnd], window.size() - windowEnd);
+        if(n == 0){
+            inputDone = true;
+        }
+        windowEnd += n;
+    }
+}
+
+void DeltaEncoder::encodeMore()
+{
+    while(out.size() - outPos < DELTA_OUT_CHUNK && !done){
+        if(windowEnd - pos <= blockSize && !inputDone){
+            refill();
+        }
+
+        // not enough left for a whole block, the rest goes out as a literal
+        if(windowEnd - pos < blockSize){
+            pos = windowEnd;
+            emitLiteral();
+            flushBlockRun();
+            done = true;
+            break;
+        }
+
+        if(!rolling){
+            uint32_t weak = weakChecksum(&window[pos], blockSize);
+            a = weak & 0xffff;
+            b = weak >> 16;
+            rolling = true;
+        }
+
+        int block = findBlock((b << 16) | a, &window[pos]);
+        if(block >= 0){
+            emitLiteral();
+            emitBlock(block);
+            pos += blockSize;
+            litStart = pos;
+            rolling = false;
+            continue;
+        }
+
+        if(pos - litStart >= DELTA_MAX_LITERAL){
+            emitLiteral();
+        }
+
+        // roll the checksum forward one byte
+        if(pos + blockSize < windowEnd){
+            uint32_t outByte = (unsigned char)window[pos];
+            uint32_t inByte = (unsigned char)window[pos + blockSize];
+            a = (a - outByte + inByte) & 0xffff;
+            b = (b - blockSize*outByte + a) & 0xffff;
+        }else{
+            rolling = false;
+        }
+        pos++;
+    }
+}
+
+int DeltaEncoder::findBlock(uint32_t weak, const char * block)
+{
+    uint32_t f = filterHash(weak);
+    if(!(filter[f/64] & (1ULL << (f%64)))){
+        return -1;
+    }
+
+    vector<pair<uint32_t, uint32_t> >::iterator it = std::lower_bound(index.begin(), index.end(), make_pair(weak, (uint32_t)0));
+    if(it == index.end() || it->first != weak){
+        return -1;
+    }
+
+    uint64_t strong = strongHash(block, blockSize);
+    int found = -1;
+    for( ; it != index.end() && it->first == weak; ++it) {
+        if(sigs[it->second].strong == strong){
+            // prefer the block that extends the current run
+            if(runCount > 0 && it->second == runStart + runCount){
+                return it->second;
+            }
+            if(found < 0){
+                found = it->second;
+            }
+        }
+    }
+
+    return found;
+}
+
+void DeltaEncoder::emitLiteral()
+{
+    if(pos == litStart){
+        return;
+    }
+    flushBlockRun();
+
+    uint32_t len = htonl(pos - litStart);
+    out.push_back(DELTA_LITERAL);
+    out.insert(out.end(), (char *)&len, (char *)&len + sizeof(len));
+    out.insert(out.end(), window.begin() + litStart, window.begin() + pos);
+
+    literalBytes += pos - litStart;
+    litStart = pos;
+}
+
+void DeltaEncoder::emitBlock(uint32_t index)
+{
+    matchedBytes += blockSize;
+
+    if(runCount > 0 && index == runStart + runCount){
+        runCount++;
+        return;
+    }
+
+    flushBlockRun();
+    runStart = index;
+    runCount = 1;
+}
+
+void DeltaEncoder::flushBlockRun()
+{
+    if(runCount == 0){
+        return;
+    }
+
+    uint32_t start = htonl(runStart);
+    uint32_t count = htonl(runCount);
+    out.push_back(DELTA_BLOCKS);
+    out.insert(out.end(), (char *)&start, (char *)&start + sizeof(start));
+    out.insert(out.end(), (char *)&count, (char *)&count + sizeof(count));
+
+    runCount = 0;
+}
+
+/*************** Delta Decoder ***************/
+DeltaDecoder::DeltaDecoder(int basisfd, uint32_t blockSize, StreamSink * output)
+{
+    this->basisfd = basisfd;
+    this->blockSize = blockSize;
+    this->output = output;
+
+    tokenLen = 0;
+    literalLeft = 0;
+    copyBuf.resize(max((size_t)DELTA_COPY_CHUNK, (size_t)blockSize));
+}
+
+DeltaDecoder::~DeltaDecoder()
+{
+    delete output;
+    if (basisfd > 0) {
+        close(basisfd);
+    }
+}
+
+void DeltaDecoder::write(const char * buf, size_t len)
+{
+    while(len > 0){
+        // literal bytes pass straight through
+        if(literalLeft > 0){
+            size_t n = min((size_t)literalLeft, len);
+            output->write(buf, n);
+            literalLeft -= n;
+            buf += n;
+            len -= n;
+            continue;
+        }
+
+        // token headers may straddle packets
+        token[tokenLen++] = *buf++;
+        len--;
+
+        size_t need;
+        if(token[0] == DELTA_LITERAL){
+            need = 5;
+        }else if(token[0] == DELTA_BLOCKS){
+            need = 9;
+        }else{
+            fprintf(stderr, "delta: corrupt token stream\n");
+            exit(1);
+        }
+        if(tokenLen < need) continue;
+
+        uint32_t first, second;
+        memcpy(&first, token + 1, sizeof(first));
+        if(token[0] == DELTA_LITERAL){
+            literalLeft = ntohl(first);
+        }else{
+            memcpy(&second, token + 5, sizeof(second));
+            copyBlocks(ntohl(first), ntohl(second));
+        }
+        tokenLen = 0;
+    }
+}
+
+void DeltaDecoder::copyBlocks(uint32_t index, uint32_t count)
+{
+    unsigned long long offset = (unsigned long long)index*blockSize;
+    unsigned long long left = (unsigned long long)count*blockSize;
+
+    while(left > 0){
+        size_t n = min((unsigned long long)copyBuf.size(), left);
+        if(pread(basisfd, &copyBuf[0], n, offset) != (ssize_t)n){
+            perror("delta: pread");
+            exit(1);
+        }
+        output->write(&copyBuf[0], n);
+        offset += n;
+        left -= n;
+    }
+}
+
+void DeltaDecoder::finish()
+{
+    output->finish();
+}
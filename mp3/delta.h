@@ -0,0 +1,77 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "parameters.h"
+#include "types.h"
+#include "stream.h"
+
+// Signature helpers
+uint32_t weakChecksum(const char * buf, size_t len);
+uint64_t strongHash(const char * buf, size_t len);
+uint32_t deltaBlockSize(unsigned long long basisSize);
+void computeSignatures(int fd, unsigned long long size, uint32_t blockSize, vector<block_sig_t> & sigs);
+
+// Turns the source stream into literal and block reference tokens against the receiver's signatures
+class DeltaEncoder : public StreamSource
+{
+    public:
+        DeltaEncoder(StreamSource * input, uint32_t blockSize, vector<block_sig_t> & sigs);
+        ~DeltaEncoder();
+
+        size_t read(char * buf, size_t len);
+
+        // statistics
+        unsigned long long literalBytes, matchedBytes;
+
+    private:
+        void refill();
+        void encodeMore();
+        int findBlock(uint32_t weak, const char * block);
+        void emitLiteral();
+        void emitBlock(uint32_t index);
+        void flushBlockRun();
+
+        StreamSource * input;
+        uint32_t blockSize;
+
+        // signature lookup
+        vector<block_sig_t> sigs;
+        vector<pair<uint32_t, uint32_t> > index;       // (weak, block) sorted by weak
+        vector<uint64_t> filter;                       // one bit per 16 bit weak hash
+
+        // unencoded source bytes, [litStart, pos) is the pending literal
+        vector<char> window;
+        size_t windowEnd, pos, litStart;
+        uint32_t a, b;
+        bool rolling, inputDone, done;
+
+        // encoded bytes waiting to be read
+        vector<char> out;
+        size_t outPos;
+        uint32_t runStart, runCount;
+};
+
+// Rebuilds the file from tokens, copying matched blocks out of the basis file
+class DeltaDecoder : public StreamSink
+{
+    public:
+        DeltaDecoder(int basisfd, uint32_t blockSize, StreamSink * output);
+        ~DeltaDecoder();
+
+        void write(const char * buf, size_t len);
+        void finish();
+
+    private:
+        void copyBlocks(uint32_t index, uint32_t count);
+
+        int basisfd;
+        uint32_t blockSize;
+        StreamSink * output;
+
+        char token[9];                                  // partially received token header
+        size_t tokenLen;
+        uint32_t literalLeft;
+        vector<char> copyBuf;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "direct.h"
+
+DirectFileSink::DirectFileSink(int fd, const string & path, unsigned long long offset, unsigned long long fileSize) : FileSink(fd)
+{
+    buffer = NULL;
+    bufferOffset = offset & ~(unsigned long long)(DIRECT_ALIGN - 1);
+    used = 0;
+    head = 0;
+
+    // a second descriptor, the buffered one still reads the resumed prefix for the digest
+    directFd = open(path.c_str(), O_WRONLY | O_DIRECT);
+    if(directFd < 0){
+        perror("O_DIRECT, writing through the page cache");
+        return;
+    }
+
+    // reserve the blocks up front so they come out contiguous; the size stays what is on disk for resume
+    if(fileSize > offset && fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, fileSize - offset) < 0 && errno != EOPNOTSUPP){
+        perror("fallocate");
+        exit(1);
+    }
+
+    buffer = (char *)arenaMap(DIRECT_BUFFER_SIZE);
+
+    // resuming inside a block: its first bytes are rewritten from what is already there
+    head = offset - bufferOffset;
+    if(head > 0 && pread(fd, buffer, head, bufferOffset) != (ssize_t)head){
+        perror("resume block");
+        exit(1);
+    }
+    used = head;
+}
+
+DirectFileSink::~DirectFileSink()
+{
+    if(directFd >= 0){
+        close(directFd);
+    }
+    if(buffer != NULL){
+        arenaUnmap(buffer, DIRECT_BUFFER_SIZE);
+    }
+}
+
+void DirectFileSink::write(const char * buf, size_t len)
+{
+    if(directFd < 0){
+        FileSink::write(buf, len);
+        return;
+    }
+
+    digest = crc32c(digest, buf, len);
+    digestLength += len;
+
+    while(len > 0){
+        size_t n = min(len, (size_t)DIRECT_BUFFER_SIZE - used);
+        memcpy(buffer + used, buf, n);
+        used += n;
+        buf += n;
+        len -= n;
+        if(used == DIRECT_BUFFER_SIZE){
+            flush(used);
+        }
+    }
+}
+
+void DirectFileSink::finish()
+{
+    if(directFd < 0 || used == 0){
+        return;
+    }
+
+    // pad the tail out to a whole block, then cut the file back to the stream's end
+    unsigned long long end = bufferOffset + used;
+    size_t padded = (used + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+    memset(buffer + used, 0, padded - used);
+    flush(padded);
+    if(ftruncate(fd, end) < 0){
+        perror("ftruncate");
+        exit(1);
+    }
+}
+
+void DirectFileSink::flush(size_t bytes)
+{
+    size_t done = 0;
+    while(done < bytes){
+        ssize_t n = pwrite(directFd, buffer + done, bytes - done, bufferOffset + done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0){
+            perror("write");
+            exit(1);
+        }
+        done += n;
+    }
+    bufferOffset += bytes;
+    used = 0;
+    head = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+
+#include "parameters.h"
+#include "types.h"
+#include "stream.h"
+#include "arena.h"
+
+// Appends to a file with O_DIRECT, bypassing the page cache: bytes are gathered into an
+// aligned buffer and written DIRECT_BUFFER_SIZE at a time, the unaligned tail is padded
+// on finish() and trimmed off again. fd stays the buffered descriptor (not owned) for the
+// digest, fdatasync and the tail; without O_DIRECT support this is a plain FileSink
+class DirectFileSink : public FileSink
+{
+    public:
+        // offset is where the stream starts in the file, fileSize where it will end
+        DirectFileSink(int fd, const string & path, unsigned long long offset, unsigned long long fileSize);
+        ~DirectFileSink();
+
+        void write(const char * buf, size_t len);
+        void finish();
+        size_t pending() { return used - head; }
+
+    private:
+        void flush(size_t bytes);
+
+        int directFd;
+        char * buffer;                          // DIRECT_BUFFER_SIZE, huge page aligned from the arena
+        unsigned long long bufferOffset;        // file offset of buffer[0], aligned
+        size_t used;                            // bytes in buffer
+        size_t head;                            // of those, the ones already in the file ahead of the resume offset
+};
+
+#endif
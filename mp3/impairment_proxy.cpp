@@ -0,0 +1,296 @@
+/*
+ *
+ * Network Impairment Proxy
+ *
+ * Relays UDP between reliable_sender and reliable_receiver on one host and
+ * applies delay, jitter, loss, reordering, duplication and a rate limit to
+ * the sender -> receiver direction (or both with -a). Stands in for
+ * "tc qdisc ... netem" without root or a second machine.
+ *
+ */
+
+#include "types.h"
+#include <poll.h>
+#include <signal.h>
+
+#define PROXY_MAX_DATAGRAM          (65536)
+#define TO_RECEIVER                 (0)
+#define TO_SENDER                   (1)
+
+typedef struct {
+	double delayMs, jitterMs;
+	double lossPct;                             // Bernoulli loss
+	bool gilbert;                               // Gilbert-Elliott loss instead
+	double geGoodToBad, geBadToGood, geLossGood, geLossBad;
+	double reorderPct, reorderHoldMs;
+	double duplicatePct;
+	double rateMbit;                            // 0 is unlimited
+	double queueMs;                             // tail drop once the rate limited backlog exceeds this
+	bool bothWays;
+	unsigned int seed;
+} impairment_t;
+
+typedef struct {
+	unsigned long long due;                     // microseconds, monotonic
+	unsigned long long order;                   // keeps equal due times in arrival order
+	int direction;
+	vector<char> bytes;
+} pending_packet_t;
+
+struct laterFirst {
+	bool operator()(const pending_packet_t * a, const pending_packet_t * b) const {
+		return a->due != b->due ? a->due > b->due : a->order > b->order;
+	}
+};
+
+typedef struct {
+	unsigned long long received, forwarded, lost, queueDrops, duplicated, reordered;
+	unsigned long long linkFree;                // when the rate limited link is idle again
+	bool geBad;
+} direction_state_t;
+
+volatile sig_atomic_t running = 1;
+
+void stopRunning(int) {
+	running = 0;
+}
+
+unsigned long long nowUs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return US_PER_SEC*(unsigned long long)ts.tv_sec + ts.tv_nsec/1000;
+}
+
+double uniform() {
+	return rand()/((double)RAND_MAX + 1.0);
+}
+
+bool chance(double pct) {
+	return uniform()*100.0 < pct;
+}
+
+bool dropPacket(impairment_t & imp, direction_state_t & dir) {
+	if(imp.gilbert){
+		// move between the good and bad states, then lose with that state's probability
+		dir.geBad = dir.geBad ? !chance(imp.geBadToGood) : chance(imp.geGoodToBad);
+		return chance(dir.geBad ? imp.geLossBad : imp.geLossGood);
+	}
+	return chance(imp.lossPct);
+}
+
+void usage(char * name) {
+	fprintf(stderr, "usage: %s [options] listen_port receiver_host receiver_port\n", name);
+	fprintf(stderr, "  -d ms          one way delay\n");
+	fprintf(stderr, "  -j ms          uniform jitter added to the delay (may reorder)\n");
+	fprintf(stderr, "  -l pct         Bernoulli loss\n");
+	fprintf(stderr, "  -g p:r:g:b     Gilbert-Elliott loss, percent: good->bad, bad->good, loss in good, loss in bad\n");
+	fprintf(stderr, "  -o pct         reorder: hold the packet back by -O ms\n");
+	fprintf(stderr, "  -O ms          reorder hold time (default 5)\n");
+	fprintf(stderr, "  -u pct         duplicate\n");
+	fprintf(stderr, "  -b mbit        rate limit\n");
+	fprintf(stderr, "  -q ms          rate limit queue, tail drop beyond it (default 25)\n");
+	fprintf(stderr, "  -a             impair the receiver -> sender direction too\n");
+	fprintf(stderr, "  -s seed        random seed (default 438)\n");
+	exit(1);
+}
+
+int bindUdp(const char * port) {
+	struct addrinfo hints, *servinfo;
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	if(getaddrinfo(NULL, port, &hints, &servinfo) != 0){
+		fprintf(stderr, "proxy: bad port %s\n", port);
+		exit(1);
+	}
+
+	int fd = socket(servinfo->ai_family, servinfo->ai_socktype, servinfo->ai_protocol);
+	if(fd < 0 || bind(fd, servinfo->ai_addr, servinfo->ai_addrlen) < 0){
+		perror("proxy: bind");
+		exit(2);
+	}
+	freeaddrinfo(servinfo);
+
+	// deep socket buffers so the proxy is never the bottleneck it is emulating
+	int bufSize = 8*1024*1024;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufSize, sizeof(bufSize));
+	return fd;
+}
+
+int main(int argc, char** argv) {
+	impairment_t imp;
+	memset(&imp, 0, sizeof(imp));
+	imp.reorderHoldMs = 5.0;
+	imp.queueMs = 25.0;
+	imp.seed = 438;
+
+	int opt;
+	while((opt = getopt(argc, argv, "d:j:l:g:o:O:u:b:q:as:")) != -1){
+		switch(opt){
+			case 'd': imp.delayMs = atof(optarg); break;
+			case 'j': imp.jitterMs = atof(optarg); break;
+			case 'l': imp.lossPct = atof(optarg); break;
+			case 'g':
+				imp.gilbert = true;
+				if(sscanf(optarg, "%lf:%lf:%lf:%lf", &imp.geGoodToBad, &imp.geBadToGood, &imp.geLossGood, &imp.geLossBad) != 4){
+					usage(argv[0]);
+				}
+				break;
+			case 'o': imp.reorderPct = atof(optarg); break;
+			case 'O': imp.reorderHoldMs = atof(optarg); break;
+			case 'u': imp.duplicatePct = atof(optarg); break;
+			case 'b': imp.rateMbit = atof(optarg); break;
+			case 'q': imp.queueMs = atof(optarg); break;
+			case 'a': imp.bothWays = true; break;
+			case 's': imp.seed = atoi(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if(argc - optind != 3){
+		usage(argv[0]);
+	}
+	srand(imp.seed);
+
+	// receiver address
+	struct addrinfo hints, *servinfo;
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	if(getaddrinfo(argv[optind + 1], argv[optind + 2], &hints, &servinfo) != 0){
+		fprintf(stderr, "proxy: failed to resolve %s\n", argv[optind + 1]);
+		exit(1);
+	}
+	struct sockaddr_storage receiverAddr;
+	socklen_t receiverAddrLen = servinfo->ai_addrlen;
+	memcpy(&receiverAddr, servinfo->ai_addr, servinfo->ai_addrlen);
+	freeaddrinfo(servinfo);
+
+	// one socket faces the sender, the other the receiver
+	int fds[2];
+	fds[TO_SENDER] = bindUdp(argv[optind]);
+	fds[TO_RECEIVER] = bindUdp("0");
+
+	struct sockaddr_storage senderAddr;
+	socklen_t senderAddrLen = 0;
+
+	signal(SIGINT, stopRunning);
+	signal(SIGTERM, stopRunning);
+
+	priority_queue<pending_packet_t *, vector<pending_packet_t *>, laterFirst> pending;
+	direction_state_t dirs[2];
+	memset(dirs, 0, sizeof(dirs));
+	unsigned long long order = 0;
+	vector<char> buf(PROXY_MAX_DATAGRAM);
+
+	struct pollfd pfds[2];
+	pfds[0].fd = fds[TO_SENDER];
+	pfds[0].events = POLLIN;
+	pfds[1].fd = fds[TO_RECEIVER];
+	pfds[1].events = POLLIN;
+
+	while(running){
+		// release everything that is due
+		unsigned long long now = nowUs();
+		while(!pending.empty() && pending.top()->due <= now){
+			pending_packet_t * p = pending.top();
+			pending.pop();
+			if(p->direction == TO_RECEIVER){
+				sendto(fds[TO_RECEIVER], &p->bytes[0], p->bytes.size(), 0, (struct sockaddr *)&receiverAddr, receiverAddrLen);
+			}else if(senderAddrLen > 0){
+				sendto(fds[TO_SENDER], &p->bytes[0], p->bytes.size(), 0, (struct sockaddr *)&senderAddr, senderAddrLen);
+			}
+			dirs[p->direction].forwarded++;
+			delete p;
+		}
+
+		int timeout = -1;
+		if(!pending.empty()){
+			timeout = (int)((pending.top()->due - now + 999)/1000);
+		}
+		if(poll(pfds, 2, timeout) < 0){
+			if(errno == EINTR) continue;
+			perror("poll");
+			break;
+		}
+
+		for(int side = 0; side < 2; side++) {
+			if(!(pfds[side].revents & POLLIN)) continue;
+
+			struct sockaddr_storage from;
+			socklen_t fromLen = sizeof(from);
+			ssize_t n = recvfrom(pfds[side].fd, &buf[0], buf.size(), MSG_DONTWAIT, (struct sockaddr *)&from, &fromLen);
+			if(n < 0) continue;
+
+			// packets from the sender head to the receiver and vice versa
+			int direction = (side == 0) ? TO_RECEIVER : TO_SENDER;
+			if(direction == TO_RECEIVER){
+				memcpy(&senderAddr, &from, fromLen);
+				senderAddrLen = fromLen;
+			}
+
+			direction_state_t & dir = dirs[direction];
+			dir.received++;
+			now = nowUs();
+
+			if(direction == TO_SENDER && !imp.bothWays){
+				pending_packet_t * p = new pending_packet_t();
+				p->due = now;
+				p->order = order++;
+				p->direction = direction;
+				p->bytes.assign(buf.begin(), buf.begin() + n);
+				pending.push(p);
+				continue;
+			}
+
+			if(dropPacket(imp, dir)){
+				dir.lost++;
+				continue;
+			}
+
+			int copies = chance(imp.duplicatePct) ? 2 : 1;
+			dir.duplicated += copies - 1;
+			for(int c = 0; c < copies; c++) {
+				// serialize onto the rate limited link
+				unsigned long long leave = now;
+				if(imp.rateMbit > 0){
+					unsigned long long start = max(now, dir.linkFree);
+					if(start - now > imp.queueMs*1000.0){
+						dir.queueDrops++;
+						continue;
+					}
+					dir.linkFree = start + (unsigned long long)(n*8/imp.rateMbit);
+					leave = dir.linkFree;
+				}
+
+				double delayMs = imp.delayMs + imp.jitterMs*uniform();
+				if(chance(imp.reorderPct)){
+					delayMs += imp.reorderHoldMs;
+					dir.reordered++;
+				}
+
+				pending_packet_t * p = new pending_packet_t();
+				p->due = leave + (unsigned long long)(delayMs*1000.0);
+				p->order = order++;
+				p->direction = direction;
+				p->bytes.assign(buf.begin(), buf.begin() + n);
+				pending.push(p);
+			}
+		}
+	}
+
+	const char * names[2] = {"sender->receiver", "receiver->sender"};
+	for(int d = 0; d < 2; d++) {
+		fprintf(stderr, "%s: received %llu forwarded %llu lost %llu queue_drops %llu duplicated %llu reordered %llu\n",
+			names[d], dirs[d].received, dirs[d].forwarded, dirs[d].lost, dirs[d].queueDrops, dirs[d].duplicated, dirs[d].reordered);
+	}
+
+	while(!pending.empty()){
+		delete pending.top();
+		pending.pop();
+	}
+	close(fds[0]);
+	close(fds[1]);
+}
@@ -0,0 +1,247 @@
+#include "netio.h"
+
+SystemIO systemIO;
+BusyPollIO busyPollIO;
+
+void SystemIO::now(struct timeval * tv)
+{
+    gettimeofday(tv, 0);
+}
+
+ssize_t SystemIO::sendTo(int fd, const void * buf, size_t len, const struct sockaddr * addr, socklen_t addrLen)
+{
+    return sendto(fd, buf, len, 0, addr, addrLen);
+}
+
+ssize_t SystemIO::sendFrom(int fd, const void * buf, size_t len, const struct sockaddr * local, const struct sockaddr * addr, socklen_t addrLen)
+{
+    if(local == NULL || local->sa_family == AF_UNSPEC){
+        return sendto(fd, buf, len, 0, addr, addrLen);
+    }
+
+    struct iovec iov;
+    union {
+        char space[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+
+    iov.iov_base = (void *)buf;
+    iov.iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_name = (void *)addr;
+    msg.msg_namelen = addrLen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    setSource(msg, local);
+    return sendmsg(fd, &msg, 0);
+}
+
+void SystemIO::setSource(struct msghdr & msg, const struct sockaddr * local)
+{
+    // the packet info's source address overrides the route's choice for an unbound socket
+    struct cmsghdr * cmsg = (struct cmsghdr *)msg.msg_control;
+    if(local->sa_family == AF_INET){
+        struct in_pktinfo info;
+        memset(&info, 0, sizeof(info));
+        info.ipi_spec_dst = ((const struct sockaddr_in *)local)->sin_addr;
+        cmsg->cmsg_level = IPPROTO_IP;
+        cmsg->cmsg_type = IP_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(info));
+        memcpy(CMSG_DATA(cmsg), &info, sizeof(info));
+        msg.msg_controllen = CMSG_SPACE(sizeof(info));
+    }else{
+        struct in6_pktinfo info;
+        memset(&info, 0, sizeof(info));
+        info.ipi6_addr = ((const struct sockaddr_in6 *)local)->sin6_addr;
+        cmsg->cmsg_level = IPPROTO_IPV6;
+        cmsg->cmsg_type = IPV6_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(info));
+        memcpy(CMSG_DATA(cmsg), &info, sizeof(info));
+        msg.msg_controllen = CMSG_SPACE(sizeof(info));
+    }
+}
+
+ssize_t SystemIO::recvFrom(int fd, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen)
+{
+    return receive(fd, buf, len, addr, addrLen, 0);
+}
+
+ssize_t SystemIO::receive(int fd, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen, int flags)
+{
+    struct iovec iov;
+    union {
+        char space[CMSG_SPACE(sizeof(uint32_t))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = addr;
+    msg.msg_namelen = (addrLen != NULL) ? *addrLen : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+
+    ssize_t numbytes = recvmsg(fd, &msg, flags);
+    if(numbytes < 0){
+        return numbytes;
+    }
+    if(addrLen != NULL){
+        *addrLen = msg.msg_namelen;
+    }
+
+    noteDrops(fd, msg);
+    return numbytes;
+}
+
+void SystemIO::noteDrops(int fd, struct msghdr & msg)
+{
+    // the kernel attaches its running drop count once SO_RXQ_OVFL is on and something was dropped
+    for(struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL){
+            if((size_t)fd >= drops.size()){
+                drops.resize(fd + 1, 0);
+            }
+            memcpy(&drops[fd], CMSG_DATA(cmsg), sizeof(uint32_t));
+        }
+    }
+}
+
+void SystemIO::setRecvTimeout(int fd, const struct timeval & timeout)
+{
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        perror("setsockopt");
+        exit(3);
+    }
+}
+
+uint32_t SystemIO::rxDropped(int fd)
+{
+    return ((size_t)fd < drops.size()) ? drops[fd] : 0;
+}
+
+int SystemIO::pathMtu(const struct sockaddr * addr, socklen_t addrLen)
+{
+    // a connected socket reports the MTU of its route
+    bool ipv6 = addr->sa_family == AF_INET6;
+    int mtu = 0;
+    socklen_t mtuLen = sizeof(mtu);
+    int routefd = socket(addr->sa_family, SOCK_DGRAM, 0);
+    if(routefd < 0 || connect(routefd, addr, addrLen) < 0
+        || getsockopt(routefd, ipv6 ? IPPROTO_IPV6 : IPPROTO_IP, ipv6 ? IPV6_MTU : IP_MTU, &mtu, &mtuLen) < 0){
+        mtu = 0;
+    }
+    if(routefd >= 0){
+        close(routefd);
+    }
+    return mtu;
+}
+
+BusyPollIO::BusyPollIO()
+{
+    spin = BUSY_SPIN_INIT;
+}
+
+void BusyPollIO::attach(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0){
+        perror("fcntl");
+        exit(3);
+    }
+
+    // raising SO_BUSY_POLL past net.core.busy_read needs CAP_NET_ADMIN, spinning here works without it
+    int busyPoll = BUSY_POLL_US;
+    if(setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busyPoll, sizeof(busyPoll)) < 0){
+        perror("setsockopt SO_BUSY_POLL");
+    }
+#ifdef SO_PREFER_BUSY_POLL
+    int prefer = 1;
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
+#endif
+}
+
+ssize_t BusyPollIO::sendTo(int fd, const void * buf, size_t len, const struct sockaddr * addr, socklen_t addrLen)
+{
+    return sendFrom(fd, buf, len, NULL, addr, addrLen);
+}
+
+ssize_t BusyPollIO::sendFrom(int fd, const void * buf, size_t len, const struct sockaddr * local, const struct sockaddr * addr, socklen_t addrLen)
+{
+    while(true){
+        ssize_t numbytes = SystemIO::sendFrom(fd, buf, len, local, addr, addrLen);
+        if(numbytes >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)){
+            return numbytes;
+        }
+
+        // full send buffer, the blocking socket would have waited here too
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        poll(&pfd, 1, -1);
+    }
+}
+
+ssize_t BusyPollIO::recvFrom(int fd, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen)
+{
+    unsigned long long timeout = ((size_t)fd < timeouts.size()) ? timeouts[fd] : 0;
+    unsigned long long start = monotonicUs();
+    unsigned long long now = start;
+    socklen_t addrSpace = (addrLen != NULL) ? *addrLen : 0;
+
+    while(true){
+        if(addrLen != NULL){
+            *addrLen = addrSpace;
+        }
+        ssize_t numbytes = receive(fd, buf, len, addr, addrLen, MSG_DONTWAIT);
+        if(numbytes >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)){
+            // arrived within the spin, so spinning a little longer next time is worth it
+            if(numbytes >= 0 && now - start < spin){
+                spin = min(spin*2, (unsigned long long)BUSY_SPIN_MAX);
+            }
+            return numbytes;
+        }
+
+        now = monotonicUs();
+        if(timeout != 0 && now - start >= timeout){
+            errno = EAGAIN;
+            return -1;
+        }
+        if(now - start < spin){
+            continue;
+        }
+
+        // nothing within the spin, give the CPU back until the socket is readable
+        spin = max(spin/2, (unsigned long long)BUSY_SPIN_MIN);
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        struct timespec left;
+        if(timeout != 0){
+            left.tv_sec = (timeout - (now - start))/US_PER_SEC;
+            left.tv_nsec = ((timeout - (now - start))%US_PER_SEC)*1000;
+        }
+        if(ppoll(&pfd, 1, (timeout != 0) ? &left : NULL, NULL) == 0){
+            errno = EAGAIN;
+            return -1;
+        }
+        now = monotonicUs();
+    }
+}
+
+void BusyPollIO::setRecvTimeout(int fd, const struct timeval & timeout)
+{
+    if((size_t)fd >= timeouts.size()){
+        timeouts.resize(fd + 1, 0);
+    }
+    timeouts[fd] = US_PER_SEC*timeout.tv_sec + timeout.tv_usec;
+}
+
+unsigned long long BusyPollIO::monotonicUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*US_PER_SEC + ts.tv_nsec/1000;
+}
@@ -0,0 +1,76 @@
+#ifndef NETIO_H
+#define NETIO_H
+
+#include "parameters.h"
+#include "types.h"
+
+// The clock and datagram socket calls the transport makes, so a simulator
+// can stand in for the kernel and the wall clock
+class NetIO
+{
+    public:
+        virtual ~NetIO(){}
+
+        virtual void now(struct timeval * tv) = 0;
+        virtual ssize_t sendTo(int fd, const void * buf, size_t len, const struct sockaddr * addr, socklen_t addrLen) = 0;
+        // Sends with local as the source address (NULL or AF_UNSPEC lets the kernel pick), one path simulations ignore it
+        virtual ssize_t sendFrom(int fd, const void * buf, size_t len, const struct sockaddr * /* local */, const struct sockaddr * addr, socklen_t addrLen)
+        {
+            return sendTo(fd, buf, len, addr, addrLen);
+        }
+        // Blocks for at most the last receive timeout (forever if zero), -1 when it expires
+        virtual ssize_t recvFrom(int fd, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen) = 0;
+        virtual void setRecvTimeout(int fd, const struct timeval & timeout) = 0;
+        // Datagrams dropped before they reached fd, as of the last receive
+        virtual uint32_t rxDropped(int fd) = 0;
+        // MTU of the route to addr in bytes, IP header included, 0 if unknown
+        virtual int pathMtu(const struct sockaddr * addr, socklen_t addrLen) = 0;
+};
+
+// Real sockets and gettimeofday
+class SystemIO : public NetIO
+{
+    public:
+        void now(struct timeval * tv);
+        ssize_t sendTo(int fd, const void * buf, size_t len, const struct sockaddr * addr, socklen_t addrLen);
+        ssize_t sendFrom(int fd, const void * buf, size_t len, const struct sockaddr * local, const struct sockaddr * addr, socklen_t addrLen);
+        ssize_t recvFrom(int fd, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen);
+        void setRecvTimeout(int fd, const struct timeval & timeout);
+        uint32_t rxDropped(int fd);
+        int pathMtu(const struct sockaddr * addr, socklen_t addrLen);
+
+    protected:
+        ssize_t receive(int fd, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen, int flags);
+        // IP_PKTINFO or IPV6_PKTINFO for local into msg_control, which has room for an in6_pktinfo
+        static void setSource(struct msghdr & msg, const struct sockaddr * local);
+        // picks SO_RXQ_OVFL out of a received message's control data
+        void noteDrops(int fd, struct msghdr & msg);
+
+    private:
+        vector<uint32_t> drops;             // SO_RXQ_OVFL, indexed by fd
+};
+
+// Latency mode: non-blocking sockets polled in user space for an adaptive
+// spell before sleeping in ppoll(), with SO_BUSY_POLL on in the kernel
+class BusyPollIO : public SystemIO
+{
+    public:
+        BusyPollIO();
+
+        void attach(int fd);
+        ssize_t sendTo(int fd, const void * buf, size_t len, const struct sockaddr * addr, socklen_t addrLen);
+        ssize_t sendFrom(int fd, const void * buf, size_t len, const struct sockaddr * local, const struct sockaddr * addr, socklen_t addrLen);
+        ssize_t recvFrom(int fd, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen);
+        void setRecvTimeout(int fd, const struct timeval & timeout);
+
+    private:
+        unsigned long long monotonicUs();
+
+        vector<unsigned long long> timeouts;    // microseconds, 0 blocks forever, indexed by fd
+        unsigned long long spin;                // microseconds, grows when spinning pays off
+};
+
+extern SystemIO systemIO;
+extern BusyPollIO busyPollIO;
+
+#endif
@@ -8,20 +8,140 @@
 #define MAX_WINDOW_SIZE             (BUFFER_SIZE/4)
 #define INIT_SWS                    (MAX_WINDOW_SIZE/2)
 #define MIN_WINDOW_SIZE             (10)
+#define RWND_UPDATE_THRESHOLD       (BUFFER_SIZE/4)    // receiver volunteers window updates below this
+#ifndef SEQ_START
+#define SEQ_START                   (0LL)       // first data sequence number, a multiple of BUFFER_SIZE; build with it near 2^32 to exercise wraparound
+#endif
 
 #define INIT_RTO                    (80000)     // in microseconds
-#define FIN_TO                      (300000)    // in microseconds
+#define TIME_WAIT_MIN               (5000)      // in microseconds
+#define TIME_WAIT_RTO_MULTIPLE      ((double)5.0)   // receiver lingers this many sender RTOs after the last packet it saw
 #define MAX_RTO                     (2000000)   // in microseconds
 
+// Resume Checkpointing
+#define CHECKPOINT_SUFFIX           ".ckpt"
+#define CHECKPOINT_INTERVAL         (64*1024*1024)                    // bytes flushed between checkpoints
+
+// Direct I/O
+#define DIRECT_ALIGN                (4096)                            // O_DIRECT offset, length and buffer alignment
+#define DIRECT_BUFFER_SIZE          (4*1024*1024)                     // in order bytes gathered per write, multiple of DIRECT_ALIGN
+
+// Delta Transfer
+#define DELTA_SUFFIX                ".delta"
+#define DELTA_MIN_BLOCK             (1024)
+#define DELTA_MAX_BLOCK             (128*1024)
+#define DELTA_MAX_LITERAL           (64*1024)                         // literal tokens are split at this size
+#define DELTA_OUT_CHUNK             (64*1024)                         // encoded bytes produced per encoder pass
+#define DELTA_COPY_CHUNK            (1024*1024)                       // basis bytes copied per pread
+#define SIG_WINDOW                  (64)                              // signature packets in flight
+#define SIG_ACK_EVERY               (SIG_WINDOW/4)
+#define SIG_TO                      (100000)    // in microseconds
+
+// Compression
+#define COMPRESS_CHUNK              (256*1024)                        // source bytes per compressed frame
+#define COMPRESS_FRAME_HEADER       ((size_t)9)                       // kind:u8 rawLen:u32 storedLen:u32
+#define COMPRESS_PROBE              (16*1024)                         // bytes sampled to judge a chunk
+#define COMPRESS_PROBE_RATIO        ((double)0.90)                    // sample must shrink below this to compress
+#define COMPRESS_MAX_BACKOFF        (16)                              // chunks skipped between probes on incompressible data
+#define COMPRESS_RAW                (0)
+#define COMPRESS_LZ                 (1)
+#define LZ_HASH_BITS                (14)
+
+// Socket Buffers
+#define SOCKBUF_MIN                 (256*1024)                        // bytes
+#define SOCKBUF_MAX                 (64*1024*1024)
+#define SOCKBUF_BDP_MULTIPLE        ((double)2.0)                     // headroom over the measured bandwidth-delay product
+#define SOCKBUF_INTERVAL            (100000)                          // microseconds, at least one srtt between resizes
+#define SOCKBUF_HYSTERESIS          ((double)0.25)                    // resizes smaller than this fraction are skipped
+#define SKB_HEADROOM                (128)                             // bytes the kernel reserves ahead of a datagram's headers
+#define SKB_SHARED_INFO             (320)                             // struct skb_shared_info at the end of the data
+#define SKB_STRUCT                  (256)                             // struct sk_buff, charged on top of the data
+
+// Busy Polling
+#define BUSY_POLL_US                (50)                              // SO_BUSY_POLL, microseconds the kernel spins per read
+#define BUSY_SPIN_INIT              (50)                              // microseconds of user space spinning before sleeping
+#define BUSY_SPIN_MIN               (5)
+#define BUSY_SPIN_MAX               (400)
+
+// Packet Buffer Arena
+#define HUGE_PAGE_SIZE              (2*1024*1024)
+#define ARENA_HUGE_MIN              (512*1024)                        // smaller arrays stay on normal pages, a huge page would be mostly unused
+#define CACHE_LINE_SIZE             (64)                              // packet slots start on their own line
+
+// AF_XDP
+#define XDP_FRAME_SIZE              (4096)                            // UMEM chunk, one datagram each
+#define XDP_FRAMES                  (2048)                            // UMEM chunks per receive queue, power of two
+#define XDP_RING_SIZE               (1024)                            // RX descriptors per queue, power of two
+#define XDP_MAX_FRAME               (XDP_FRAME_SIZE - 256)            // copy mode keeps XDP_PACKET_HEADROOM ahead of the frame
+#define XDP_STATS_EVERY             (1024)                            // receives between XDP_STATISTICS reads
+
+// io_uring
+#define URING_ENTRIES               (512)                             // submission queue entries
+#define URING_RECV_DEPTH            (64)                              // recvmsg kept posted on the socket
+#define URING_SEND_DEPTH            (256)                             // datagrams copied out and waiting on sendmsg
+#define URING_SEND_BATCH            (32)                              // queued sends that are submitted without waiting for a receive
+#define URING_FILE_BLOCK            (1024*1024)                       // bytes per registered buffer, one file read or write each
+#define URING_FILE_BLOCKS           (8)
+#define URING_FILE_DEPTH            (4)                               // blocks a file source or sink keeps in flight
+
+// Rate Limiting
+#define RATE_BURST_US               (20000)                           // microseconds of the cap a bucket holds; SO_RCVTIMEO sleeps whole jiffies
+#define RATE_BURST_MIN              (2*MAX_DATAGRAM)                  // bytes, so slow caps still send whole datagrams back to back
+
+// Multipath
+#define MAX_SUBFLOWS                (16)
+#define NO_SUBFLOW                  (0xFF)                            // slot not outstanding on any subflow
+#define SUBFLOW_INIT_RATE_WINDOW    (MIN_WINDOW_SIZE)                 // packets per RTT assumed until a rate is measured
+
+// Multiplexed Streams
+#define MAX_OPEN_STREAMS            (16)                              // streams the sender interleaves at once
+#define NO_STREAM                   (0xFFFFFFFF)                      // end of a connection that carried no streams
+
+// Batch Transfer
+#define BATCH_INLINE_MAX            (256*1024)                        // files up to this size are written whole by the file thread
+#define BATCH_MAX_QUEUED            (64*1024*1024)                    // bytes held for the file thread before the writer waits
+#define BATCH_MAX_PATH              (4096)
+#define BATCH_JOB_DIR               (0)
+#define BATCH_JOB_WRITE             (1)                               // create, write and close a small file
+#define BATCH_JOB_OPEN              (2)                               // create a large file for the writer
+#define BATCH_JOB_CLOSE             (3)
+
+// Path MTU Probing
+#define IPV4_HEADER_SIZE            (20)
+#define IPV6_HEADER_SIZE            (40)
+#define UDP_HEADER_SIZE             (8)
+#define MAX_DATAGRAM                (9000 - IPV4_HEADER_SIZE - UDP_HEADER_SIZE)   // jumbo frame
+#define MTU_PROBE_TRIES             (3)                               // losses before a probe size is given up on
+#define MTU_PROBE_ROUNDS            (8)                               // binary search steps below the interface MTU
+#define MTU_PROBE_GRANULARITY       (64)                              // bytes, stop searching once this close
+
 // Header Flags
 #define ACK_HEADER                  (0x01)
 #define SYN_HEADER                  (0x02)
 #define SYN_ACK_HEADER              (0x03)
-#define FIN_HEADER                  (0x04)
-#define FIN_ACK_HEADER              (0x05)
+#define FIN_ACK_HEADER              (0x05)                            // ACK of the end of stream, the file digest matched
 #define DATA_HEADER                 (0x06)
 #define DATA_RETRANS_HEADER         (0x07)
 #define ACK_HEADER_W_FLAGS          (0x08)
+#define SIG_HEADER                  (0x09)
+#define SIG_ACK_HEADER              (0x0A)
+#define FIN_ERR_HEADER              (0x0B)                            // FIN + ACK, but the file digest did not match
+#define PROBE_HEADER                (0x0C)                            // padded to the size in seqNum
+#define PROBE_ACK_HEADER            (0x0D)
+#define WINDOW_PROBE_HEADER         (0x0E)                            // sender asks for the receive window while it is closed
+#define DATA_FIN_HEADER             (0x0F)                            // last data packet, a fin_trailer_t follows the payload
+#define STREAM_FIN_HEADER           (0x10)                            // last packet of a stream but not the connection, with a fin_trailer_t
+
+// SYN and SYN + ACK Flags
+#define SYN_FLAG_DELTA              (0x01)
+#define SYN_FLAG_COMPRESS           (0x02)
+#define SYN_FLAG_FASTOPEN           (0x04)                            // the first window follows the SYN without waiting
+#define SYN_FLAG_STREAMS            (0x08)                            // many streams multiplexed, the receiver writes a directory
+#define SYN_FLAG_BATCH              (0x10)                            // each stream starts with a manifest, the receiver recreates the tree
+
+// Delta Stream Tokens
+#define DELTA_LITERAL               ('L')                             // 'L' len:u32 bytes[len]
+#define DELTA_BLOCKS                ('B')                             // 'B' index:u32 count:u32
 
 // Timing Information
 #define START_TIME_VEC_SIZE         (100)
@@ -51,4 +171,16 @@
 #define FLAG_SIZE                   (64)
 #define CS_ACK_THRESHOLD            (8)
 
+// Live statistics page
+#define STATS_MAGIC                 (0x5354415453763031ULL)           // "STATSv01"
+#define STATS_ROLE_SENDER           (1)
+#define STATS_ROLE_RECEIVER         (2)
+#define STATS_INTERVAL              (1000)                            // xfer_stat default, milliseconds
+
+// Event tracing
+#define TRACE_MAGIC                 (0x43525458)                      // "XTRC"
+#define TRACE_VERSION               (1)
+#define TRACE_EVENTS                (1 << 20)                         // ring capacity, power of two (16 MB)
+#define TRACE_MAX_TRACERS           (4)
+
 #endif
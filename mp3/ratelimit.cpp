@@ -0,0 +1,54 @@
+#include "ratelimit.h"
+
+TokenBucket processRateLimit;
+
+void TokenBucket::configure(double bytesPerSecond)
+{
+    rate = max(bytesPerSecond, 0.0)/US_PER_SEC;
+    burst = max((long long)(rate*RATE_BURST_US), (long long)RATE_BURST_MIN);
+    tokens.store(burst);
+    lastRefill.store(0);
+}
+
+void TokenBucket::refill(unsigned long long nowUs)
+{
+    // whoever moves lastRefill forward credits the interval; a loser's interval was credited by the winner
+    unsigned long long last = lastRefill.load(std::memory_order_relaxed);
+    if(nowUs <= last || lastRefill.compare_exchange_strong(last, nowUs) == false){
+        return;
+    }
+
+    // the first refill only starts the clock, configure left the bucket full
+    if(last == 0){
+        return;
+    }
+    // the level is capped, not the credit: a wakeup that comes late while in debt still earns the whole interval
+    long long add = (long long)min((nowUs - last)*rate, (double)2*burst);
+    long long current = tokens.load(std::memory_order_relaxed);
+    while(tokens.compare_exchange_weak(current, min(current + add, burst)) == false){
+    }
+}
+
+bool TokenBucket::ready(unsigned long long nowUs)
+{
+    if(rate <= 0){
+        return true;
+    }
+    refill(nowUs);
+    return tokens.load(std::memory_order_relaxed) > 0;
+}
+
+void TokenBucket::take(size_t bytes)
+{
+    if(rate > 0){
+        tokens.fetch_sub(bytes);
+    }
+}
+
+unsigned long long TokenBucket::waitUs(unsigned long long nowUs)
+{
+    if(ready(nowUs)){
+        return 0;
+    }
+    return (unsigned long long)((1 - tokens.load(std::memory_order_relaxed))/rate) + 1;
+}
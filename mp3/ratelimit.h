@@ -0,0 +1,38 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include "parameters.h"
+#include "types.h"
+
+// Token bucket in bytes, refilled from the caller's clock. Any number of connections
+// may share one: refill and take are compare and swap loops, no lock. A datagram may
+// take the bucket into debt, so a cap below one datagram per burst still makes progress
+class TokenBucket
+{
+    public:
+        TokenBucket() : rate(0), burst(0), tokens(0), lastRefill(0) {}
+
+        // bytes per second, 0 turns the cap off; call before any connection uses the bucket
+        void configure(double bytesPerSecond);
+        bool limited() const { return rate > 0; }
+
+        // true if a datagram may go now; take charges every datagram sent, retransmissions too
+        bool ready(unsigned long long nowUs);
+        void take(size_t bytes);
+
+        // microseconds until ready, 0 if it already is
+        unsigned long long waitUs(unsigned long long nowUs);
+
+    private:
+        void refill(unsigned long long nowUs);
+
+        double rate;                            // bytes per microsecond
+        long long burst;                        // bytes, the most that can build up while idle
+        std::atomic<long long> tokens;          // bytes, negative while in debt
+        std::atomic<unsigned long long> lastRefill;     // microseconds on the caller's clock
+};
+
+// The cap every connection in the process shares, off unless configured
+extern TokenBucket processRateLimit;
+
+#endif
@@ -1,4 +1,3 @@
-
 /*
  *
  * TCP Receiver
@@ -7,17 +6,69 @@
 
 #include "tcp.h"
 
+void usage(char * name) {
+	fprintf(stderr, "usage: %s [-d] [-s] [-O] [-B] [-U] [-X interface] [-C cpu] [-m stats_file] [-t trace_file] UDP_port filename_to_write\n", name);
+	fprintf(stderr, "  -d  delta transfer against an existing filename_to_write\n");
+	fprintf(stderr, "  -s  print transfer statistics when done\n");
+	fprintf(stderr, "  -O  write filename_to_write with O_DIRECT, keeping it out of the page cache\n");
+	fprintf(stderr, "  -B  busy-poll the socket, lower latency for more CPU\n");
+	fprintf(stderr, "  -U  batch socket and file I/O through io_uring, fewer system calls per packet\n");
+	fprintf(stderr, "  -X  receive through AF_XDP sockets on interface, needs CAP_NET_ADMIN and CAP_BPF\n");
+	fprintf(stderr, "  -C  pin the transport thread to cpu\n");
+	fprintf(stderr, "  -m  publish live statistics in stats_file (read it with xfer_stat)\n");
+	fprintf(stderr, "  -t  trace congestion events to trace_file, also dumped on SIGUSR1\n");
+	fprintf(stderr, "  a sender with several files makes filename_to_write a directory, stream n in file n\n");
+	fprintf(stderr, "  a batch sender's tree is recreated under filename_to_write\n\n");
+	exit(1);
+}
+
 int main(int argc, char** argv) {
+	transfer_options_t options;
+	int opt;
+
+	while((opt = getopt(argc, argv, "dsOBUX:C:m:t:")) != -1){
+		switch(opt){
+			case 'd':
+				options.delta = true;
+				break;
+			case 's':
+				options.stats = true;
+				break;
+			case 'O':
+				options.directIO = true;
+				break;
+			case 'B':
+				options.busyPoll = true;
+				break;
+			case 'U':
+				options.uring = true;
+				break;
+			case 'X':
+				options.xdpInterface = optarg;
+				break;
+			case 'C':
+				options.cpu = atoi(optarg);
+				break;
+			case 'm':
+				options.statsPage = optarg;
+				break;
+			case 't':
+				options.tracePath = optarg;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
 
-	if(argc != 3){
-		fprintf(stderr, "usage: %s UDP_port filename_to_write\n\n", argv[0]);
-		exit(1);
+	if(argc - optind != 2){
+		usage(argv[0]);
 	}
 
 
 	// setup receiver connection
-	TCP receiver(argv[1]);
+	TCP receiver(argv[optind]);
+	receiver.options = options;
 
 	// receive file
-	receiver.reliableReceive(argv[2]);
+	return receiver.reliableReceive(argv[optind + 1]) ? 0 : 1;
 }
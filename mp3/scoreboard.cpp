@@ -0,0 +1,56 @@
+#include "scoreboard.h"
+
+void SlotBitmap::resize(size_t slots)
+{
+    if(slots == 0 || slots % 64 != 0){
+        fprintf(stderr, "Scoreboard size %zu is not a multiple of 64 slots\n", slots);
+        exit(1);
+    }
+    this->slots = slots;
+    words.assign(slots/64, 0);
+}
+
+void SlotBitmap::clearRange(uint32_t start, size_t n)
+{
+    while(n > 0){
+        size_t take = min(n, (size_t)64);
+        clearBits(start, (take < 64) ? (1ULL << take) - 1 : ~0ULL);
+        start = (start + take) % slots;
+        n -= take;
+    }
+}
+
+size_t SlotBitmap::runLength(uint32_t start, size_t max) const
+{
+    size_t run = 0;
+    while(run < max){
+        uint64_t clear = ~extract(start, 64);
+        size_t ones = (clear == 0) ? 64 : __builtin_ctzll(clear);
+        run += ones;
+        if(ones < 64) break;
+        start = (start + 64) % slots;
+    }
+    return min(run, max);
+}
+
+size_t SlotBitmap::gapLength(uint32_t start, size_t max) const
+{
+    size_t gap = 0;
+    while(gap < max){
+        uint64_t set = extract(start, 64);
+        size_t zeros = (set == 0) ? 64 : __builtin_ctzll(set);
+        gap += zeros;
+        if(zeros < 64) break;
+        start = (start + 64) % slots;
+    }
+    return min(gap, max);
+}
+
+void Scoreboard::resize(size_t slots, packet_state_t idle)
+{
+    this->idle = idle;
+    filled.resize(slots);
+    sent.resize(slots);
+    received.resize(slots);
+    delivered.resize(slots);
+}
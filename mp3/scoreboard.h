@@ -0,0 +1,121 @@
+#ifndef SCOREBOARD_H
+#define SCOREBOARD_H
+
+#include "parameters.h"
+#include "types.h"
+#include "arena.h"
+
+// One bit per buffer slot, 64 slots a word; slot indexes wrap at size()
+class SlotBitmap
+{
+    public:
+        SlotBitmap() : slots(0) {}
+
+        void resize(size_t slots);
+        size_t size() const { return slots; }
+
+        bool test(uint32_t i) const { return (load(i/64) >> (i%64)) & 1; }
+        void set(uint32_t i) { words[i/64] |= bit(i); }
+        void clear(uint32_t i) { words[i/64] &= ~bit(i); }
+
+        // set and clear for a bitmap two threads share, ordered after the writer's earlier stores
+        void publish(uint32_t i) { __atomic_fetch_or(&words[i/64], bit(i), __ATOMIC_RELEASE); }
+        void retract(uint32_t i) { __atomic_fetch_and(&words[i/64], ~bit(i), __ATOMIC_RELEASE); }
+
+        // n (at most 64) bits from start, bit k is slot start + k
+        uint64_t extract(uint32_t start, size_t n) const
+        {
+            size_t w = start/64, shift = start%64;
+            uint64_t bits = load(w) >> shift;
+            if(shift != 0){
+                bits |= load((w + 1) % words.size()) << (64 - shift);
+            }
+            return (n < 64) ? bits & ((1ULL << n) - 1) : bits;
+        }
+
+        // clears slot start + k for every bit k set in bits
+        void clearBits(uint32_t start, uint64_t bits)
+        {
+            size_t w = start/64, shift = start%64;
+            words[w] &= ~(bits << shift);
+            if(shift != 0){
+                words[(w + 1) % words.size()] &= ~(bits >> (64 - shift));
+            }
+        }
+
+        void clearRange(uint32_t start, size_t n);
+
+        // slots in a row from start with the bit set (runLength) or clear (gapLength), at most max
+        size_t runLength(uint32_t start, size_t max) const;
+        size_t gapLength(uint32_t start, size_t max) const;
+
+    private:
+        static uint64_t bit(uint32_t i) { return 1ULL << (i%64); }
+        uint64_t load(size_t w) const { return __atomic_load_n(&words[w], __ATOMIC_ACQUIRE); }
+
+        SlotArray<uint64_t> words;
+        size_t slots;
+};
+
+// Per slot packet state kept as one bitmap per state, so scans over the window take a word at a time.
+// The sender's idle state is AVAILABLE (an acknowledged slot is free at once), the receiver's WAITING
+class Scoreboard
+{
+    public:
+        Scoreboard() : idle(AVAILABLE) {}
+
+        void resize(size_t slots, packet_state_t idle);
+        size_t size() const { return received.size(); }
+
+        packet_state_t get(uint32_t i) const
+        {
+            if(idle == WAITING){
+                if(received.test(i) == false) return WAITING;
+                return delivered.test(i) ? DELIVERED : RECEIVED;
+            }
+            if(filled.test(i)) return FILLED;
+            return sent.test(i) ? SENT : AVAILABLE;
+        }
+
+        // the receiver's network and writer threads hand slots back and forth, WAITING -> RECEIVED
+        // (-> DELIVERED) -> WAITING, with release stores; the sender's slots have one owner
+        void set(uint32_t i, packet_state_t state)
+        {
+            if(idle == WAITING){
+                if(state == RECEIVED){
+                    received.publish(i);
+                }else if(state == DELIVERED){
+                    delivered.publish(i);
+                }else{
+                    delivered.retract(i);
+                    received.retract(i);
+                }
+                return;
+            }
+            filled.clear(i);
+            sent.clear(i);
+            if(state == FILLED){
+                filled.set(i);
+            }else if(state == SENT){
+                sent.set(i);
+            }
+        }
+
+        // sender: every slot start + k with bit k set was selectively acknowledged
+        void acknowledge(uint32_t start, uint64_t bits)
+        {
+            filled.clearBits(start, bits);
+            sent.clearBits(start, bits);
+        }
+
+        // sender
+        SlotBitmap filled, sent;
+
+        // receiver: stored (RECEIVED or DELIVERED), and of those handed to a stream ahead of the cumulative ACK
+        SlotBitmap received, delivered;
+
+    private:
+        packet_state_t idle;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#!/bin/bash
+# Sender, impairment proxy and receiver all on 127.0.0.1, no root needed.
+# usage: testLocal.sh iterations bytes [proxy options...]
+#   e.g. testLocal.sh 3 20000000 -d 10 -j 2 -l 1 -b 100
+
+timestamp() {
+     date +"%T"
+}
+
+ITERATIONS=$1
+BYTES=$2
+shift 2
+
+./impairment_proxy "$@" 4960 127.0.0.1 4950 &
+PROXY=$!
+trap "kill $PROXY 2>/dev/null" EXIT
+
+for i in $(seq 1 $ITERATIONS)
+do
+    timestamp
+    echo "Testing iteration ${i}"
+    ./reliable_receiver 4950 destfile &
+    RECEIVER=$!
+    sleep 0.2
+    ./reliable_sender 127.0.0.1 4960 sourcefile $BYTES
+    # the receiver's digest check, then a byte-for-byte compare for anything it would miss
+    if ! wait $RECEIVER || ! cmp <(head -c $BYTES sourcefile) destfile; then
+        echo "Test iteration ${i} FAILED! FIX BUGS!"
+        exit 1
+    fi
+    timestamp
+    echo ""
+done
+
+echo "ALL TEST ITERATIONS PASSED! GOOD JOB!"
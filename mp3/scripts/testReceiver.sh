@@ -9,8 +9,9 @@ do
     # rm -f destfile
     timestamp
     echo "Testing iteration ${i}"
-    ./reliable_receiver 4950 destfile
-    if ! diff -q "sourcefile" "destfile"; then
+    # the receiver checks the sender's whole-file digest and fails on a mismatch,
+    # the byte-for-byte diff still catches anything the digest would miss
+    if ! ./reliable_receiver 4950 destfile || ! diff -q "sourcefile" "destfile"; then
         diff sourcefile destfile > errors
         echo "Test iteration ${i} FAILED! FIX BUGS!"
         exit;
@@ -6,15 +6,119 @@
 
 #include "tcp.h"
 
+void usage(char * name) {
+	fprintf(stderr, "usage: %s [-c] [-b] [-M] [-P] [-F] [-s] [-B] [-U] [-X interface] [-C cpu] [-r mbit] [-G mbit] [-L local_addrs] [-R remote_addrs] [-m stats_file] [-t trace_file] receiver_hostname receiver_port filename_to_xfer bytes_to_xfer [filename bytes ...]\n", name);
+	fprintf(stderr, "  several files go as multiplexed streams over one connection, the receiver writes them to a directory\n");
+	fprintf(stderr, "  -b  batch: filename_to_xfer is a directory to copy whole, or a file listing paths, and takes no bytes_to_xfer\n");
+	fprintf(stderr, "  -c  compress chunks that sample as compressible\n");
+	fprintf(stderr, "  -M  probe the path MTU before sending and grow the payload to fit, costs a round trip or more\n");
+	fprintf(stderr, "  -P  keep the classic payload size, the default, overrides -M\n");
+	fprintf(stderr, "  -F  fast open: send the first window with the SYN, implies -P\n");
+	fprintf(stderr, "  -s  print transfer statistics when done\n");
+	fprintf(stderr, "  -B  busy-poll the socket, lower latency for more CPU\n");
+	fprintf(stderr, "  -U  batch socket and file I/O through io_uring, fewer system calls per packet\n");
+	fprintf(stderr, "  -X  receive through AF_XDP sockets on interface, needs CAP_NET_ADMIN and CAP_BPF\n");
+	fprintf(stderr, "  -C  pin the transport thread to cpu\n");
+	fprintf(stderr, "  -r  cap this connection at mbit megabits per second, retransmissions included\n");
+	fprintf(stderr, "  -G  cap every connection in this process together at mbit megabits per second\n");
+	fprintf(stderr, "  -L  multipath: comma separated source addresses\n");
+	fprintf(stderr, "  -R  multipath: more comma separated receiver addresses, one subflow per local/remote pair\n");
+	fprintf(stderr, "  -m  publish live statistics in stats_file (read it with xfer_stat)\n");
+	fprintf(stderr, "  -t  trace congestion events to trace_file, also dumped on SIGUSR1\n");
+	exit(1);
+}
+
 int main(int argc, char** argv) {
-	if(argc != 5) {
-		fprintf(stderr, "usage: %s receiver_hostname receiver_port filename_to_xfer bytes_to_xfer\n", argv[0]);
-		exit(1);
+	transfer_options_t options;
+	bool batch = false;
+	bool classic = false;
+	int opt;
+
+	while((opt = getopt(argc, argv, "cbMPFsBUX:C:r:G:L:R:m:t:")) != -1){
+		switch(opt){
+			case 'c':
+				options.compress = true;
+				break;
+			case 'b':
+				batch = true;
+				break;
+			case 'M':
+				options.probeMtu = true;
+				break;
+			case 'P':
+				classic = true;
+				break;
+			case 'F':
+				options.fastOpen = true;
+				break;
+			case 's':
+				options.stats = true;
+				break;
+			case 'B':
+				options.busyPoll = true;
+				break;
+			case 'U':
+				options.uring = true;
+				break;
+			case 'X':
+				options.xdpInterface = optarg;
+				break;
+			case 'C':
+				options.cpu = atoi(optarg);
+				break;
+			case 'r':
+				options.rateLimit = atof(optarg)*1e6/8;
+				break;
+			case 'G':
+				processRateLimit.configure(atof(optarg)*1e6/8);
+				break;
+			case 'L':
+				options.localAddrs = optarg;
+				break;
+			case 'R':
+				options.remoteAddrs = optarg;
+				break;
+			case 'm':
+				options.statsPage = optarg;
+				break;
+			case 't':
+				options.tracePath = optarg;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if(batch ? argc - optind != 3 : argc - optind < 4 || (argc - optind) % 2 != 0) {
+		usage(argv[0]);
+	}
+	if(classic){
+		options.probeMtu = false;
 	}
 
 	// setup sender connection
-	TCP sender(argv[1], argv[2]);
+	TCP sender(argv[optind], argv[optind + 1]);
+	sender.options = options;
+
+	// send a tree, one stream per file or directory
+	if(batch){
+		BatchProvider tree(argv[optind + 2]);
+		bool sent = sender.reliableSend(&tree);
+		if(options.stats){
+			fprintf(stderr, "batch: %llu files, %llu directories, %llu skipped\n", tree.files, tree.directories, tree.skipped);
+		}
+		return sent ? 0 : 1;
+	}
 
 	// send file
-	sender.reliableSend(argv[3], atoll(argv[4]));
+	if(argc - optind == 4){
+		return sender.reliableSend(argv[optind + 2], atoll(argv[optind + 3])) ? 0 : 1;
+	}
+
+	// or one stream per file
+	FileListProvider files;
+	for(int i = optind + 2; i < argc; i += 2) {
+		files.add(argv[i], atoll(argv[i + 1]));
+	}
+	return sender.reliableSend(&files) ? 0 : 1;
 }
@@ -0,0 +1,232 @@
+#include "simulator.h"
+
+// virtual time starts at an arbitrary wall clock so timeval arithmetic looks ordinary
+#define SIM_EPOCH_SEC   (1000000000ULL)
+#define SIM_STACK_SIZE  (8*1024*1024)       // per side, only the pages touched are backed
+
+Simulator::Simulator(sim_link_t forward, sim_link_t reverse, uint64_t seed)
+{
+    links[SIM_SENDER] = forward;
+    links[SIM_RECEIVER] = reverse;
+    now = 0;
+    order = 0;
+    linkFree[0] = linkFree[1] = 0;
+    rng = seed*0x9E3779B97F4A7C15ULL + 1;
+
+    for (int i = 0; i < 2; i++) {
+        endpoints[i].sim = this;
+        endpoints[i].id = i;
+        endpoints[i].timeout = 0;
+        endpoints[i].wakeAt = 0;
+        endpoints[i].blocked = false;
+        endpoints[i].done = false;
+        endpoints[i].delivered = 0;
+        endpoints[i].lost = 0;
+        endpoints[i].cpuSeconds = 0.0;
+        endpoints[i].stack = NULL;
+    }
+}
+
+Simulator::~Simulator()
+{
+    for (int i = 0; i < 2; i++) {
+        if (endpoints[i].stack != NULL) {
+            munmap(endpoints[i].stack, SIM_STACK_SIZE);
+        }
+    }
+    while (!inFlight.empty()) {
+        delete inFlight.top();
+        inFlight.pop();
+    }
+}
+
+double Simulator::uniform()
+{
+    // xorshift64*, identical sequence on every platform
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return ((rng*0x2545F4914F6CDD1DULL) >> 11)*(1.0/9007199254740992.0);
+}
+
+void Simulator::endpointMain(unsigned int high, unsigned int low)
+{
+    // makecontext only passes ints, the endpoint's address comes in two halves
+    SimEndpoint & e = *(SimEndpoint *)(((uintptr_t)high << 16 << 16) | low);
+    e.body();
+    e.done = true;
+
+    // returning resumes the scheduler through uc_link
+}
+
+void Simulator::resume(int id)
+{
+    // nothing else runs on this thread and a side never sleeps, so the time it runs for is its CPU time;
+    // the monotonic clock reads without a system call, the thread CPU clock does not
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    if (swapcontext(&scheduler, &endpoints[id].context) < 0) {
+        perror("swapcontext");
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    endpoints[id].cpuSeconds += (after.tv_sec - before.tv_sec) + (after.tv_nsec - before.tv_nsec)/1e9;
+}
+
+bool Simulator::run(std::function<void()> sender, std::function<void()> receiver, unsigned long long limitUs)
+{
+    endpoints[SIM_SENDER].body = sender;
+    endpoints[SIM_RECEIVER].body = receiver;
+    for (int i = 0; i < 2; i++) {
+        SimEndpoint & e = endpoints[i];
+        e.stack = (char *)mmap(NULL, SIM_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (e.stack == MAP_FAILED || getcontext(&e.context) < 0) {
+            perror("simulator stack");
+            exit(1);
+        }
+        e.context.uc_stack.ss_sp = e.stack;
+        e.context.uc_stack.ss_size = SIM_STACK_SIZE;
+        e.context.uc_link = &scheduler;
+        uintptr_t self = (uintptr_t)&e;
+        makecontext(&e.context, (void (*)())endpointMain, 2, (unsigned int)(self >> 16 >> 16), (unsigned int)self);
+    }
+
+    // the receiver is listening before the sender's first SYN
+    resume(SIM_RECEIVER);
+    resume(SIM_SENDER);
+
+    while (true) {
+        if (endpoints[0].done && endpoints[1].done) {
+            return true;
+        }
+
+        // next thing to happen: a packet arriving or a receive timing out
+        unsigned long long next = numeric_limits<unsigned long long>::max();
+        if (!inFlight.empty()) {
+            next = inFlight.top()->due;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (!endpoints[i].done && endpoints[i].wakeAt > 0) {
+                next = min(next, endpoints[i].wakeAt);
+            }
+        }
+        if (next == numeric_limits<unsigned long long>::max() || next > limitUs) {
+            return false;
+        }
+        now = max(now, next);
+
+        while (!inFlight.empty() && inFlight.top()->due <= now) {
+            sim_packet_t * packet = inFlight.top();
+            inFlight.pop();
+            if (!endpoints[packet->to].done) {
+                endpoints[packet->to].inbox.push_back(std::move(packet->bytes));
+            }
+            delete packet;
+        }
+
+        for (int i = 0; i < 2; i++) {
+            SimEndpoint & e = endpoints[i];
+            if (!e.done && e.blocked && (!e.inbox.empty() || (e.wakeAt > 0 && now >= e.wakeAt))) {
+                resume(i);
+            }
+        }
+    }
+}
+
+void Simulator::transmit(int from, const void * buf, size_t len)
+{
+    sim_link_t & link = links[from];
+    SimEndpoint & e = endpoints[from];
+
+    if ((link.mtu > 0 && len + IPV4_HEADER_SIZE + UDP_HEADER_SIZE > link.mtu) || uniform()*100.0 < link.lossPct) {
+        e.lost++;
+        return;
+    }
+
+    // serialize behind whatever is already queued on the link
+    unsigned long long leave = now;
+    if (link.rateMbit > 0) {
+        unsigned long long start = max(now, linkFree[from]);
+        if (start - now > link.queueMs*1000.0) {
+            e.lost++;
+            return;
+        }
+        linkFree[from] = start + (unsigned long long)(len*8/link.rateMbit);
+        leave = linkFree[from];
+    }
+
+    sim_packet_t * packet = new sim_packet_t();
+    packet->due = leave + (unsigned long long)(link.delayMs*1000.0);
+    packet->order = order++;
+    packet->to = 1 - from;
+    packet->bytes.assign((const char *)buf, (const char *)buf + len);
+    inFlight.push(packet);
+    e.delivered++;
+}
+
+/*************** Simulated Socket Calls ***************/
+void SimEndpoint::now(struct timeval * tv)
+{
+    tv->tv_sec = SIM_EPOCH_SEC + sim->now/US_PER_SEC;
+    tv->tv_usec = sim->now%US_PER_SEC;
+}
+
+ssize_t SimEndpoint::sendTo(int, const void * buf, size_t len, const struct sockaddr *, socklen_t)
+{
+    sim->transmit(id, buf, len);
+    return len;
+}
+
+ssize_t SimEndpoint::recvFrom(int, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen)
+{
+    // yield to the scheduler until a packet arrives or the timeout passes
+    if (inbox.empty()) {
+        blocked = true;
+        wakeAt = (timeout > 0) ? sim->now + timeout : 0;
+        if (swapcontext(&context, &sim->scheduler) < 0) {
+            perror("swapcontext");
+            exit(1);
+        }
+        blocked = false;
+        wakeAt = 0;
+    }
+
+    if (inbox.empty()) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    vector<char> packet = std::move(inbox.front());
+    inbox.pop_front();
+    size_t copied = min(len, packet.size());
+    memcpy(buf, &packet[0], copied);
+
+    // the peer appears at 127.0.0.1, port by side
+    if (addr != NULL && addrLen != NULL) {
+        struct sockaddr_in peer;
+        memset(&peer, 0, sizeof(peer));
+        peer.sin_family = AF_INET;
+        peer.sin_port = htons(1 - id + 1);
+        peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        memcpy(addr, &peer, min((size_t)*addrLen, sizeof(peer)));
+        *addrLen = sizeof(peer);
+    }
+    return copied;
+}
+
+void SimEndpoint::setRecvTimeout(int, const struct timeval & timeout)
+{
+    this->timeout = US_PER_SEC*timeout.tv_sec + timeout.tv_usec;
+}
+
+uint32_t SimEndpoint::rxDropped(int)
+{
+    // endpoints never overflow, queue drops are the link's
+    return 0;
+}
+
+int SimEndpoint::pathMtu(const struct sockaddr *, socklen_t)
+{
+    // the link this side sends on, an unlimited one carries the largest IPv4 packet
+    return (sim->links[id].mtu > 0) ? (int)sim->links[id].mtu : (int)numeric_limits<uint16_t>::max();
+}
@@ -0,0 +1,102 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include "parameters.h"
+#include "types.h"
+#include "netio.h"
+#include <ucontext.h>
+#include <sys/mman.h>
+
+#define SIM_SENDER          (0)
+#define SIM_RECEIVER        (1)
+
+// One direction of the simulated path
+typedef struct {
+    double delayMs;             // one way propagation delay
+    double lossPct;             // Bernoulli loss
+    double rateMbit;            // serialization rate, 0 is unlimited
+    double queueMs;             // tail drop once the backlog exceeds this
+    uint32_t mtu;               // larger datagrams are lost, 0 is unlimited
+} sim_link_t;
+
+typedef struct {
+    unsigned long long due;     // virtual microseconds
+    unsigned long long order;   // keeps equal due times in send order
+    int to;
+    vector<char> bytes;
+} sim_packet_t;
+
+struct simPacketLater {
+    bool operator()(const sim_packet_t * a, const sim_packet_t * b) const {
+        return a->due != b->due ? a->due > b->due : a->order > b->order;
+    }
+};
+
+class Simulator;
+
+// The NetIO handed to one side of the connection; its socket calls go to the simulated link
+class SimEndpoint : public NetIO
+{
+    public:
+        void now(struct timeval * tv);
+        ssize_t sendTo(int fd, const void * buf, size_t len, const struct sockaddr * addr, socklen_t addrLen);
+        ssize_t recvFrom(int fd, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen);
+        void setRecvTimeout(int fd, const struct timeval & timeout);
+        uint32_t rxDropped(int fd);
+        int pathMtu(const struct sockaddr * addr, socklen_t addrLen);
+
+        Simulator * sim;
+        int id;
+
+        deque<vector<char> > inbox;
+        unsigned long long timeout;         // microseconds, 0 blocks forever
+        unsigned long long wakeAt;          // 0 while not waiting on a timeout
+        bool blocked, done;
+
+        // packets from this side that the link delivered or lost
+        unsigned long long delivered, lost;
+        double cpuSeconds;                  // CPU time this side ran for
+
+    private:
+        friend class Simulator;
+
+        ucontext_t context;
+        char * stack;
+        std::function<void()> body;
+};
+
+// Runs a sender and a receiver as coroutines on the calling thread, one at a
+// time: a side runs until its receive would block, and the virtual clock
+// only advances when both are waiting on the network. Runs are deterministic
+// for a given seed and take no longer than the CPU work.
+class Simulator
+{
+    public:
+        Simulator(sim_link_t forward, sim_link_t reverse, uint64_t seed);
+        ~Simulator();
+
+        // false if both sides stalled or limitUs of virtual time passed;
+        // the stalled sides stay suspended and never unwind, so the caller should exit the process
+        bool run(std::function<void()> sender, std::function<void()> receiver, unsigned long long limitUs);
+
+        unsigned long long now;             // virtual microseconds since the start
+        SimEndpoint endpoints[2];
+        sim_link_t links[2];                // indexed by the sending side
+
+    private:
+        friend class SimEndpoint;
+
+        static void endpointMain(unsigned int high, unsigned int low);
+        void resume(int id);
+        void transmit(int from, const void * buf, size_t len);
+        double uniform();
+
+        ucontext_t scheduler;
+
+        priority_queue<sim_packet_t *, vector<sim_packet_t *>, simPacketLater> inFlight;
+        unsigned long long order;
+        unsigned long long linkFree[2];
+        uint64_t rng;
+};
+
+#endif
@@ -0,0 +1,25 @@
+#include "stats.h"
+#include <sys/mman.h>
+
+transfer_stats_t * openStatsPage(const char * path, unsigned long long role)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0 || ftruncate(fd, sizeof(transfer_stats_t)) < 0) {
+        perror(path);
+        exit(1);
+    }
+
+    void * page = mmap(NULL, sizeof(transfer_stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+
+    transfer_stats_t * stats = (transfer_stats_t *)page;
+    memset(stats, 0, sizeof(transfer_stats_t));
+    stats->pid = getpid();
+    stats->role = role;
+    __atomic_store_n(&stats->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+    return stats;
+}
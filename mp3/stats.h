@@ -0,0 +1,28 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "parameters.h"
+#include "types.h"
+
+// Relaxed atomics: no ordering or locks on the hot path, and a reader mapping
+// the page never sees a torn value. Counters are added to from more than one
+// thread (the receiver's network and writer threads), so adds are read-modify-write
+inline void statSet(unsigned long long & field, unsigned long long value)
+{
+    __atomic_store_n(&field, value, __ATOMIC_RELAXED);
+}
+
+inline void statAdd(unsigned long long & field, unsigned long long value)
+{
+    __atomic_fetch_add(&field, value, __ATOMIC_RELAXED);
+}
+
+inline unsigned long long statGet(const unsigned long long & field)
+{
+    return __atomic_load_n(&field, __ATOMIC_RELAXED);
+}
+
+// Maps path as a shared statistics page for this process, exits on failure
+transfer_stats_t * openStatsPage(const char * path, unsigned long long role);
+
+#endif
@@ -0,0 +1,118 @@
+#include "stream.h"
+
+/*************** File Source ***************/
+FileSource::FileSource(int fd, unsigned long long bytes)
+{
+    this->fd = fd;
+    remaining = bytes;
+    digest = 0;
+    digestLength = 0;
+}
+
+size_t FileSource::read(char * buf, size_t len)
+{
+    size_t total = 0;
+    len = min((unsigned long long)len, remaining);
+
+    // regular files only come up short at EOF, but be safe
+    while(total < len){
+        ssize_t n = ::read(fd, buf + total, len - total);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0){
+            perror("read");
+            exit(1);
+        }
+        if(n == 0){
+            remaining = 0;
+            break;
+        }
+        total += n;
+    }
+
+    remaining -= min((unsigned long long)total, remaining);
+    digest = crc32c(digest, buf, total);
+    digestLength += total;
+    return total;
+}
+
+/*************** File Sink ***************/
+FileSink::FileSink(int fd)
+{
+    this->fd = fd;
+    digest = 0;
+    digestLength = 0;
+}
+
+void FileSink::write(const char * buf, size_t len)
+{
+    digest = crc32c(digest, buf, len);
+    digestLength += len;
+
+    while(len > 0){
+        ssize_t n = ::write(fd, buf, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0){
+            perror("write");
+            exit(1);
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+/*************** File List Provider ***************/
+void FileListProvider::add(const char * path, unsigned long long bytes)
+{
+    files.push_back(make_pair(string(path), bytes));
+}
+
+StreamSource * FileListProvider::open(FileSource *& digest)
+{
+    if(files.empty()){
+        return NULL;
+    }
+
+    int fd = ::open(files.front().first.c_str(), O_RDONLY);
+    if(fd < 0){
+        perror(files.front().first.c_str());
+        exit(1);
+    }
+    digest = new FileSource(fd, files.front().second);
+    files.pop_front();
+    return digest;
+}
+
+void FileListProvider::close(FileSource * digest)
+{
+    ::close(digest->fd);
+}
+
+/*************** Directory Acceptor ***************/
+DirectoryAcceptor::DirectoryAcceptor(const char * dir)
+{
+    this->dir = dir;
+    if(mkdir(dir, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) < 0 && errno != EEXIST){
+        perror(dir);
+        exit(1);
+    }
+}
+
+StreamSink * DirectoryAcceptor::accept(uint32_t id, FileSink *& digest)
+{
+    string path = dir + "/" + to_string(id);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(fd < 0){
+        perror(path.c_str());
+        exit(1);
+    }
+    digest = new FileSink(fd);
+    return digest;
+}
+
+void DirectoryAcceptor::close(uint32_t id, FileSink * digest, bool verified)
+{
+    if(verified == false){
+        fprintf(stderr, "Stream %u digest mismatch, %s/%u is corrupt\n", id, dir.c_str(), id);
+    }
+    ::close(digest->fd);
+}
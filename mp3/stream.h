@@ -0,0 +1,128 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "parameters.h"
+#include "types.h"
+#include "crc32c.h"
+
+// A stage producing the byte stream that the sender packetizes
+class StreamSource
+{
+    public:
+        virtual ~StreamSource(){}
+
+        // Copies up to len bytes into buf, returns 0 once the stream is exhausted
+        virtual size_t read(char * buf, size_t len) = 0;
+};
+
+// A stage consuming the in-order byte stream that the receiver reassembles
+class StreamSink
+{
+    public:
+        virtual ~StreamSink(){}
+
+        virtual void write(const char * buf, size_t len) = 0;
+        // Called once after the last byte of the stream has been written
+        virtual void finish(){}
+};
+
+// Reads a fixed number of bytes from an open file (the fd is not owned)
+class FileSource : public StreamSource
+{
+    public:
+        FileSource(int fd, unsigned long long bytes);
+        size_t read(char * buf, size_t len);
+
+        int fd;
+        unsigned long long remaining;
+
+        // running CRC32C of everything read
+        uint32_t digest;
+        unsigned long long digestLength;
+};
+
+// Appends to an open file (the fd is not owned)
+class FileSink : public StreamSink
+{
+    public:
+        FileSink(int fd);
+        void write(const char * buf, size_t len);
+        // bytes written here that have not reached the file yet
+        virtual size_t pending() { return 0; }
+
+        int fd;
+
+        // running CRC32C of everything written
+        uint32_t digest;
+        unsigned long long digestLength;
+};
+
+// Hands a multiplexed sender its streams, one at a time as earlier ones finish
+class StreamProvider
+{
+    public:
+        virtual ~StreamProvider(){}
+
+        // The next stream, NULL once there are no more; its end of stream carries digest's CRC32C.
+        // The sender deletes the stages once the stream is read, after close()
+        virtual StreamSource * open(FileSource *& digest) = 0;
+        virtual void close(FileSource * digest) = 0;
+        // Streams start with a manifest_header_t, the receiver recreates a tree from them
+        virtual bool manifests() { return false; }
+};
+
+// Gives a multiplexed receiver somewhere to write each stream it sees
+class StreamAcceptor
+{
+    public:
+        virtual ~StreamAcceptor(){}
+
+        // Stream id starts, digest is checked against the sender's when it ends.
+        // The receiver deletes the stages once the stream ends, after close()
+        virtual StreamSink * accept(uint32_t id, FileSink *& digest) = 0;
+        virtual void close(uint32_t id, FileSink * digest, bool verified) = 0;
+        // Waits until every closed stream is on disk, false if any could not be written
+        virtual bool finish() { return true; }
+};
+
+// Each file in the list is its own stream
+class FileListProvider : public StreamProvider
+{
+    public:
+        void add(const char * path, unsigned long long bytes);
+        StreamSource * open(FileSource *& digest);
+        void close(FileSource * digest);
+
+    private:
+        deque<pair<string, unsigned long long> > files;
+};
+
+// Stream n becomes the file n in a directory
+class DirectoryAcceptor : public StreamAcceptor
+{
+    public:
+        DirectoryAcceptor(const char * dir);
+        StreamSink * accept(uint32_t id, FileSink *& digest);
+        void close(uint32_t id, FileSink * digest, bool verified);
+
+    private:
+        string dir;
+};
+
+// A stream the sender is packetizing
+typedef struct {
+    uint32_t id;
+    uint32_t nextSeq;                   // streamSeq of its next packet
+    int lastSlot;                       // slot of its newest packet, -1 before the first
+    StreamSource * source;              // first stage, may wrap digest
+    FileSource * digest;
+} outgoing_stream_t;
+
+// A stream the receiver is reassembling
+typedef struct {
+    uint32_t nextSeq;                   // streamSeq it can deliver next
+    StreamSink * sink;                  // first stage, may wrap digest
+    FileSink * digest;
+} incoming_stream_t;
+
+#endif
@@ -10,6 +10,11 @@ void *get_in_addr(struct sockaddr *sa) {
 	return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
+// data packets: any of them may be the first the receiver hears after the handshake
+bool dataPacket(uint8_t type) {
+	return type == DATA_HEADER || type == STREAM_FIN_HEADER || type == DATA_FIN_HEADER;
+}
+
 void bufferFiller(CircularBuffer & buffer) {
 	buffer.fillBuffer();
 }
@@ -19,6 +24,7 @@ void packetSender(TCP & connection) {
 }
 
 TCP::~TCP(){
+	delete trace;
 	delete buffer;
 	close(sockfd);
 }
@@ -48,12 +54,13 @@ TCP::TCP(char * hostname, char * hostUDPport)
 
 	freeaddrinfo(servinfo);
 
+	// any free local port, so a receiver or proxy on this host can own hostUDPport
 	memset(&hints, 0, sizeof hints);
-	hints.ai_family = AF_UNSPEC;
+	hints.ai_family = receiverAddr.sa_family;
 	hints.ai_socktype = SOCK_DGRAM;
 	hints.ai_flags = AI_PASSIVE;
 
-	if ((rv = getaddrinfo(NULL, hostUDPport, &hints, &servinfo)) != 0) {
+	if ((rv = getaddrinfo(NULL, "0", &hints, &servinfo)) != 0) {
 		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
 		exit(1);
 	}
@@ -82,19 +89,26 @@ TCP::TCP(char * hostname, char * hostUDPport)
 
 	freeaddrinfo(servinfo);
 
-	// Initial time out estimation
+	// Initial time out estimation, applied once the connection starts
 	rto.tv_sec = 0;
 	rto.tv_usec = INIT_RTO;
-	if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &rto, sizeof(rto)) < 0) {
-		perror("setsockopt");
-		exit(3);
-	}
+	io = &systemIO;
 
 	// Book keeping
-	expectedAckSeqNum = 0;
-	lastPacketSent = -1;
+	expectedAckSeqNum = SEQ_START;
+	lastPacketSent = SEQ_START - 1;
 	numRetransmissions = 0;
+	resumeOffset = 0;
+	receiverWindow = BUFFER_SIZE;
+	fastOpen = false;
+	finVerified = false;
 	srtt = 0.0;
+	rtoNext = INIT_RTO;
+	memset(&localCounters, 0, sizeof(localCounters));
+	counters = &localCounters;
+	trace = NULL;
+	rateLimited = false;
+	setupSocketBuffers(true);
 
 	state = CLOSED;
 	sendState = WAITING_TO_SEND;
@@ -104,44 +118,123 @@ TCP::TCP(char * hostname, char * hostUDPport)
 void TCP::senderSetupConnection()
 {
 	struct timeval synTime;
-	msg_header_t syn;
+	syn_packet_t syn;
 	syn.type = SYN_HEADER;
 	syn.seqNum = htonl(0);
+	syn.fileSize = htobe64(buffer->bytesToTransfer);
+	syn.sourceId = htonl(buffer->sourceId);
+	syn.flags = options.compress ? SYN_FLAG_COMPRESS : 0;
+	syn.flags |= options.fastOpen ? SYN_FLAG_FASTOPEN : 0;
+	syn.flags |= (buffer->provider != NULL) ? SYN_FLAG_STREAMS : 0;
+	syn.flags |= (buffer->provider != NULL && buffer->provider->manifests()) ? SYN_FLAG_BATCH : 0;
 
 	state = LISTEN;
 
 	// send SYN
-	gettimeofday(&synTime, 0);
-	sendto(sockfd, (char *)&syn, sizeof(msg_header_t), 0, &receiverAddr, receiverAddrLen);
+	io->setRecvTimeout(sockfd, rto);
+	io->now(&synTime);
+	io->sendTo(sockfd, (char *)&syn, sizeof(syn_packet_t), &receiverAddr, receiverAddrLen);
 
 	state = SYN_SENT;
 
+	// the first window goes out now, the SYN + ACK turns up among its ACKs
+	if(options.fastOpen){
+		fastOpen = true;
+		fastOpenSyn = syn;
+		fastOpenSynTime = synTime;
+		return;
+	}
+
 	// wait for SYN + ACK
 	ack_packet_t ack;
 	ack.type = ACK_HEADER;
-	ack.seqNum = receiveStartSynAck(synTime);
+	ack.window = 0;
+	ack.seqNum = receiveStartSynAck(syn, synTime);
+
+	// receiver offered an existing copy to diff against
+	if(buffer->sigBlockSize > 0){
+		receiveSignatures();
+	}
+
+	// largest payload the path carries without fragmenting, opt-in since the final ACK waits on it
+	if(options.probeMtu){
+		probePathMtu();
+	}
 
 	// send ACK
-	sendto(sockfd, (char *)&ack, sizeof(ack_packet_t), 0, &receiverAddr, receiverAddrLen);
+	io->sendTo(sockfd, (char *)&ack, sizeof(ack_packet_t), &receiverAddr, receiverAddrLen);
 
 }
 
-void TCP::reliableSend(char * filename, unsigned long long int bytesToTransfer)
+bool TCP::reliableSend(char * filename, unsigned long long int bytesToTransfer)
 {
-    buffer = new CircularBuffer(BUFFER_SIZE, filename, bytesToTransfer);
+	buffer = new CircularBuffer(BUFFER_SIZE, filename, bytesToTransfer);
+	return runSender();
+}
 
-	// Set up TCP connection
+bool TCP::reliableSend(StreamProvider * provider)
+{
+	buffer = new CircularBuffer(BUFFER_SIZE, provider);
+	return runSender();
+}
+
+bool TCP::runSender()
+{
+	setupXdp();
+	setupUring();
+	setupBusyPoll();
+	pinTransportThread();
+
+	buffer->io = io;
+	if(io == &uringIO){
+		buffer->useUring(&uringIO);
+	}
+	if(options.rateLimit > 0){
+		rateLimit.configure(options.rateLimit);
+	}
+	if(options.statsPage != NULL){
+		counters = openStatsPage(options.statsPage, STATS_ROLE_SENDER);
+	}
+	buffer->counters = counters;
+	if(options.tracePath != NULL){
+		trace = new Tracer(options.tracePath);
+	}
+	statSet(counters->cwnd, buffer->windowSize);
+	TRACE(TRACE_CWND, expectedAckSeqNum, buffer->windowSize);
+	io->now(&transferStart);
+	sizingTime = transferStart;
+	sizingDelivered = 0;
+	statSet(counters->socketBuffer, socketBuffer);
+
+	// Set up TCP connection, the handshake only uses receiverAddr
+	setupSubflows();
 	senderSetupConnection();
 
-	state = ESTABLISHED;
+	// skip whatever the receiver already has from an interrupted transfer
+	if(resumeOffset > 0){
+		fprintf(stderr, "Resuming transfer at byte %llu\n", resumeOffset);
+		buffer->seekSource(resumeOffset);
+	}else if(buffer->signatures.empty() == false){
+		buffer->encodeDelta();
+	}
+	if(options.compress){
+		buffer->encodeCompression();
+	}
+
+	// a fast open connection is established by its first ACK instead
+	if(state != SYN_SENT){
+		state = ESTABLISHED;
+	}
 	sendState = SLOW_START;
 
 	// send initial information
+	buffer->endRto = rtoNext;
 	buffer->initialFill();
 	sendWindow();
 
  	while(ackManager() == true){
 		if(buffer->fileLoadCompleted != true){
+			buffer->endRto = rtoNext;
 			buffer->fillBuffer();
 		}
 		if((lastPacketSent - expectedAckSeqNum) != (int)(buffer->windowSize-1)){
@@ -152,51 +245,67 @@ void TCP::reliableSend(char * filename, unsigned long long int bytesToTransfer)
 	state = CLOSING;
 
 	// tear down TCP connection
-	senderTearDownConnection();
+	bool verified = senderTearDownConnection();
+	if(options.stats){
+		printStats(true);
+	}
+	return verified;
 }
 
-void TCP::senderTearDownConnection()
+bool TCP::senderTearDownConnection()
 {
-	msg_header_t fin;
-	fin.type = FIN_HEADER;
-	fin.seqNum = htonl(0);
-
-	// send FIN
-	sendto(sockfd, (char *)&fin, sizeof(msg_header_t), 0, &receiverAddr, receiverAddrLen);
-
-	state = FIN_SENT;
-
-	// wait for FIN + ACK
+	// the FIN + ACK that ended ackManager() acknowledged the end of stream, so this ACK is not waited on;
+	// it only lets the receiver leave TIME_WAIT early
 	ack_packet_t ack;
 	ack.type = ACK_HEADER;
-	ack.seqNum = receiveEndFinAck();
-
-	// send ACK
-	sendto(sockfd, (char *)&ack, sizeof(ack_packet_t), 0, &receiverAddr, receiverAddrLen);
+	ack.seqNum = htonl((uint32_t)buffer->endSeq);
+	ack.window = 0;
+	io->sendTo(sockfd, (char *)&ack, sizeof(ack_packet_t), &receiverAddr, receiverAddrLen);
 
 	state = CLOSED;
+
+	if(finVerified == false){
+		fprintf(stderr, "Receiver reported a file digest mismatch\n");
+	}
+	return finVerified;
 }
 
 
 bool TCP::ackManager()
 {
 	ack_process_t pACK;
-	struct sockaddr_storage theirAddr;
-	socklen_t theirAddrLen = sizeof(theirAddr);
+	int received;
 
 	// Transmission completed
 	if(expectedAckSeqNum >= buffer->seqNum && buffer->fileLoadCompleted == true){
 		return false;
 	}
 
-	// Wait for ack
-	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &rto, sizeof(rto));
-	if(recvfrom(sockfd, (char *)&pACK.ack, sizeof(ack_packet_wf_t), 0, (struct sockaddr*)&theirAddr, &theirAddrLen) == -1){
+	// Wait for ack, or only until a rate cap lets the next packet go; with nothing in flight there is no RTO to keep
+	struct timeval wait = rto;
+	unsigned long long paced = rateLimited ? rateWait() : 0;
+	if(paced > 0 && (paced < (unsigned long long)(US_PER_SEC*rto.tv_sec + rto.tv_usec) || lastPacketSent < expectedAckSeqNum)){
+		wait.tv_sec = paced/US_PER_SEC;
+		wait.tv_usec = paced%US_PER_SEC;
+	}else{
+		paced = 0;
+	}
+	io->setRecvTimeout(sockfd, wait);
+	if((received = receiveAck(pACK)) == -1){
+		// the cap held the next packet back, nothing was lost
+		if(paced > 0) return true;
+		// a closed receive window is not loss, ask for it instead of backing off cwnd
+		if(receiverWindow == 0){
+			sendWindowProbe(); return true;
+		}
+		if(state == SYN_SENT){
+			resendFastOpenSyn();
+		}
 		processTO(); return true;
 	}
 
 	// drop non-ack messages
-	if((pACK.ack.type != ACK_HEADER) && (pACK.ack.type != ACK_HEADER_W_FLAGS)) return true;
+	if(received == 0) return true;
 
 	//process ack if received
 	processAcks(pACK);
@@ -207,20 +316,66 @@ bool TCP::ackManager()
 	return true;
 }
 
+int TCP::receiveAck(ack_process_t & pACK)
+{
+	struct sockaddr_storage theirAddr;
+	socklen_t theirAddrLen = sizeof(theirAddr);
+	union {
+		ack_packet_wf_t ack;
+		syn_ack_packet_t synAck;
+	} packet;
+	int numbytes;
+
+	if((numbytes = io->recvFrom(sockfd, (char *)&packet, sizeof(packet), (struct sockaddr*)&theirAddr, &theirAddrLen)) == -1){
+		return -1;
+	}
+
+	// a late SYN + ACK must never be read as a SACK, its fields would free random slots
+	if(packet.synAck.type == SYN_ACK_HEADER){
+		if(numbytes == sizeof(syn_ack_packet_t)){
+			receiveFastOpenSynAck(packet.synAck);
+		}
+		return 0;
+	}
+
+	// the answer to the end of stream is a cumulative ACK that also reports the digest check
+	if((packet.ack.type == FIN_ACK_HEADER || packet.ack.type == FIN_ERR_HEADER) && numbytes == sizeof(ack_packet_t)){
+		finVerified = (packet.ack.type == FIN_ACK_HEADER);
+		packet.ack.type = ACK_HEADER;
+	}
+	if((packet.ack.type != ACK_HEADER) && (packet.ack.type != ACK_HEADER_W_FLAGS)) return 0;
+	pACK.ack = packet.ack;
+
+	// any ACK means the receiver has the SYN, even if its SYN + ACK was lost
+	if(state == SYN_SENT){
+		state = ESTABLISHED;
+	}
+	return 1;
+}
+
 void TCP::processTO()
 {
+	subflowTimeout();
+
 	// Send Window Settings
 	sendState = AIMD;
 	buffer->windowSize = max((buffer->windowSize)/2, (uint32_t)MIN_WINDOW_SIZE);
+	statSet(counters->cwnd, buffer->windowSize);
+	TRACE(TRACE_CWND, expectedAckSeqNum, buffer->windowSize);
 
 	// recalculate timing constraints
 	numRetransmissions++;
-	rttHistory.erase(rttHistory.begin(), rttHistory.begin() + min((size_t)(numRetransmissions*DROP_HIST_WEIGHT), rttHistory.size() - 1));
+	statAdd(counters->timeouts, 1);
+	if(rttHistory.empty() == false){
+		rttHistory.erase(rttHistory.begin(), rttHistory.begin() + min((size_t)(numRetransmissions*DROP_HIST_WEIGHT), rttHistory.size() - 1));
+	}
 
 	// Update RT
 	rtoNext = min(1.5*rtoNext, (double)MAX_RTO);
 	rto.tv_sec = ((unsigned long long)rtoNext)/(US_PER_SEC);
 	rto.tv_usec = ((unsigned long long)rtoNext)%(US_PER_SEC);
+	statSet(counters->rto, rtoNext);
+	TRACE(TRACE_TIMEOUT, expectedAckSeqNum, rtoNext);
 
 	// Resend window
 	resendTOWindow();
@@ -229,23 +384,37 @@ void TCP::processTO()
 
 void TCP::processAcks(ack_process_t & pACK)
 {
-	gettimeofday(&(pACK.time), 0);
-	pACK.ack.seqNum = ntohl(pACK.ack.seqNum);
+	io->now(&(pACK.time));
+	// ACKs only ever name packets around the oldest unacknowledged one
+	pACK.seqNum = seqUnwrap(ntohl(pACK.ack.seqNum), expectedAckSeqNum);
+
+	// a repeat of the last cumulative ACK that only moves the window is an update, not a duplicate
+	uint32_t window = ntohs(pACK.ack.window);
+	bool windowUpdate = (pACK.ack.type == ACK_HEADER && pACK.seqNum == expectedAckSeqNum - 1 && window != receiverWindow);
+	receiverWindow = window;
+	statSet(counters->rwnd, receiverWindow);
+	statSet(counters->hostDrops, io->rxDropped(sockfd));
+	if(windowUpdate){
+		buffer->eIdx = (pACK.seqNum + sendWindowSize())% BUFFER_SIZE;
+		return;
+	}
 
 	if(pACK.ack.type == ACK_HEADER){
+		TRACE(TRACE_ACK, pACK.seqNum, 0);
 		processCAck(pACK);
 	} else {
+		TRACE(TRACE_SACK, pACK.seqNum, __builtin_popcountll(pACK.ack.flags));
 		processSAck(pACK);
 	}
 }
 
 void TCP::processCAck(ack_process_t & pACK)
 {
-	if(expectedAckSeqNum == pACK.ack.seqNum){
+	if(expectedAckSeqNum == pACK.seqNum){
 		processCExpecAck(pACK);
-	} else if(expectedAckSeqNum < pACK.ack.seqNum){
+	} else if(expectedAckSeqNum < pACK.seqNum){
 		processCOoOAck(pACK);
-	} else if(expectedAckSeqNum == (pACK.ack.seqNum + 1)){
+	} else if(expectedAckSeqNum == (pACK.seqNum + 1)){
 		processCDupAck(pACK);
 	}
 }
@@ -253,10 +422,11 @@ void TCP::processCAck(ack_process_t & pACK)
 void TCP::processCExpecAck(ack_process_t & pACK)
 {
 	unsigned long long rttSample;
-	uint32_t ackReceivedIdx = (pACK.ack.seqNum % BUFFER_SIZE);
+	uint32_t ackReceivedIdx = (pACK.seqNum % BUFFER_SIZE);
 
-	buffer->state[ackReceivedIdx] = AVAILABLE;
+	buffer->state.set(ackReceivedIdx, AVAILABLE);
 	rttSample = (US_PER_SEC*(pACK.time.tv_sec - buffer->timestamp[ackReceivedIdx].tv_sec) + pACK.time.tv_usec - buffer->timestamp[ackReceivedIdx].tv_usec);
+	subflowRttSample(ackReceivedIdx, rttSample);
 
 	updateWindowSettings(pACK);
 	updateTimingConstraints(rttSample);
@@ -264,28 +434,28 @@ void TCP::processCExpecAck(ack_process_t & pACK)
 
 void TCP::processCOoOAck(ack_process_t & pACK)
 {
-	uint32_t ackReceivedIdx = (pACK.ack.seqNum % BUFFER_SIZE);
+	uint32_t ackReceivedIdx = (pACK.seqNum % BUFFER_SIZE);
 
 	// Handling missing acks based on cumulative out of order ACK
-	for(unsigned int i = (expectedAckSeqNum % buffer->data.size()); i != (ackReceivedIdx); i = ((i + 1) % buffer->data.size())){
-		if(buffer->state[i] == SENT){
-			buffer->state[i] = AVAILABLE;
-		}
-	}
+	uint32_t expectedIdx = expectedAckSeqNum % BUFFER_SIZE;
+	buffer->state.sent.clearRange(expectedIdx, (ackReceivedIdx + BUFFER_SIZE - expectedIdx) % BUFFER_SIZE);
 
 	// handling acked message
-	buffer->state[ackReceivedIdx] = AVAILABLE;
+	buffer->state.set(ackReceivedIdx, AVAILABLE);
 
 	updateWindowSettings(pACK);
 }
 
 void TCP::processCDupAck(ack_process_t & pACK)
 {
-	static int dupAckLastSeen = -1;
+	static seq_t dupAckLastSeen = -1;
 	static uint8_t counter  = 0;
 	static uint8_t counterPost = 0;
 
-	if(dupAckLastSeen == pACK.ack.seqNum){
+	statAdd(counters->dupAcks, 1);
+	TRACE(TRACE_DUPACK, pACK.seqNum, 0);
+
+	if(dupAckLastSeen == pACK.seqNum){
 		counter++;
 		if(counter == DUP_MAX_COUNTER){
 			counterPost = 0;
@@ -301,18 +471,18 @@ void TCP::processCDupAck(ack_process_t & pACK)
 	}else{
 		counter = 0;
 		counterPost = 0;
-		dupAckLastSeen = pACK.ack.seqNum;
+		dupAckLastSeen = pACK.seqNum;
 		numRetransmissions = numRetransmissions/2;
 	}
 }
 
 void TCP::processSAck(ack_process_t & pACK)
 {
-	if(expectedAckSeqNum == pACK.ack.seqNum){
+	if(expectedAckSeqNum == pACK.seqNum){
 		processSExpecAck(pACK);
-	} else if(expectedAckSeqNum < pACK.ack.seqNum){
+	} else if(expectedAckSeqNum < pACK.seqNum){
 		processSOoOAck(pACK);
-	} else if(expectedAckSeqNum == (pACK.ack.seqNum + 1)){
+	} else if(expectedAckSeqNum == (pACK.seqNum + 1)){
 		processSDupAck(pACK);
 	}
 }
@@ -320,21 +490,13 @@ void TCP::processSAck(ack_process_t & pACK)
 void TCP::processSExpecAck(ack_process_t & pACK)
 {
 	unsigned long long rttSample;
-	uint32_t ackReceivedIdx = (pACK.ack.seqNum % BUFFER_SIZE);
+	uint32_t ackReceivedIdx = (pACK.seqNum % BUFFER_SIZE);
 
-	buffer->state[ackReceivedIdx] = AVAILABLE;
+	buffer->state.set(ackReceivedIdx, AVAILABLE);
 	rttSample = (US_PER_SEC*(pACK.time.tv_sec - buffer->timestamp[ackReceivedIdx].tv_sec) + pACK.time.tv_usec - buffer->timestamp[ackReceivedIdx].tv_usec);
+	subflowRttSample(ackReceivedIdx, rttSample);
 
-	uint64_t mask = 1;
-	uint64_t flags = be64toh(pACK.ack.flags);
-	uint32_t j = (ackReceivedIdx + 1)%BUFFER_SIZE;
-	for(size_t i = 0; i < FLAG_SIZE; i++) {
-		if(flags & mask){
-			buffer->state[j] = AVAILABLE;
-		}
-		mask = mask << 1;
-		j = (j + 1)%BUFFER_SIZE;
-	}
+	processSackFlags(pACK);
 
 	updateWindowSettings(pACK);
 	updateTimingConstraints(rttSample);
@@ -342,23 +504,16 @@ void TCP::processSExpecAck(ack_process_t & pACK)
 
 void TCP::processSDupAck(ack_process_t & pACK)
 {
-	static int dupAckLastSeen = -1;
+	static seq_t dupAckLastSeen = -1;
 	static uint8_t counter  = 0;
 	static uint8_t counterPost = 0;
-	uint32_t ackReceivedIdx = (pACK.ack.seqNum % BUFFER_SIZE);
 
-	uint64_t mask = 1;
-	uint64_t flags = be64toh(pACK.ack.flags);
-	uint32_t j = (ackReceivedIdx + 1)%BUFFER_SIZE;
-	for(size_t i = 0; i < FLAG_SIZE; i++) {
-		if(flags & mask){
-			buffer->state[j] = AVAILABLE;
-		}
-		mask = mask << 1;
-		j = (j + 1)%BUFFER_SIZE;
-	}
+	processSackFlags(pACK);
 
-	if(dupAckLastSeen == pACK.ack.seqNum){
+	statAdd(counters->dupAcks, 1);
+	TRACE(TRACE_DUPACK, pACK.seqNum, 0);
+
+	if(dupAckLastSeen == pACK.seqNum){
 		counter++;
 		if(counter == DUP_MAX_COUNTER){
 			counterPost = 0;
@@ -374,71 +529,100 @@ void TCP::processSDupAck(ack_process_t & pACK)
 	}else{
 		counter = 0;
 		counterPost = 0;
-		dupAckLastSeen = pACK.ack.seqNum;
+		dupAckLastSeen = pACK.seqNum;
 		numRetransmissions = numRetransmissions/2;
 	}
 }
 
 void TCP::processSOoOAck(ack_process_t & pACK)
 {
-	uint32_t ackReceivedIdx = (pACK.ack.seqNum % BUFFER_SIZE);
+	uint32_t ackReceivedIdx = (pACK.seqNum % BUFFER_SIZE);
 
 	// Handling missing acks based on cumulative out of order ACK
-	for(unsigned int i = (expectedAckSeqNum % BUFFER_SIZE); i != (ackReceivedIdx); i = ((i + 1) % BUFFER_SIZE)){
-		if(buffer->state[i] == SENT){
-			buffer->state[i] = AVAILABLE;
-		}
-	}
+	uint32_t expectedIdx = expectedAckSeqNum % BUFFER_SIZE;
+	buffer->state.sent.clearRange(expectedIdx, (ackReceivedIdx + BUFFER_SIZE - expectedIdx) % BUFFER_SIZE);
 
 	// handling acked message
-	buffer->state[ackReceivedIdx] = AVAILABLE;
+	buffer->state.set(ackReceivedIdx, AVAILABLE);
 
-	uint64_t mask = 1;
-	uint64_t flags = be64toh(pACK.ack.flags);
-	uint32_t j = (ackReceivedIdx + 1)%BUFFER_SIZE;
-	for(size_t i = 0; i < FLAG_SIZE; i++) {
-		if(flags & mask){
-			buffer->state[j] = AVAILABLE;
-		}
-		mask = mask << 1;
-		j = (j + 1)%BUFFER_SIZE;
-	}
+	processSackFlags(pACK);
 
 	updateWindowSettings(pACK);
 }
 
+void TCP::processSackFlags(ack_process_t & pACK)
+{
+	// bit i of the flags is the packet after the cumulative ACK + i
+	uint64_t flags = be64toh(pACK.ack.flags);
+	uint32_t first = (pACK.seqNum + 1) % BUFFER_SIZE;
+	buffer->state.acknowledge(first, flags);
+	for(uint64_t rest = flags; rest != 0; rest &= rest - 1) {
+		subflowDelivered((first + __builtin_ctzll(rest)) % BUFFER_SIZE, pACK.time);
+	}
+}
+
 void TCP::updateWindowSettings(ack_process_t & pACK)
 {
-	if((sendState == SLOW_START) || (sendState == AIMD && (pACK.ack.seqNum % buffer->windowSize) == (buffer->windowSize - 1))){
+	// a window a rate cap kept from filling says nothing about the path, the cap bounds cwnd instead of loss
+	if(rateLimited == false && ((sendState == SLOW_START) || (sendState == AIMD && (pACK.seqNum % buffer->windowSize) == (buffer->windowSize - 1)))){
 		buffer->windowSize = min((buffer->windowSize + 1), (uint32_t) MAX_WINDOW_SIZE);
-		// cout << "WINDOW SIZE: " << buffer->windowSizsube << "\n";
+		statSet(counters->cwnd, buffer->windowSize);
+		TRACE(TRACE_CWND, expectedAckSeqNum, buffer->windowSize);
 	}
 
-	buffer->sIdx = (pACK.ack.seqNum + 1)% BUFFER_SIZE;
-	buffer->eIdx = (pACK.ack.seqNum + (buffer->windowSize))% BUFFER_SIZE;
+	// payload bytes newly covered by the cumulative ACK, and the subflows that carried them
+	unsigned long long acked = 0;
+	for(seq_t seq = expectedAckSeqNum; seq <= pACK.seqNum; seq++) {
+		acked += buffer->length[seq % BUFFER_SIZE] - buffer->headerLength();
+		subflowDelivered(seq % BUFFER_SIZE, pACK.time);
+	}
+	statAdd(counters->bytesAcked, acked);
+	sizeSocketBuffers(statGet(counters->bytesAcked), srtt, (unsigned long long)sendWindowSize()*(buffer->payload + sizeof(msg_header_t)));
+
+	buffer->sIdx = (pACK.seqNum + 1)% BUFFER_SIZE;
+	buffer->eIdx = (pACK.seqNum + sendWindowSize())% BUFFER_SIZE;
+
+	expectedAckSeqNum = pACK.seqNum + 1;
+}
+
+uint32_t TCP::sendWindowSize()
+{
+	return min(buffer->windowSize, receiverWindow);
+}
 
-	expectedAckSeqNum = pACK.ack.seqNum + 1;
+void TCP::sendWindowProbe()
+{
+	msg_header_t probe;
+	probe.type = WINDOW_PROBE_HEADER;
+	probe.seqNum = htonl((uint32_t)expectedAckSeqNum);
+	probe.crc = 0;
+	io->sendTo(sockfd, (char *)&probe, sizeof(msg_header_t), &receiverAddr, receiverAddrLen);
+
+	// back off between probes until the window opens
+	rtoNext = min(2*rtoNext, (double)MAX_RTO);
+	rto.tv_sec = ((unsigned long long)rtoNext)/(US_PER_SEC);
+	rto.tv_usec = ((unsigned long long)rtoNext)%(US_PER_SEC);
 }
 
 void TCP::resendTOWindow()
 {
-	struct sockaddr_storage theirAddr;
-	socklen_t theirAddrLen = sizeof(theirAddr);
 	ack_process_t pACK;
 
 	// set timing options for acks during retransmission
 	struct timeval retransCheckTime;
 	retransCheckTime.tv_sec = 0;
 	retransCheckTime.tv_usec = RETRANS_CHECK_TIME;
-	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &retransCheckTime, sizeof(retransCheckTime));
+	io->setRecvTimeout(sockfd, retransCheckTime);
 
 	int j = buffer->sIdx;
 	for(unsigned int i = 0; i < buffer->data.size(); i++) {
-		if(buffer->state[j] == SENT){
-			gettimeofday(&(buffer->timestamp[j]), 0);
-			sendto(sockfd, (char *)&(buffer->data[j]), buffer->length[j], 0, &receiverAddr, receiverAddrLen);
+		if(buffer->state.get(j) == SENT){
+			sendPacket(j);
+			statAdd(counters->packetsSent, 1);
+			statAdd(counters->packetsRetransmitted, 1);
+			TRACE(TRACE_RETRANSMIT, ntohl(buffer->data[j].header.seqNum), buffer->length[j]);
 
-			if(recvfrom(sockfd, (char *)&pACK.ack, sizeof(ack_packet_wf_t), 0, (struct sockaddr*)&theirAddr, &theirAddrLen) != -1){
+			if(receiveAck(pACK) == 1){
 				processAcks(pACK);
 			}
 		}
@@ -450,9 +634,11 @@ void TCP::resendWindow()
 {
 	int j = buffer->sIdx;
 	for(unsigned int i = 0; i < (buffer->windowSize)/2; i++) {
-		if(buffer->state[j] == SENT){
-			gettimeofday(&(buffer->timestamp[j]), 0);
-			sendto(sockfd, (char *)&(buffer->data[j]), buffer->length[j], 0, &receiverAddr, receiverAddrLen);
+		if(buffer->state.get(j) == SENT && subflowInFlight(j) == false){
+			sendPacket(j);
+			statAdd(counters->packetsSent, 1);
+			statAdd(counters->packetsRetransmitted, 1);
+			TRACE(TRACE_RETRANSMIT, ntohl(buffer->data[j].header.seqNum), buffer->length[j]);
 		}
 		j = (j + 1) % BUFFER_SIZE;
 	}
@@ -460,6 +646,12 @@ void TCP::resendWindow()
 
 void TCP::updateTimingConstraints(unsigned long long rttSample)
 {
+	// fast open has no handshake sample, the first ACK stands in for it
+	if(rttHistory.empty()){
+		seedTimingConstraints(rttSample);
+		return;
+	}
+
 	if(rttHistory.size() >= MAX_RTT_HISTORY){
 		// once we have hit the max history, start dorping values
 		rttHistory.pop_front();
@@ -469,6 +661,8 @@ void TCP::updateTimingConstraints(unsigned long long rttSample)
 		rttHistory.push_back(rttSample);
 	}
 
+	TRACE(TRACE_RTT, expectedAckSeqNum, rttSample);
+
 	// update SRTT
 	alpha = min(ALPHA_TO_SCALAR*numRetransmissions + ALPHA, ALPHA_MAX);
 	srtt = (1.0 - alpha)*((double)srtt) + alpha*((double)rttSample);
@@ -478,6 +672,8 @@ void TCP::updateTimingConstraints(unsigned long long rttSample)
 	rtoNext = min(rtoNext, (double)MAX_RTO);
 	rto.tv_sec = ((unsigned long long)rtoNext)/(US_PER_SEC);
 	rto.tv_usec = ((unsigned long long)rtoNext)%(US_PER_SEC);
+	statSet(counters->srtt, srtt);
+	statSet(counters->rto, rtoNext);
 }
 
 double TCP::stdDevRTT()
@@ -509,31 +705,385 @@ inline double TCP::srttWeight(){
 
 void TCP::sendWindow()
 {
+	rateLimited = false;
+
+	// nothing new fits in min(cwnd, rwnd)
+	if(lastPacketSent >= expectedAckSeqNum - 1 + (int)sendWindowSize()){
+		return;
+	}
+
 	uint32_t eIdx = buffer->eIdx;
 	uint32_t i = (lastPacketSent + 1) % BUFFER_SIZE;
 
 	for(;i != eIdx; i = (i + 1)%BUFFER_SIZE){
-		if(buffer->state[i] == FILLED){
-			buffer->state[i] = SENT;
+		if(buffer->state.get(i) == FILLED){
+			if(rateBlocked()) return;
+			buffer->state.set(i, SENT);
 
-			gettimeofday(&(buffer->timestamp[i]), 0);
-			sendto(sockfd, (char *)&(buffer->data[i]), buffer->length[i], 0, &receiverAddr, receiverAddrLen);
+			sendPacket(i);
+			statAdd(counters->packetsSent, 1);
+			TRACE(TRACE_SEND, ntohl(buffer->data[i].header.seqNum), buffer->length[i]);
 
 			lastPacketSent++;
 		}
 	}
 
 	// edge case of i == eIdx
-	if(buffer->state[i] == FILLED){
-		buffer->state[i] = SENT;
-		gettimeofday(&(buffer->timestamp[i]), 0);
-		sendto(sockfd, (char *)&(buffer->data[i]), buffer->length[i], 0, &receiverAddr, receiverAddrLen);
+	if(buffer->state.get(i) == FILLED && rateBlocked() == false){
+		buffer->state.set(i, SENT);
+		sendPacket(i);
+		statAdd(counters->packetsSent, 1);
+		TRACE(TRACE_SEND, ntohl(buffer->data[i].header.seqNum), buffer->length[i]);
 
 		// book keeping
 		lastPacketSent++;
 	}
 }
 
+void TCP::printStats(bool sender)
+{
+	struct timeval now;
+	struct rusage usage;
+	io->now(&now);
+	getrusage(RUSAGE_SELF, &usage);
+
+	unsigned long long elapsed = US_PER_SEC*(now.tv_sec - transferStart.tv_sec) + now.tv_usec - transferStart.tv_usec;
+	unsigned long long cpu = US_PER_SEC*(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+
+	// one key=value line, easy to scrape from scripts
+	if(sender == false){
+		fprintf(stderr, "stats role=receiver bytes=%llu elapsed_us=%llu packets=%llu cpu_us=%llu host_drops=%llu sockbuf=%llu hugealigned_bytes=%llu\n",
+			finLength, elapsed, counters->packetsReceived, cpu, counters->hostDrops, counters->socketBuffer, arenaHugeAlignedBytes.load());
+	}else{
+		fprintf(stderr, "stats role=sender bytes=%llu elapsed_us=%llu packets=%llu retransmits=%llu timeouts=%llu cpu_us=%llu host_drops=%llu sockbuf=%llu hugealigned_bytes=%llu\n",
+			buffer->bytesToTransfer, elapsed, counters->packetsSent, counters->packetsRetransmitted, counters->timeouts, cpu, counters->hostDrops, counters->socketBuffer,
+			arenaHugeAlignedBytes.load());
+
+		for(size_t i = 0; subflows.size() > 1 && i < subflows.size(); i++) {
+			char local[INET6_ADDRSTRLEN] = "any", remote[INET6_ADDRSTRLEN];
+			if(subflows[i].local.ss_family != AF_UNSPEC){
+				inet_ntop(subflows[i].local.ss_family, get_in_addr((struct sockaddr *)&subflows[i].local), local, sizeof(local));
+			}
+			inet_ntop(subflows[i].remote.ss_family, get_in_addr((struct sockaddr *)&subflows[i].remote), remote, sizeof(remote));
+			fprintf(stderr, "stats role=subflow index=%zu local=%s remote=%s packets=%llu delivered=%llu srtt_us=%.0f\n",
+				i, local, remote, subflows[i].sent, subflows[i].delivered, subflows[i].srtt);
+		}
+	}
+}
+
+/*************** Rate Limiting ***************/
+// Whether a cap holds back the next new packet; retransmissions are charged but never held
+bool TCP::rateBlocked()
+{
+	if(rateLimit.limited() == false && processRateLimit.limited() == false) return false;
+
+	rateLimited = (rateWait() > 0);
+	return rateLimited;
+}
+
+unsigned long long TCP::rateWait()
+{
+	struct timeval now;
+	io->now(&now);
+	unsigned long long nowUs = US_PER_SEC*now.tv_sec + now.tv_usec;
+	return max(rateLimit.waitUs(nowUs), processRateLimit.waitUs(nowUs));
+}
+
+/*************** Multipath ***************/
+// Appends each address in a comma separated list, resolved numerically with the given port
+void parseAddresses(const char * list, int family, const char * port, vector<struct sockaddr_storage> & out)
+{
+	if(list == NULL) return;
+
+	string addresses(list);
+	size_t start = 0;
+	while(start <= addresses.size()){
+		size_t end = addresses.find(',', start);
+		if(end == string::npos) end = addresses.size();
+		string host = addresses.substr(start, end - start);
+		start = end + 1;
+		if(host.empty()) continue;
+
+		struct addrinfo hints, *servinfo;
+		memset(&hints, 0, sizeof hints);
+		hints.ai_family = family;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = AI_NUMERICHOST;
+		int rv;
+		if ((rv = getaddrinfo(host.c_str(), port, &hints, &servinfo)) != 0) {
+			fprintf(stderr, "multipath address %s: %s\n", host.c_str(), gai_strerror(rv));
+			exit(1);
+		}
+		struct sockaddr_storage addr;
+		memset(&addr, 0, sizeof(addr));
+		memcpy(&addr, servinfo->ai_addr, servinfo->ai_addrlen);
+		out.push_back(addr);
+		freeaddrinfo(servinfo);
+	}
+}
+
+void TCP::setupSubflows()
+{
+	vector<struct sockaddr_storage> locals, remotes;
+	char port[8];
+	snprintf(port, sizeof(port), "%d", ntohs(((struct sockaddr_in *)&receiverAddr)->sin_port));
+
+	// the receiver named on the command line is always a remote, the default source always a local
+	struct sockaddr_storage addr;
+	memset(&addr, 0, sizeof(addr));
+	memcpy(&addr, &receiverAddr, receiverAddrLen);
+	remotes.push_back(addr);
+	parseAddresses(options.remoteAddrs, receiverAddr.sa_family, port, remotes);
+	parseAddresses(options.localAddrs, receiverAddr.sa_family, "0", locals);
+	if(locals.empty()){
+		memset(&addr, 0, sizeof(addr));
+		addr.ss_family = AF_UNSPEC;
+		locals.push_back(addr);
+	}
+	if(locals.size()*remotes.size() > MAX_SUBFLOWS){
+		fprintf(stderr, "at most %d subflows\n", MAX_SUBFLOWS);
+		exit(1);
+	}
+
+	subflows.clear();
+	for(struct sockaddr_storage & local : locals) {
+		for(struct sockaddr_storage & remote : remotes) {
+			subflow_t flow;
+			memset(&flow, 0, sizeof(flow));
+			flow.local = local;
+			flow.remote = remote;
+			flow.remoteLen = receiverAddrLen;
+			subflows.push_back(flow);
+		}
+	}
+	slotSubflow.assign(BUFFER_SIZE, NO_SUBFLOW);
+	slotResent.assign(BUFFER_SIZE, false);
+}
+
+void TCP::sendPacket(uint32_t idx)
+{
+	// a retransmission moves the packet off the subflow it was last sent on
+	slotResent[idx] = (slotSubflow[idx] != NO_SUBFLOW);
+	if(slotSubflow[idx] != NO_SUBFLOW){
+		subflows[slotSubflow[idx]].inflight--;
+	}
+	uint32_t flow = pickSubflow();
+	subflows[flow].inflight++;
+	subflows[flow].sent++;
+	slotSubflow[idx] = flow;
+
+	rateLimit.take(buffer->length[idx]);
+	processRateLimit.take(buffer->length[idx]);
+
+	io->now(&(buffer->timestamp[idx]));
+	if(io->sendFrom(sockfd, (char *)&(buffer->data[idx]), buffer->length[idx], (struct sockaddr *)&subflows[flow].local,
+		(struct sockaddr *)&subflows[flow].remote, subflows[flow].remoteLen) < 0 && subflows.size() > 1){
+		// no route or address from here, the RTO resends it elsewhere
+		subflows[flow].srtt = MAX_RTO;
+	}
+}
+
+uint32_t TCP::pickSubflow()
+{
+	if(subflows.size() == 1) return 0;
+
+	// earliest expected delivery: half a round trip, plus the time to drain whatever is queued past the
+	// subflow's pipe; the pipe is twice its measured delivery rate over a round trip so a subflow the
+	// sender has not filled yet still looks empty
+	uint32_t best = 0;
+	double bestDelivery = numeric_limits<double>::max();
+	for(uint32_t i = 0; i < subflows.size(); i++) {
+		subflow_t & flow = subflows[i];
+		double rtt = (flow.srtt > 0) ? flow.srtt : ((srtt > 0) ? srtt : INIT_RTO);
+		double pipe = max(2*flow.rate*rtt, (double)SUBFLOW_INIT_RATE_WINDOW);
+		double queued = max((double)flow.inflight - pipe, 0.0);
+		double delivery = rtt/2 + queued*rtt/pipe;
+		if(delivery < bestDelivery){
+			bestDelivery = delivery;
+			best = i;
+		}
+	}
+	return best;
+}
+
+void TCP::subflowRttSample(uint32_t idx, unsigned long long rttSample)
+{
+	if(slotSubflow[idx] == NO_SUBFLOW || slotResent[idx]) return;
+
+	subflow_t & flow = subflows[slotSubflow[idx]];
+	flow.srtt = (flow.srtt > 0) ? (1.0 - ALPHA)*flow.srtt + ALPHA*rttSample : rttSample;
+}
+
+void TCP::subflowDelivered(uint32_t idx, struct timeval & now)
+{
+	if(slotSubflow[idx] == NO_SUBFLOW) return;
+
+	subflow_t & flow = subflows[slotSubflow[idx]];
+	slotSubflow[idx] = NO_SUBFLOW;
+	flow.inflight--;
+	flow.delivered++;
+
+	// delivery rate over at least one of the subflow's round trips
+	if(flow.markTime.tv_sec == 0 && flow.markTime.tv_usec == 0){
+		flow.markTime = now;
+		flow.deliveredMark = flow.delivered;
+		return;
+	}
+	double elapsed = US_PER_SEC*(now.tv_sec - flow.markTime.tv_sec) + now.tv_usec - flow.markTime.tv_usec;
+	if(elapsed > 0 && elapsed >= flow.srtt){
+		double rate = (flow.delivered - flow.deliveredMark)/elapsed;
+		flow.rate = (flow.rate > 0) ? (1.0 - ALPHA)*flow.rate + ALPHA*rate : rate;
+		flow.markTime = now;
+		flow.deliveredMark = flow.delivered;
+	}
+}
+
+bool TCP::subflowInFlight(uint32_t idx)
+{
+	// subflows reorder against each other, a packet is not missing until its own subflow had time to
+	// deliver it; one not sampled yet gets the whole RTO, or its late packets would be resent forever
+	if(subflows.size() == 1 || slotSubflow[idx] == NO_SUBFLOW) return false;
+
+	struct timeval now;
+	io->now(&now);
+	double age = US_PER_SEC*(now.tv_sec - buffer->timestamp[idx].tv_sec) + now.tv_usec - buffer->timestamp[idx].tv_usec;
+	subflow_t & flow = subflows[slotSubflow[idx]];
+	return age < ((flow.srtt > 0) ? flow.srtt : rtoNext);
+}
+
+void TCP::subflowTimeout()
+{
+	if(subflows.size() == 1) return;
+
+	// subflows holding a packet unacknowledged for a whole RTO look twice as slow until fresh samples
+	// say otherwise, so the retransmissions and what follows move to the ones still delivering
+	struct timeval now;
+	io->now(&now);
+	vector<bool> expired(subflows.size(), false);
+	for(uint32_t idx = 0; idx < BUFFER_SIZE; idx++) {
+		if(buffer->state.get(idx) != SENT || slotSubflow[idx] == NO_SUBFLOW) continue;
+		double age = US_PER_SEC*(now.tv_sec - buffer->timestamp[idx].tv_sec) + now.tv_usec - buffer->timestamp[idx].tv_usec;
+		if(age >= rtoNext){
+			expired[slotSubflow[idx]] = true;
+		}
+	}
+
+	for(uint32_t i = 0; i < subflows.size(); i++) {
+		if(expired[i]){
+			subflows[i].srtt = min(2*((subflows[i].srtt > 0) ? subflows[i].srtt : rtoNext), (double)MAX_RTO);
+			subflows[i].rate = subflows[i].rate/2;
+		}
+	}
+}
+
+/*************** Latency Mode ***************/
+void TCP::setupXdp()
+{
+	if(options.xdpInterface == NULL || io != &systemIO) return;
+
+	if(xdpIO.attach(sockfd, options.xdpInterface) == false){
+		fprintf(stderr, "AF_XDP receive on %s unavailable\n", options.xdpInterface);
+		exit(1);
+	}
+	io = &xdpIO;
+}
+
+void TCP::setupUring()
+{
+	if(options.uring == false || io != &systemIO) return;
+
+	if(uringIO.attach(sockfd) == false){
+		fprintf(stderr, "io_uring unavailable, using plain system calls\n");
+		return;
+	}
+	io = &uringIO;
+
+	// the ring has a single issuer, disk writes go through it from the transport thread
+	options.writerThread = false;
+}
+
+void TCP::setupBusyPoll()
+{
+	// a simulator or other injected io already decides how waiting works
+	if(options.busyPoll == false || io != &systemIO) return;
+
+	busyPollIO.attach(sockfd);
+	io = &busyPollIO;
+}
+
+void TCP::pinTransportThread()
+{
+	if(options.cpu < 0) return;
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(options.cpu, &cpus);
+	if(sched_setaffinity(0, sizeof(cpus), &cpus) < 0){
+		perror("sched_setaffinity");
+		exit(1);
+	}
+}
+
+/*************** Socket Buffers ***************/
+void TCP::setupSocketBuffers(bool sender)
+{
+	// count kernel receive queue drops so they can be told apart from network loss
+	int on = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+
+	// until there is a measurement, room for one full window of the largest datagrams
+	sizesSendBuffer = sender;
+	unsigned long long burst = MAX_WINDOW_SIZE*(sender ? MAX_DATAGRAM : datagramTruesize(MAX_DATAGRAM));
+	socketBuffer = setSocketBuffer(min(max(burst, (unsigned long long)SOCKBUF_MIN), (unsigned long long)SOCKBUF_MAX));
+}
+
+void TCP::sizeSocketBuffers(unsigned long long delivered, double rttUs, unsigned long long burst)
+{
+	struct timeval now;
+	io->now(&now);
+	unsigned long long elapsed = US_PER_SEC*(now.tv_sec - sizingTime.tv_sec) + now.tv_usec - sizingTime.tv_usec;
+	if(elapsed < max((double)SOCKBUF_INTERVAL, rttUs)) return;
+
+	// bandwidth over the last interval times srtt, never less than a window's burst
+	double bdp = (double)(delivered - sizingDelivered)/elapsed*rttUs;
+	unsigned long long target = max((unsigned long long)(SOCKBUF_BDP_MULTIPLE*bdp), burst);
+	target = min(max(target, (unsigned long long)SOCKBUF_MIN), (unsigned long long)SOCKBUF_MAX);
+	sizingTime = now;
+	sizingDelivered = delivered;
+
+	// the kernel reports double what was asked for, to cover its own overhead
+	if(fabs(2.0*target - socketBuffer) < SOCKBUF_HYSTERESIS*socketBuffer) return;
+	socketBuffer = setSocketBuffer(target);
+	statSet(counters->socketBuffer, socketBuffer);
+}
+
+// the receive buffer is charged each datagram's skb truesize, not its length: the data sits in an
+// allocation rounded up to a power of two, with the sk_buff on top. A 9000 byte datagram costs 16.6 KB.
+unsigned long long TCP::datagramTruesize(uint32_t datagram)
+{
+	unsigned long long allocation = 1;
+	while(allocation < SKB_HEADROOM + IPV6_HEADER_SIZE + UDP_HEADER_SIZE + datagram + SKB_SHARED_INFO){
+		allocation <<= 1;
+	}
+	return allocation + SKB_STRUCT;
+}
+
+int TCP::setSocketBuffer(int bytes)
+{
+	int optname = sizesSendBuffer ? SO_SNDBUF : SO_RCVBUF;
+	int forceOptname = sizesSendBuffer ? SO_SNDBUFFORCE : SO_RCVBUFFORCE;
+
+	// privileged processes can go past net.core.wmem_max and rmem_max
+	if(setsockopt(sockfd, SOL_SOCKET, forceOptname, &bytes, sizeof(bytes)) < 0){
+		setsockopt(sockfd, SOL_SOCKET, optname, &bytes, sizeof(bytes));
+	}
+
+	int actual = 0;
+	socklen_t actualLen = sizeof(actual);
+	getsockopt(sockfd, SOL_SOCKET, optname, &actual, &actualLen);
+	return actual;
+}
+
 /*************** Receiver Functions ***************/
 TCP::TCP(char * hostUDPport)
 {
@@ -574,108 +1124,245 @@ TCP::TCP(char * hostUDPport)
 
 	freeaddrinfo(servinfo);
 
+	resumeOffset = 0;
+	finDigest = 0;
+	finLength = 0;
+	memset(&localCounters, 0, sizeof(localCounters));
+	counters = &localCounters;
+	trace = NULL;
+	rateLimited = false;
+	probedDatagram = sizeof(msg_header_t) + PAYLOAD;
+	rxBuffer.resize(MAX_DATAGRAM);
+	io = &systemIO;
+	bytesReceived = 0;
+	handshakeRtt = 0.0;
+	fastOpen = false;
+	setupSocketBuffers(false);
 	state = CLOSED;
 }
 
 void TCP::receiverSetupConnection()
 {
-	msg_header_t syn_ack;
+	syn_ack_packet_t syn_ack;
+	unsigned long long fileSize;
+	uint32_t sourceId;
+	uint8_t synFlags;
+	bool delta = false;
+
+	// signatures are ready before the SYN so they don't inflate the sender's first RTT sample
+	if(options.delta && buffer->checkpointOffset == 0){
+		delta = buffer->prepareDelta();
+	}
 
 	// receive SYN
-	syn_ack.seqNum = receiveStartSyn();
+	syn_ack.seqNum = receiveStartSyn(fileSize, sourceId, synFlags);
 	state = SYN_RECVD;
 
+	// data sent with the SYN starts at byte 0, so a fast open transfer neither resumes nor diffs
+	fastOpen = (synFlags & SYN_FLAG_FASTOPEN) != 0;
+
+	// multiplexed streams fill a directory from scratch, there is no one file to resume or diff
+	bool streams = (synFlags & SYN_FLAG_STREAMS) != 0;
+	if(streams && (synFlags & SYN_FLAG_BATCH)){
+		buffer->acceptStreams(new BatchAcceptor(buffer->destPath.c_str()));
+	}else if(streams){
+		buffer->acceptStreams(new DirectoryAcceptor(buffer->destPath.c_str()));
+	}else{
+		buffer->openDest();
+	}
+
+	// pick up where an interrupted transfer of the same file left off,
+	// otherwise offer the existing copy as a delta basis
+	resumeOffset = (fastOpen || streams) ? 0 : buffer->resumeOffsetFor(fileSize, sourceId);
+	syn_ack.flags = fastOpen ? SYN_FLAG_FASTOPEN : 0;
+	syn_ack.blockSize = 0;
+	syn_ack.numBlocks = 0;
+	if(resumeOffset == 0 && delta && fastOpen == false && streams == false){
+		buffer->decodeDelta();
+		syn_ack.flags |= SYN_FLAG_DELTA;
+		syn_ack.blockSize = htonl(buffer->sigBlockSize);
+		syn_ack.numBlocks = htonl(buffer->signatures.size());
+	}else if(streams == false){
+		buffer->openDestAt(resumeOffset, fileSize, sourceId);
+	}
+	if(synFlags & SYN_FLAG_COMPRESS){
+		buffer->decodeCompression();
+	}
+
 	// send SYN + ACK
 	syn_ack.type = SYN_ACK_HEADER;
- 	sendto(sockfd, (char *)&syn_ack, sizeof(msg_header_t), 0, (struct sockaddr *)&senderAddr, senderAddrLen);
+	syn_ack.resumeOffset = htobe64(resumeOffset);
+	io->now(&synAckTime);
+ 	io->sendTo(sockfd, (char *)&syn_ack, sizeof(syn_ack_packet_t), (struct sockaddr *)&senderAddr, senderAddrLen);
+
+	// data is already arriving at the classic payload size, the first packets may be queued behind the SYN
+	if(fastOpen){
+		fastOpenSynAck = syn_ack;
+		buffer->setPayload(probedDatagram - sizeof(msg_header_t));
+		return;
+	}
+
+	// the sender may have everything and be sending data already
+	if((syn_ack.flags & SYN_FLAG_DELTA) && sendSignatures(syn_ack)){
+		buffer->setPayload(probedDatagram - sizeof(msg_header_t));
+		return;
+	}
 
 	// receive ACK
 	receiveStartAck(syn_ack);
 }
 
-void TCP::reliableReceive(char * filename)
+bool TCP::reliableReceive(char * filename)
 {
+	setupXdp();
+	setupUring();
+	setupBusyPoll();
 
 	buffer = new CircularBuffer(BUFFER_SIZE, filename);
+	buffer->io = io;
+	buffer->directIO = options.directIO;
+	if(io == &uringIO){
+		buffer->useUring(&uringIO);
+	}
+	if(options.statsPage != NULL){
+		counters = openStatsPage(options.statsPage, STATS_ROLE_RECEIVER);
+	}
+	buffer->counters = counters;
+	if(options.tracePath != NULL){
+		trace = new Tracer(options.tracePath);
+	}
+	io->now(&transferStart);
+	sizingTime = transferStart;
+	sizingDelivered = 0;
+	statSet(counters->socketBuffer, socketBuffer);
 
 	state = LISTEN;
 
+	// disk writes overlap with receiving
+	if(options.writerThread){
+		buffer->startWriter();
+	}
+	// after the writer exists, so it keeps the default affinity
+	pinTransportThread();
+
 	// Set up TCP connection
 	receiverSetupConnection();
 
 	state = ESTABLISHED;
 
-	while(true){
-		if(receivePacket() == false) break;
+	// a short transfer may already have ended during the handshake
+	while(buffer->streamComplete() == false){
+		receivePacket();
 	}
+	buffer->stopWriter();
 
 	state = CLOSING;
 
+	// compare against the digest the sender computed while reading the file
+	finDigest = buffer->endDigest;
+	finLength = (buffer->acceptor != NULL) ? buffer->bytesToTransfer : buffer->endLength;
+	bool verified = buffer->verifyDigest(finDigest, finLength);
+	if(verified){
+		buffer->completeTransfer();
+	}else{
+		fprintf(stderr, "File digest mismatch, %s is corrupt\n", filename);
+		buffer->clearCheckpoint();
+	}
+
 	// tear down TCP connection
-	receiverTearDownConnection();
+	receiverTearDownConnection(verified);
+	if(options.stats){
+		printStats(false);
+	}
+
+	return verified;
 }
 
-void TCP::receiverTearDownConnection()
+void TCP::receiverTearDownConnection(bool verified)
 {
-	msg_header_t fin_ack;
+	ack_packet_t fin_ack;
 
-	// FIN received in receivePacket function
-	state = SYN_RECVD;
+	// DATA_FIN received in receivePacket function
+	state = FIN_RCVD;
 
-	// send FIN + ACK
-	fin_ack.type = FIN_ACK_HEADER;
- 	sendto(sockfd, (char *)&fin_ack, sizeof(msg_header_t), 0, (struct sockaddr *)&senderAddr, senderAddrLen);
+	// send FIN + ACK, the only ACK that covers the end of stream
+	fin_ack.type = verified ? FIN_ACK_HEADER : FIN_ERR_HEADER;
+	fin_ack.seqNum = htonl((uint32_t)buffer->endSeq);
+	fin_ack.window = htons(buffer->receiveWindow());
+ 	io->sendTo(sockfd, (char *)&fin_ack, sizeof(ack_packet_t), (struct sockaddr *)&senderAddr, senderAddrLen);
 
-	// receive ACK
+	// repeat it if the sender retransmits
 	receiveEndAck(fin_ack);
 
 	state = CLOSED;
 }
 
 
-bool TCP::receivePacket()
+void TCP::receivePacket()
 {
 	int numbytes;
 	struct sockaddr_storage their_addr;
 	socklen_t addr_len;
-	msg_packet_t packet;
+	msg_packet_t & packet = *(msg_packet_t *)&rxBuffer[0];
 	addr_len = sizeof(their_addr);
 
-	if ((numbytes = recvfrom(sockfd, (char *)&packet, sizeof(msg_packet_t) , 0, (struct sockaddr *)&their_addr, &addr_len)) == -1) {
+	if ((numbytes = io->recvFrom(sockfd, (char *)&packet, rxBuffer.size(), (struct sockaddr *)&their_addr, &addr_len)) == -1) {
 		perror("recvfrom");
 		exit(1);
 	}
 
-	// start closing connection
-	if(packet.header.type == FIN_HEADER) return false;
+	// the sender can put at most a full window of the largest datagrams on the wire at once
+	bytesReceived += numbytes;
+	statSet(counters->hostDrops, io->rxDropped(sockfd));
+	sizeSocketBuffers(bytesReceived, handshakeRtt, MAX_WINDOW_SIZE*datagramTruesize(probedDatagram));
+
+	// sender is waiting on a closed window
+	if(packet.header.type == WINDOW_PROBE_HEADER){
+		buffer->sendWindowUpdate();
+		return;
+	}
+
+	// a fast open sender repeats its SYN until it hears back, answer with the SYN's own sequence number
+	if(fastOpen && packet.header.type == SYN_HEADER && numbytes == sizeof(syn_packet_t)){
+		fastOpenSynAck.seqNum = packet.header.seqNum;
+		io->sendTo(sockfd, (char *)&fastOpenSynAck, sizeof(syn_ack_packet_t), (struct sockaddr *)&their_addr, addr_len);
+		return;
+	}
 
 	// if garbage packet, then drop but wait to close connection
-	if(packet.header.type != DATA_HEADER) return true;
+	if(dataPacket(packet.header.type) == false) return;
 
-	buffer->storeReceivedPacket(packet, numbytes);
+	// ACK back along the subflow the packet came in on
+	buffer->setReplyAddr((struct sockaddr *)&their_addr, addr_len);
 
-	return true;
+	statAdd(counters->packetsReceived, 1);
+	TRACE(TRACE_RECV, ntohl(packet.header.seqNum), numbytes);
+	buffer->storeReceivedPacket(packet, numbytes);
 }
 
 
 /*************** Startup Handshake Functions ***************/
-int TCP::receiveStartSyn()
+int TCP::receiveStartSyn(unsigned long long & fileSize, uint32_t & sourceId, uint8_t & synFlags)
 {
 	struct sockaddr theirAddr;
     socklen_t theirAddrLen = sizeof(theirAddr);
-	msg_header_t syn;
+	syn_packet_t syn;
 	int numbytes;
 
 	while(true){
-		if((numbytes = recvfrom(sockfd, (char *)&syn, sizeof(msg_header_t), 0, (struct sockaddr*)&theirAddr, &theirAddrLen)) == -1){
+		if((numbytes = io->recvFrom(sockfd, (char *)&syn, sizeof(syn_packet_t), (struct sockaddr*)&theirAddr, &theirAddrLen)) == -1){
 			perror("recvfrom");
 		}
 
-		if((syn.type == SYN_HEADER) && (numbytes == sizeof(msg_header_t))){
+		if((syn.type == SYN_HEADER) && (numbytes == sizeof(syn_packet_t))){
 			break;
 		}
 	}
 
+	fileSize = be64toh(syn.fileSize);
+	sourceId = ntohl(syn.sourceId);
+	synFlags = syn.flags;
+
 	senderAddr = theirAddr;
 	senderAddrLen = theirAddrLen;
 	buffer->setSocketAddrInfo(sockfd, senderAddr, senderAddrLen);
@@ -683,42 +1370,43 @@ int TCP::receiveStartSyn()
 	return syn.seqNum;
 }
 
-int TCP::receiveStartSynAck(struct timeval synZeroTime)
+int TCP::receiveStartSynAck(syn_packet_t syn, struct timeval synZeroTime)
 {
 	struct sockaddr theirAddr;
     socklen_t theirAddrLen = sizeof(theirAddr);
-	msg_header_t syn, syn_ack;
+	syn_ack_packet_t syn_ack;
 
 	// Determinining initial RTT
 	struct timeval synAckTime;
 	vector<struct timeval> synTimeVec(START_TIME_VEC_SIZE);
 	synTimeVec[0] = synZeroTime;
-	unsigned long long initialRTT, initialRTO;
+	unsigned long long initialRTT;
 
-	syn.type = SYN_HEADER;
 	int seqNum = 1;
 
 	while(true){
-		if((recvfrom(sockfd, (char *)&syn_ack, sizeof(msg_header_t), 0, (struct sockaddr*)&theirAddr, &theirAddrLen) == -1)
+		if((io->recvFrom(sockfd, (char *)&syn_ack, sizeof(syn_ack_packet_t), (struct sockaddr*)&theirAddr, &theirAddrLen) != sizeof(syn_ack_packet_t))
 			|| (syn_ack.type != SYN_ACK_HEADER)){
 
 			// store the next syntime
 			syn.seqNum = htonl(seqNum);
-			gettimeofday(&synTimeVec[seqNum%START_TIME_VEC_SIZE], 0);
-			sendto(sockfd, (char *)&syn, sizeof(msg_header_t), 0, &receiverAddr, receiverAddrLen);
+			io->now(&synTimeVec[seqNum%START_TIME_VEC_SIZE]);
+			io->sendTo(sockfd, (char *)&syn, sizeof(syn_packet_t), &receiverAddr, receiverAddrLen);
 			seqNum++;
 		} else{
 			// Determine initial RTT
-			gettimeofday(&synAckTime, 0);
+			io->now(&synAckTime);
 			int synTimeIndex = ntohl(syn_ack.seqNum)%START_TIME_VEC_SIZE;
 			initialRTT = US_PER_SEC*(synAckTime.tv_sec - synTimeVec[synTimeIndex].tv_sec) +  synAckTime.tv_usec - synTimeVec[synTimeIndex].tv_usec;
 
 			// Assign RTO and same initialRTT
-			srtt = initialRTT;
-			rttHistory.push_back(initialRTT);
-			initialRTO = min(2*initialRTT, (unsigned long long)INIT_RTO);
-			rto.tv_sec = initialRTO/US_PER_SEC;
-			rto.tv_usec = initialRTO%US_PER_SEC;
+			seedTimingConstraints(initialRTT);
+
+			resumeOffset = be64toh(syn_ack.resumeOffset);
+			if(syn_ack.flags & SYN_FLAG_DELTA){
+				buffer->sigBlockSize = ntohl(syn_ack.blockSize);
+				buffer->signatures.resize(ntohl(syn_ack.numBlocks));
+			}
 
 			return syn_ack.seqNum;
 		}
@@ -726,72 +1414,327 @@ int TCP::receiveStartSynAck(struct timeval synZeroTime)
 
 }
 
-void TCP::receiveStartAck(msg_header_t syn_ack)
+void TCP::seedTimingConstraints(unsigned long long rttSample)
+{
+	srtt = rttSample;
+	rttHistory.push_back(rttSample);
+	// never below the path's RTT, or the first window times out before its ACKs can arrive; nor below
+	// INIT_RTO, since a handshake doesn't time how long the receiver takes to take in a whole window
+	rtoNext = min(max(2*rttSample, (unsigned long long)INIT_RTO), (unsigned long long)MAX_RTO);
+	rto.tv_sec = ((unsigned long long)rtoNext)/US_PER_SEC;
+	rto.tv_usec = ((unsigned long long)rtoNext)%US_PER_SEC;
+	statSet(counters->srtt, srtt);
+	statSet(counters->rto, rtoNext);
+	TRACE(TRACE_RTT, expectedAckSeqNum, rttSample);
+}
+
+void TCP::receiveStartAck(syn_ack_packet_t syn_ack)
 {
 	struct sockaddr theirAddr;
 	socklen_t theirAddrLen = sizeof(theirAddr);
-	msg_packet_t packet;
+	msg_packet_t & packet = *(msg_packet_t *)&rxBuffer[0];
 	int numbytes;
 
 	while(true){
-		if ((numbytes = recvfrom(sockfd, (char *)&packet, sizeof(msg_packet_t) , 0, (struct sockaddr *)&theirAddr, &theirAddrLen)) == -1) {
+		if ((numbytes = io->recvFrom(sockfd, (char *)&packet, rxBuffer.size(), (struct sockaddr *)&theirAddr, &theirAddrLen)) == -1) {
 			perror("recvfrom");
 		}
 
+		// anything past the SYN + ACK is the receiver's only RTT sample
+		if(handshakeRtt == 0.0 && packet.header.type != SYN_HEADER){
+			struct timeval now;
+			io->now(&now);
+			handshakeRtt = US_PER_SEC*(now.tv_sec - synAckTime.tv_sec) + now.tv_usec - synAckTime.tv_usec;
+		}
+
 		// write message into buffer if ACK lost and message seen first
-		if(packet.header.type == DATA_HEADER && numbytes > (int)sizeof(msg_header_t)){
+		if(dataPacket(packet.header.type) && numbytes > (int)sizeof(msg_header_t)){
+			buffer->setPayload(probedDatagram - sizeof(msg_header_t));
 			buffer->storeReceivedPacket(packet, numbytes);
 			break;
 		} else if(packet.header.type == ACK_HEADER){
+			buffer->setPayload(probedDatagram - sizeof(msg_header_t));
 			break;
+		} else if(packet.header.type == PROBE_HEADER){
+			answerProbe(packet, numbytes, &theirAddr, theirAddrLen);
 		} else{
-			sendto(sockfd, (char *)&syn_ack, sizeof(msg_header_t), 0, &theirAddr, theirAddrLen);
+			io->sendTo(sockfd, (char *)&syn_ack, sizeof(syn_ack_packet_t), &theirAddr, theirAddrLen);
 		}
 	}
 }
 
-/*************** Teardown Handshake Functions ***************/
-int TCP::receiveEndFinAck()
+/*************** Fast Open ***************/
+void TCP::resendFastOpenSyn()
+{
+	// a new sequence number per SYN, so only the answer to the last one is timed
+	fastOpenSyn.seqNum = htonl(ntohl(fastOpenSyn.seqNum) + 1);
+	io->now(&fastOpenSynTime);
+	io->sendTo(sockfd, (char *)&fastOpenSyn, sizeof(syn_packet_t), &receiverAddr, receiverAddrLen);
+}
+
+void TCP::receiveFastOpenSynAck(syn_ack_packet_t & syn_ack)
+{
+	if(state != SYN_SENT) return;
+	state = ESTABLISHED;
+
+	// the SYN + ACK usually beats every data ACK and gives the first RTT sample
+	if(syn_ack.seqNum == fastOpenSyn.seqNum && rttHistory.empty()){
+		struct timeval now;
+		io->now(&now);
+		seedTimingConstraints(US_PER_SEC*(now.tv_sec - fastOpenSynTime.tv_sec) + now.tv_usec - fastOpenSynTime.tv_usec);
+	}
+}
+
+/*************** Path MTU Probing ***************/
+void TCP::probePathMtu()
+{
+	// DF set and the kernel's PMTU cache ignored, so oversize probes are lost rather than fragmented
+	int discover = IP_PMTUDISC_PROBE;
+	if(receiverAddr.sa_family == AF_INET6){
+		setsockopt(sockfd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &discover, sizeof(discover));
+	}else{
+		setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof(discover));
+	}
+
+	uint32_t low = sizeof(msg_header_t) + PAYLOAD;     // the classic payload always fits
+	uint32_t high = maxDatagramSize();
+
+	// the interface MTU usually holds end to end, otherwise search down from it
+	if(high > low && sendProbe(high) == false){
+		high--;
+		for(int round = 0; round < MTU_PROBE_ROUNDS && high - low > MTU_PROBE_GRANULARITY; round++) {
+			uint32_t mid = (low + high)/2;
+			if(sendProbe(mid)){
+				low = mid;
+			}else{
+				high = mid - 1;
+			}
+		}
+	}else if(high > low){
+		low = high;
+	}
+
+	buffer->setPayload(low - sizeof(msg_header_t));
+}
+
+uint32_t TCP::maxDatagramSize()
+{
+	uint32_t ipHeader = (receiverAddr.sa_family == AF_INET6) ? IPV6_HEADER_SIZE : IPV4_HEADER_SIZE;
+	uint32_t size = MAX_DATAGRAM;
+
+	// every subflow shares the payload size, so the narrowest route decides
+	for(subflow_t & flow : subflows) {
+		int mtu = io->pathMtu((struct sockaddr *)&flow.remote, flow.remoteLen);
+		if(mtu <= (int)(ipHeader + UDP_HEADER_SIZE)){
+			return 0;
+		}
+		size = min((uint32_t)(mtu - ipHeader - UDP_HEADER_SIZE), size);
+	}
+	return size;
+}
+
+bool TCP::sendProbe(uint32_t size)
+{
+	struct sockaddr_storage theirAddr;
+	socklen_t theirAddrLen = sizeof(theirAddr);
+	struct timeval sentTime, now;
+	msg_header_t probeAck;
+
+	vector<char> probe(size, 0);
+	msg_header_t * header = (msg_header_t *)&probe[0];
+	header->type = PROBE_HEADER;
+	header->seqNum = htonl(size);
+	header->crc = 0;
+
+	io->setRecvTimeout(sockfd, rto);
+	unsigned long long timeout = US_PER_SEC*rto.tv_sec + rto.tv_usec;
+
+	for(int tries = 0; tries < MTU_PROBE_TRIES; tries++) {
+		// EMSGSIZE, larger than the local interface allows
+		if(io->sendTo(sockfd, &probe[0], size, &receiverAddr, receiverAddrLen) < 0){
+			return false;
+		}
+		io->now(&sentTime);
+
+		// skip stray handshake packets until this try times out
+		while(true){
+			if(io->recvFrom(sockfd, (char *)&probeAck, sizeof(msg_header_t), (struct sockaddr*)&theirAddr, &theirAddrLen) != -1
+				&& probeAck.type == PROBE_ACK_HEADER && ntohl(probeAck.seqNum) == size){
+				return true;
+			}
+
+			io->now(&now);
+			if((unsigned long long)(US_PER_SEC*(now.tv_sec - sentTime.tv_sec) + now.tv_usec - sentTime.tv_usec) >= timeout) break;
+		}
+	}
+
+	return false;
+}
+
+void TCP::answerProbe(msg_packet_t & probe, int numbytes, struct sockaddr * theirAddr, socklen_t theirAddrLen)
+{
+	// only a probe that arrived whole shows the path carries that size
+	if(numbytes != (int)ntohl(probe.header.seqNum)){
+		return;
+	}
+	probedDatagram = max(probedDatagram, (uint32_t)numbytes);
+
+	msg_header_t probeAck;
+	probeAck.type = PROBE_ACK_HEADER;
+	probeAck.seqNum = probe.header.seqNum;
+	probeAck.crc = 0;
+	io->sendTo(sockfd, (char *)&probeAck, sizeof(msg_header_t), theirAddr, theirAddrLen);
+}
+
+/*************** Delta Signature Exchange ***************/
+bool TCP::sendSignatures(syn_ack_packet_t syn_ack)
 {
 	struct sockaddr theirAddr;
-    socklen_t theirAddrLen = sizeof(theirAddr);
-	msg_header_t fin, fin_ack;
+	socklen_t theirAddrLen = sizeof(theirAddr);
+	msg_packet_t & packet = *(msg_packet_t *)&rxBuffer[0];
+	sig_packet_t sigPacket;
+	int numbytes;
+	bool established = false;
+
+	uint32_t numSigs = buffer->signatures.size();
+	uint32_t numPackets = (numSigs + SIGS_PER_PACKET - 1)/SIGS_PER_PACKET;
+	uint32_t base = 0, next = 0;
+
+	struct timeval sigTime;
+	sigTime.tv_sec = 0;
+	sigTime.tv_usec = SIG_TO;
+	io->setRecvTimeout(sockfd, sigTime);
+
+	// go-back-N over a window of signature packets
+	while(base < numPackets){
+		for( ; next < numPackets && next < base + SIG_WINDOW; next++) {
+			uint32_t first = next*SIGS_PER_PACKET;
+			uint32_t count = min((uint32_t)SIGS_PER_PACKET, numSigs - first);
+
+			sigPacket.header.type = SIG_HEADER;
+			sigPacket.header.seqNum = htonl(next);
+			for(uint32_t i = 0; i < count; i++) {
+				sigPacket.sigs[i].weak = htonl(buffer->signatures[first + i].weak);
+				sigPacket.sigs[i].strong = htobe64(buffer->signatures[first + i].strong);
+			}
+			io->sendTo(sockfd, (char *)&sigPacket, sizeof(msg_header_t) + count*sizeof(block_sig_t), (struct sockaddr *)&senderAddr, senderAddrLen);
+		}
 
-	fin.type = FIN_HEADER;
-	int seqNum = 1;
+		if((numbytes = io->recvFrom(sockfd, (char *)&packet, rxBuffer.size(), &theirAddr, &theirAddrLen)) == -1){
+			next = base;
+			continue;
+		}
 
-	while(true){
-		if((recvfrom(sockfd, (char *)&fin_ack, sizeof(msg_header_t), 0, (struct sockaddr*)&theirAddr, &theirAddrLen) == -1)
-			|| (fin_ack.type != FIN_ACK_HEADER)){
-			fin.seqNum = htonl(seqNum++);
-			sendto(sockfd, (char *)&fin, sizeof(msg_header_t), 0, &receiverAddr, receiverAddrLen);
-		} else{
+		if(packet.header.type == SIG_ACK_HEADER){
+			uint32_t acked = ntohl(packet.header.seqNum);
+			if(acked > base){
+				base = min(acked, numPackets);
+				next = max(next, base);
+			}else if(acked == base){
+				// receiver saw a gap
+				next = base;
+			}
+		}else if(packet.header.type == SYN_HEADER){
+			io->sendTo(sockfd, (char *)&syn_ack, sizeof(syn_ack_packet_t), &theirAddr, theirAddrLen);
+		}else if(packet.header.type == ACK_HEADER){
+			established = true;
 			break;
+		}else if(dataPacket(packet.header.type) && numbytes > (int)sizeof(msg_header_t)){
+			buffer->setPayload(probedDatagram - sizeof(msg_header_t));
+			buffer->storeReceivedPacket(packet, numbytes);
+			established = true;
+			break;
+		}else if(packet.header.type == PROBE_HEADER){
+			answerProbe(packet, numbytes, &theirAddr, theirAddrLen);
 		}
 	}
 
-	return fin_ack.seqNum;
+	// back to blocking receives
+	sigTime.tv_usec = 0;
+	io->setRecvTimeout(sockfd, sigTime);
+
+	return established;
+}
+
+void TCP::receiveSignatures()
+{
+	struct sockaddr_storage theirAddr;
+	socklen_t theirAddrLen = sizeof(theirAddr);
+	sig_packet_t sigPacket;
+	ack_packet_t sigAck;
+	int numbytes;
+
+	uint32_t numSigs = buffer->signatures.size();
+	uint32_t numPackets = (numSigs + SIGS_PER_PACKET - 1)/SIGS_PER_PACKET;
+	uint32_t next = 0;
+
+	sigAck.type = SIG_ACK_HEADER;
+	sigAck.window = 0;
+	io->setRecvTimeout(sockfd, rto);
+
+	while(next < numPackets){
+		numbytes = io->recvFrom(sockfd, (char *)&sigPacket, sizeof(sig_packet_t), (struct sockaddr*)&theirAddr, &theirAddrLen);
+
+		if(numbytes > (int)sizeof(msg_header_t) && sigPacket.header.type == SIG_HEADER){
+			uint32_t first = next*SIGS_PER_PACKET;
+			uint32_t count = min((uint32_t)SIGS_PER_PACKET, numSigs - first);
+
+			// in order, whole packet
+			if(ntohl(sigPacket.header.seqNum) == next && numbytes == (int)(sizeof(msg_header_t) + count*sizeof(block_sig_t))){
+				for(uint32_t i = 0; i < count; i++) {
+					buffer->signatures[first + i].weak = ntohl(sigPacket.sigs[i].weak);
+					buffer->signatures[first + i].strong = be64toh(sigPacket.sigs[i].strong);
+				}
+				next++;
+
+				if((next % SIG_ACK_EVERY) != 0 && next != numPackets) continue;
+			}
+		}else if(numbytes != -1){
+			// duplicate SYN + ACKs
+			continue;
+		}
+
+		sigAck.seqNum = htonl(next);
+		io->sendTo(sockfd, (char *)&sigAck, sizeof(ack_packet_t), &receiverAddr, receiverAddrLen);
+	}
 }
 
-void TCP::receiveEndAck(msg_header_t fin_ack)
+/*************** Teardown Handshake Functions ***************/
+void TCP::receiveEndAck(ack_packet_t fin_ack)
 {
 	struct sockaddr theirAddr;
 	socklen_t theirAddrLen = sizeof(theirAddr);
-	ack_packet_t ack;
+	msg_packet_t & packet = *(msg_packet_t *)&rxBuffer[0];
 
-	rto.tv_sec = 0;
-	rto.tv_usec = FIN_TO;
-	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &rto, sizeof(rto));
+	// the sender's ACK ends TIME_WAIT early; its RTO may have backed off well past endRto, so the
+	// FIN + ACK is also repeated on a backed off timer instead of only when a retransmission shows up
+	double linger = min(max(TIME_WAIT_RTO_MULTIPLE*buffer->endRto, (double)TIME_WAIT_MIN), (double)MAX_RTO);
+	double resend = max((double)buffer->endRto, (double)TIME_WAIT_MIN);
+	struct timeval lastHeard, now;
+	io->now(&lastHeard);
 
 	state = TIME_WAIT;
 
 	while(true){
-		if (((recvfrom(sockfd, (char *)&ack, sizeof(ack_packet_t) , 0, (struct sockaddr *)&theirAddr, &theirAddrLen)) == -1)
-			|| ack.type != FIN_HEADER){
+		io->now(&now);
+		double quiet = US_PER_SEC*(now.tv_sec - lastHeard.tv_sec) + now.tv_usec - lastHeard.tv_usec;
+		if(quiet >= linger){
 			break;
-		}else{
+		}
+		double wait = min(resend, linger - quiet);
+		rto.tv_sec = ((unsigned long long)wait)/US_PER_SEC;
+		rto.tv_usec = ((unsigned long long)wait)%US_PER_SEC;
+		io->setRecvTimeout(sockfd, rto);
+
+		if (io->recvFrom(sockfd, (char *)&packet, rxBuffer.size(), (struct sockaddr *)&theirAddr, &theirAddrLen) == -1){
+			io->sendTo(sockfd, (char *)&fin_ack, sizeof(ack_packet_t), (struct sockaddr *)&senderAddr, senderAddrLen);
+			resend = 1.5*resend;
+		}else if(dataPacket(packet.header.type)){
 			// If fin_ack, lost then resend
-			sendto(sockfd, (char *)&fin_ack, sizeof(msg_header_t), 0, &theirAddr, theirAddrLen);
+			io->sendTo(sockfd, (char *)&fin_ack, sizeof(ack_packet_t), &theirAddr, theirAddrLen);
+			io->now(&lastHeard);
+		}else if(packet.header.type == ACK_HEADER){
+			break;
 		}
 	}
 }
@@ -4,6 +4,11 @@
 #include "parameters.h"
 #include "types.h"
 #include "circular_buffer.h"
+#include "xdp.h"
+#include "ratelimit.h"
+#include "batch.h"
+#include "stats.h"
+#include "trace.h"
 
 class TCP
 {
@@ -15,32 +20,60 @@ class TCP
         ~TCP();
 
         // Public Sender Member Functions
-        void reliableSend(char * filename, unsigned long long int bytesToTransfer);
+        bool reliableSend(char * filename, unsigned long long int bytesToTransfer);
+        bool reliableSend(StreamProvider * provider);       // one stream per source, multiplexed
         void sendWindow();
 
         // Public Receiver Member Functions
-        void reliableReceive(char * filename);
+        bool reliableReceive(char * filename);
+
+        transfer_options_t options;
+
+        // Clock and socket calls, replaceable before a transfer starts
+        NetIO * io;
+
+        // Live transfer statistics, a shared page when options.statsPage is set
+        transfer_stats_t * counters;
     private:
+        // Transfer statistics
+        void printStats(bool sender);
+
         // Private Sender Member Functions
+        bool runSender();
         void senderSetupConnection();
-        void senderTearDownConnection();
+        bool senderTearDownConnection();
 
         // Private Receiver Memeber Functions
-        bool receivePacket();
+        void receivePacket();
         void receiverSetupConnection();
-        void receiverTearDownConnection();
+        void receiverTearDownConnection(bool verified);
 
         // Private Startup Handshake functions
-        int receiveStartSyn();
-        int receiveStartSynAck(struct timeval synZeroTime);
-        void receiveStartAck(msg_header_t syn_ack);
+        int receiveStartSyn(unsigned long long & fileSize, uint32_t & sourceId, uint8_t & synFlags);
+        int receiveStartSynAck(syn_packet_t syn, struct timeval synZeroTime);
+        void receiveStartAck(syn_ack_packet_t syn_ack);
+        void seedTimingConstraints(unsigned long long rttSample);
+
+        // Private Fast open, the handshake finishes alongside the first window
+        void resendFastOpenSyn();
+        void receiveFastOpenSynAck(syn_ack_packet_t & syn_ack);
+
+        // Private Path MTU probing
+        void probePathMtu();
+        uint32_t maxDatagramSize();
+        bool sendProbe(uint32_t size);
+        void answerProbe(msg_packet_t & probe, int numbytes, struct sockaddr * theirAddr, socklen_t theirAddrLen);
+
+        // Private Delta signature exchange
+        bool sendSignatures(syn_ack_packet_t syn_ack);
+        void receiveSignatures();
 
         // Private Teardown Handshake functions
-        int receiveEndFinAck();
-        void receiveEndAck(msg_header_t fin_ack);
+        void receiveEndAck(ack_packet_t fin_ack);
 
         // ACK Processing
         bool ackManager();
+        int receiveAck(ack_process_t & pACK);
         void processTO();
         void processAcks(ack_process_t & pACK);
 
@@ -53,12 +86,42 @@ class TCP
         void processSExpecAck(ack_process_t & pACK);
         void processSDupAck(ack_process_t & pACK);
         void processSOoOAck(ack_process_t & pACK);
+        void processSackFlags(ack_process_t & pACK);
 
         // Fast recover and fast retransmit functions
         void resendTOWindow();
         void resendWindow();
         void updateWindowSettings(ack_process_t & pACK);
 
+        // Receiver flow control
+        uint32_t sendWindowSize();
+        void sendWindowProbe();
+
+        // Latency mode
+        void setupXdp();
+        void setupUring();
+        void setupBusyPoll();
+        void pinTransportThread();
+
+        // Rate cap: this connection's bucket and the process's, both in the transmit path
+        bool rateBlocked();
+        unsigned long long rateWait();
+
+        // Multipath: subflows share the sequence space, each packet goes where it should arrive first
+        void setupSubflows();
+        void sendPacket(uint32_t idx);
+        uint32_t pickSubflow();
+        void subflowRttSample(uint32_t idx, unsigned long long rttSample);
+        void subflowDelivered(uint32_t idx, struct timeval & now);
+        void subflowTimeout();
+        bool subflowInFlight(uint32_t idx);
+
+        // Socket buffers sized from the bandwidth-delay product
+        void setupSocketBuffers(bool sender);
+        void sizeSocketBuffers(unsigned long long delivered, double rttUs, unsigned long long burst);
+        int setSocketBuffer(int bytes);
+        unsigned long long datagramTruesize(uint32_t datagram);
+
         // RTT function
         void updateTimingConstraints(unsigned long long rttSample);
         double stdDevRTT();
@@ -83,9 +146,51 @@ class TCP
         // Book keeping
         tcp_state_t state;
         send_state_t sendState;
-        int expectedAckSeqNum;
-        int lastPacketSent;
+        seq_t expectedAckSeqNum;
+        seq_t lastPacketSent;
         int numRetransmissions;
+        uint32_t receiverWindow;                            // packets past the cumulative ACK, from the last ACK
+        unsigned long long resumeOffset;
+
+        // Transfer statistics
+        struct timeval transferStart;
+        transfer_stats_t localCounters;
+
+        // Socket buffer sizing: SO_SNDBUF on the sender, SO_RCVBUF on the receiver
+        bool sizesSendBuffer;
+        int socketBuffer;                                   // bytes, as the kernel reports it
+        struct timeval sizingTime;
+        unsigned long long sizingDelivered;                 // bytes delivered as of sizingTime
+        unsigned long long bytesReceived;                   // receiver: datagram bytes off the socket
+        struct timeval synAckTime;
+        double handshakeRtt;                                // receiver: SYN + ACK to the sender's next packet, microseconds
+
+        // Token bucket for options.rateLimit; rateLimited when the last sendWindow stopped on a cap, not the window
+        TokenBucket rateLimit;
+        bool rateLimited;
+
+        // Multipath subflows, just receiverAddr from the default source unless options ask for more
+        vector<subflow_t> subflows;
+        vector<uint8_t> slotSubflow;                        // subflow each slot was last sent on, NO_SUBFLOW once acknowledged
+        vector<bool> slotResent;                            // sent more than once, its ACK is no subflow RTT sample
+
+        // Binary event trace, NULL unless options.tracePath is set
+        Tracer * trace;
+
+        // Path MTU: largest whole probe seen (receiver), receive space for it
+        uint32_t probedDatagram;
+        vector<char> rxBuffer;
+
+        // Fast open: the SYN to resend until answered (sender), the SYN + ACK to repeat (receiver)
+        bool fastOpen;
+        syn_packet_t fastOpenSyn;
+        struct timeval fastOpenSynTime;
+        syn_ack_packet_t fastOpenSynAck;
+
+        // Whole file digest from the sender's DATA_FIN (receiver), the receiver's check of it (sender)
+        uint32_t finDigest;
+        unsigned long long finLength;
+        bool finVerified;
 };
 
 
@@ -24,6 +24,11 @@ do
             sh ./scripts/testLossySender.sh $2 $3 $4 $5
             exit
             ;;
+        --test-local | --tl)
+            shift
+            bash ./scripts/testLocal.sh "$@"
+            exit
+            ;;
         --test-r | --tr)
             sh ./scripts/testReceiver.sh $2
             exit
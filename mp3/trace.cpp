@@ -0,0 +1,95 @@
+#include <signal.h>
+#include <sys/mman.h>
+#include "trace.h"
+
+// every live tracer, so a signal or exit() can dump them all
+static Tracer * volatile tracers[TRACE_MAX_TRACERS];
+
+static void dumpAll()
+{
+    for (int i = 0; i < TRACE_MAX_TRACERS; i++) {
+        if (tracers[i] != NULL) {
+            tracers[i]->dump();
+        }
+    }
+}
+
+static void dumpOnSignal(int)
+{
+    int savedErrno = errno;
+    dumpAll();
+    errno = savedErrno;
+}
+
+Tracer::Tracer(const char * path)
+{
+    snprintf(this->path, sizeof(this->path), "%s", path);
+    head = 0;
+
+    // untouched pages cost nothing until the ring reaches them
+    ring = (trace_event_t *)mmap(NULL, TRACE_EVENTS*sizeof(trace_event_t), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+
+    static bool handlersInstalled = false;
+    if (!handlersInstalled) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = dumpOnSignal;
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &action, NULL);
+        atexit(dumpAll);
+        handlersInstalled = true;
+    }
+
+    for (int i = 0; i < TRACE_MAX_TRACERS; i++) {
+        if (tracers[i] == NULL) {
+            tracers[i] = this;
+            break;
+        }
+    }
+}
+
+Tracer::~Tracer()
+{
+    dump();
+    for (int i = 0; i < TRACE_MAX_TRACERS; i++) {
+        if (tracers[i] == this) {
+            tracers[i] = NULL;
+        }
+    }
+    munmap(ring, TRACE_EVENTS*sizeof(trace_event_t));
+}
+
+void Tracer::dump()
+{
+    uint64_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint64_t begin = (end > TRACE_EVENTS) ? end - TRACE_EVENTS : 0;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        return;
+    }
+
+    trace_file_header_t header;
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.count = end - begin;
+    header.dropped = begin;
+    bool ok = write(fd, &header, sizeof(header)) == sizeof(header);
+
+    // oldest first: the tail of the ring after the wrap point, then the start
+    size_t first = begin & (TRACE_EVENTS - 1);
+    size_t firstCount = min((uint64_t)(TRACE_EVENTS - first), end - begin);
+    if (ok && firstCount > 0) {
+        ok = write(fd, &ring[first], firstCount*sizeof(trace_event_t)) == (ssize_t)(firstCount*sizeof(trace_event_t));
+    }
+    size_t secondCount = (end - begin) - firstCount;
+    if (ok && secondCount > 0) {
+        ok = write(fd, &ring[0], secondCount*sizeof(trace_event_t)) == (ssize_t)(secondCount*sizeof(trace_event_t));
+    }
+    close(fd);
+}
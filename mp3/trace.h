@@ -0,0 +1,69 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "parameters.h"
+#include "types.h"
+
+typedef enum : uint8_t {
+    TRACE_SEND = 1,             // seq, value = datagram bytes
+    TRACE_RETRANSMIT,           // seq, value = datagram bytes
+    TRACE_ACK,                  // cumulative ACK seq
+    TRACE_SACK,                 // ACK seq, value = packets flagged beyond it
+    TRACE_DUPACK,               // seq
+    TRACE_TIMEOUT,              // oldest unacked seq, value = new rto in microseconds
+    TRACE_CWND,                 // value = window in packets
+    TRACE_RTT,                  // value = sample in microseconds
+    TRACE_RECV                  // receiver: data seq, value = datagram bytes
+} trace_type_t;
+
+// Records into the enclosing object's trace, if tracing is on
+#define TRACE(type, seq, value)     do { if (trace != NULL) trace->record(type, seq, value); } while (0)
+
+#pragma pack(1)
+typedef struct {
+    uint64_t ns;                // CLOCK_MONOTONIC
+    uint32_t seq;
+    uint32_t typeValue;         // type in the top 8 bits, value in the low 24
+} trace_event_t;
+
+#pragma pack(1)
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;             // events that follow, oldest first
+    uint64_t dropped;           // older events overwritten in the ring
+} trace_file_header_t;
+#pragma pack()
+
+// Fixed size ring of binary events for one connection. Only the connection's
+// own thread records, so recording is a clock read and a 16 byte store; when
+// full the oldest events are overwritten. Dumped to its file when the
+// transfer ends, on exit(), or on SIGUSR1 while running.
+class Tracer
+{
+    public:
+        Tracer(const char * path);
+        ~Tracer();
+
+        inline void record(trace_type_t type, uint32_t seq, uint32_t value)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+
+            trace_event_t & e = ring[head & (TRACE_EVENTS - 1)];
+            e.ns = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+            e.seq = seq;
+            e.typeValue = ((uint32_t)type << 24) | min(value, (uint32_t)0xFFFFFF);
+            __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+        }
+
+        // async-signal-safe: only open, write and close
+        void dump();
+
+    private:
+        char path[256];
+        trace_event_t * ring;
+        uint64_t head;
+};
+
+#endif
@@ -0,0 +1,191 @@
+/*
+ *
+ * Trace Decoder
+ *
+ * Reads a trace written by reliable_sender/reliable_receiver -t and prints
+ * a summary, an event listing, or a time-sequence plot as SVG: sequence
+ * numbers sent, retransmitted and acknowledged over time, timeouts marked,
+ * with the congestion window and RTT samples underneath.
+ *
+ */
+
+#include <set>
+#include "trace.h"
+
+#define PLOT_WIDTH                  (1200)
+#define PLOT_SEQ_HEIGHT             (500)
+#define PLOT_CWND_HEIGHT            (200)
+#define PLOT_MARGIN                 (60)
+
+const char * typeNames[] = {"?", "send", "retransmit", "ack", "sack", "dupack", "timeout", "cwnd", "rtt", "recv"};
+
+void usage(char * name) {
+	fprintf(stderr, "usage: %s [-l] [-p plot.svg] trace_file\n", name);
+	fprintf(stderr, "  -l  list every event: time_ms type seq value\n");
+	fprintf(stderr, "  -p  write a time-sequence plot\n");
+	exit(1);
+}
+
+uint8_t eventType(const trace_event_t & e) { return e.typeValue >> 24; }
+uint32_t eventValue(const trace_event_t & e) { return e.typeValue & 0xFFFFFF; }
+
+// one mark per pixel and type, so million event traces stay small
+void plotPoint(FILE * svg, std::set<uint64_t> & drawn, int x, int y, int type, const char * color, int radius)
+{
+	uint64_t key = ((uint64_t)type << 40) | ((uint64_t)x << 20) | (uint64_t)y;
+	if(drawn.insert(key).second){
+		fprintf(svg, "<circle cx=\"%d\" cy=\"%d\" r=\"%d\" fill=\"%s\"/>\n", x, y, radius, color);
+	}
+}
+
+void writePlot(const char * path, vector<trace_event_t> & events)
+{
+	FILE * svg = fopen(path, "w");
+	if(svg == NULL){
+		perror(path);
+		exit(1);
+	}
+
+	// events carry the low 32 bits of sequence numbers, each is widened against the one before so a wrap stays a line
+	vector<seq_t> seqs(events.size());
+	seq_t previous = events.front().seq;
+	for(size_t i = 0; i < events.size(); i++) {
+		seqs[i] = previous = seqUnwrap(events[i].seq, previous);
+	}
+
+	uint64_t t0 = events.front().ns, t1 = max(events.back().ns, t0 + 1);
+	seq_t seqMin = numeric_limits<seq_t>::max(), seqMax = numeric_limits<seq_t>::min();
+	uint32_t cwndMax = 1, rttMax = 1;
+	for(size_t i = 0; i < events.size(); i++) {
+		uint8_t type = eventType(events[i]);
+		if(type == TRACE_CWND){
+			cwndMax = max(cwndMax, eventValue(events[i]));
+		}else if(type == TRACE_RTT){
+			rttMax = max(rttMax, eventValue(events[i]));
+		}else if(type != TRACE_TIMEOUT){
+			seqMin = min(seqMin, seqs[i]);
+			seqMax = max(seqMax, seqs[i]);
+		}
+	}
+	if(seqMin > seqMax){
+		seqMin = seqMax = 0;
+	}
+	seqMax = max(seqMax, seqMin + 1);
+
+	int width = PLOT_WIDTH, height = PLOT_SEQ_HEIGHT + PLOT_CWND_HEIGHT + 3*PLOT_MARGIN;
+	int cwndTop = PLOT_SEQ_HEIGHT + 2*PLOT_MARGIN;
+	auto px = [&](uint64_t ns){ return PLOT_MARGIN + (int)((ns - t0)*(double)(width - 2*PLOT_MARGIN)/(t1 - t0)); };
+	auto pySeq = [&](seq_t seq){ return PLOT_MARGIN + PLOT_SEQ_HEIGHT - (int)((seq - seqMin)*(double)PLOT_SEQ_HEIGHT/(seqMax - seqMin)); };
+	auto pyCwnd = [&](uint32_t v){ return cwndTop + PLOT_CWND_HEIGHT - (int)(v*(double)PLOT_CWND_HEIGHT/cwndMax); };
+	auto pyRtt = [&](uint32_t v){ return cwndTop + PLOT_CWND_HEIGHT - (int)(v*(double)PLOT_CWND_HEIGHT/rttMax); };
+
+	fprintf(svg, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" font-family=\"sans-serif\" font-size=\"12\">\n", width, height);
+	fprintf(svg, "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n");
+	fprintf(svg, "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" fill=\"none\" stroke=\"#888\"/>\n",
+		PLOT_MARGIN, PLOT_MARGIN, width - 2*PLOT_MARGIN, PLOT_SEQ_HEIGHT);
+	fprintf(svg, "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" fill=\"none\" stroke=\"#888\"/>\n",
+		PLOT_MARGIN, cwndTop, width - 2*PLOT_MARGIN, PLOT_CWND_HEIGHT);
+	fprintf(svg, "<text x=\"%d\" y=\"%d\">seq %lld</text><text x=\"%d\" y=\"%d\">seq %lld</text>\n",
+		4, PLOT_MARGIN - 4, (long long)seqMax, 4, PLOT_MARGIN + PLOT_SEQ_HEIGHT + 14, (long long)seqMin);
+	fprintf(svg, "<text x=\"%d\" y=\"%d\">0 ms</text><text x=\"%d\" y=\"%d\" text-anchor=\"end\">%.1f ms</text>\n",
+		PLOT_MARGIN, height - 8, width - PLOT_MARGIN, height - 8, (t1 - t0)/1e6);
+	fprintf(svg, "<text x=\"%d\" y=\"%d\">cwnd (black, max %u pkts)  rtt (green, max %u us)</text>\n",
+		PLOT_MARGIN, cwndTop - 6, cwndMax, rttMax);
+	fprintf(svg, "<text x=\"%d\" y=\"%d\">send (grey)  retransmit (red)  ack (blue)  recv (black)  dup-ack (purple)  timeout (orange)</text>\n",
+		PLOT_MARGIN, PLOT_MARGIN - 24);
+
+	std::set<uint64_t> drawn;
+	string cwndPath;
+	int lastCwndY = -1;
+	for(size_t i = 0; i < events.size(); i++) {
+		trace_event_t & e = events[i];
+		int x = px(e.ns);
+		switch(eventType(e)){
+			case TRACE_SEND:       plotPoint(svg, drawn, x, pySeq(seqs[i]), TRACE_SEND, "#aaa", 1); break;
+			case TRACE_RETRANSMIT: plotPoint(svg, drawn, x, pySeq(seqs[i]), TRACE_RETRANSMIT, "red", 2); break;
+			case TRACE_ACK:
+			case TRACE_SACK:       plotPoint(svg, drawn, x, pySeq(seqs[i]), TRACE_ACK, "blue", 1); break;
+			case TRACE_RECV:       plotPoint(svg, drawn, x, pySeq(seqs[i]), TRACE_RECV, "black", 1); break;
+			case TRACE_DUPACK:     plotPoint(svg, drawn, x, pySeq(seqs[i]), TRACE_DUPACK, "purple", 2); break;
+			case TRACE_RTT:        plotPoint(svg, drawn, x, pyRtt(eventValue(e)), TRACE_RTT, "green", 1); break;
+			case TRACE_TIMEOUT:
+				fprintf(svg, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" stroke=\"orange\"/>\n",
+					x, PLOT_MARGIN, x, PLOT_MARGIN + PLOT_SEQ_HEIGHT);
+				break;
+			case TRACE_CWND: {
+				int y = pyCwnd(eventValue(e));
+				if(lastCwndY < 0){
+					cwndPath = "M" + to_string(x) + " " + to_string(y);
+				}else if(y != lastCwndY){
+					cwndPath += " H" + to_string(x) + " V" + to_string(y);
+				}
+				lastCwndY = y;
+				break;
+			}
+		}
+	}
+	if(lastCwndY >= 0){
+		cwndPath += " H" + to_string(width - PLOT_MARGIN);
+		fprintf(svg, "<path d=\"%s\" fill=\"none\" stroke=\"black\"/>\n", cwndPath.c_str());
+	}
+	fprintf(svg, "</svg>\n");
+	fclose(svg);
+}
+
+int main(int argc, char** argv) {
+	bool list = false;
+	const char * plotPath = NULL;
+	int opt;
+
+	while((opt = getopt(argc, argv, "lp:")) != -1){
+		switch(opt){
+			case 'l':
+				list = true;
+				break;
+			case 'p':
+				plotPath = optarg;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if(argc - optind != 1){
+		usage(argv[0]);
+	}
+
+	FILE * in = fopen(argv[optind], "rb");
+	trace_file_header_t header;
+	if(in == NULL || fread(&header, sizeof(header), 1, in) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION){
+		fprintf(stderr, "%s is not a trace file\n", argv[optind]);
+		return 1;
+	}
+	vector<trace_event_t> events(header.count);
+	events.resize(fread(&events[0], sizeof(trace_event_t), header.count, in));
+	fclose(in);
+	if(events.empty()){
+		fprintf(stderr, "no events\n");
+		return 0;
+	}
+
+	unsigned long long counts[sizeof(typeNames)/sizeof(typeNames[0])] = {0};
+	for(trace_event_t & e : events) {
+		uint8_t type = eventType(e);
+		counts[type < sizeof(typeNames)/sizeof(typeNames[0]) ? type : 0]++;
+		if(list){
+			printf("%.6f %s %u %u\n", (e.ns - events.front().ns)/1e6, typeNames[type < TRACE_RECV + 1 ? type : 0], e.seq, eventValue(e));
+		}
+	}
+
+	fprintf(stderr, "%zu events over %.1f ms (%llu older events overwritten)\n",
+		events.size(), (events.back().ns - events.front().ns)/1e6, (unsigned long long)header.dropped);
+	for(size_t t = 1; t < sizeof(typeNames)/sizeof(typeNames[0]); t++) {
+		if(counts[t] > 0){
+			fprintf(stderr, "  %-10s %llu\n", typeNames[t], counts[t]);
+		}
+	}
+
+	if(plotPath != NULL){
+		writePlot(plotPath, events);
+	}
+	return 0;
+}
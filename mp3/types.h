@@ -39,6 +39,7 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -51,11 +52,14 @@
 #include <netdb.h>
 #include <list>
 #include <deque>
+#include <map>
 #include <cmath>
 #include <stdint.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <poll.h>
+#include <sched.h>
 
 using std::sqrt;
 using std::thread;
@@ -70,6 +74,7 @@ using std::pair;
 using std::make_pair;
 using std::greater;
 using std::deque;
+using std::map;
 using std::queue;
 using std::stack;
 using std::string;
@@ -85,14 +90,78 @@ using std::condition_variable;
 
 typedef pair<int,int> int_pair;
 
+// A sequence number in full; packets carry only its low 32 bits and each end widens them
+// again against its own window, which is never close to 2^31 packets wide
+typedef int64_t seq_t;
+
+inline seq_t seqUnwrap(uint32_t wire, seq_t near)
+{
+    return near + (int32_t)(wire - (uint32_t)near);
+}
+
 #pragma pack(1)
 typedef struct {
     uint8_t type;
-    int seqNum;
+    uint32_t seqNum;            // low 32 bits, see seqUnwrap
+    uint32_t crc;               // CRC32C of the whole packet with this field zeroed
 } msg_header_t;
 
 #define PAYLOAD (1472 - sizeof(msg_header_t))
 
+// Leads a data packet's payload only when SYN_FLAG_STREAMS was negotiated, a single file has none
+#pragma pack(1)
+typedef struct {
+    uint32_t stream;            // multiplexed stream the payload belongs to, NO_STREAM for the connection's end
+    uint32_t streamSeq;         // packet number within that stream
+} stream_header_t;
+
+#pragma pack(1)
+typedef struct {
+    uint8_t type;
+    uint32_t seqNum;
+    uint64_t fileSize;          // total bytes the sender intends to transfer
+    uint8_t flags;
+    uint32_t sourceId;          // identifies the source file's contents, a resume must match it
+} syn_packet_t;
+
+#pragma pack(1)
+typedef struct {
+    uint8_t type;
+    uint32_t seqNum;
+    uint64_t resumeOffset;      // bytes the receiver already has on disk
+    uint8_t flags;
+    uint32_t blockSize;         // delta: bytes covered by each signature
+    uint32_t numBlocks;         // delta: signatures that follow in SIG packets
+} syn_ack_packet_t;
+
+#pragma pack(1)
+typedef struct {
+    uint32_t digest;            // CRC32C of the whole file
+    uint64_t length;            // bytes the digest covers
+    uint32_t rto;               // sender's RTO when the stream ended, microseconds
+} fin_trailer_t;
+
+#pragma pack(1)
+typedef struct {
+    uint16_t pathLength;        // bytes of relative path that follow, no terminator
+    uint32_t mode;              // st_mode, file type and permissions
+    uint64_t size;              // bytes that follow the path
+} manifest_header_t;
+
+#pragma pack(1)
+typedef struct {
+    uint32_t weak;              // rolling checksum
+    uint64_t strong;
+} block_sig_t;
+
+#define SIGS_PER_PACKET (PAYLOAD / sizeof(block_sig_t))
+
+#pragma pack(1)
+typedef struct {
+    msg_header_t header;        // seqNum is the signature packet index
+    block_sig_t sigs[SIGS_PER_PACKET];
+} sig_packet_t;
+
 #pragma pack(1)
 typedef struct {
     msg_header_t header;
@@ -102,27 +171,95 @@ typedef struct {
 #pragma pack(1)
 typedef struct {
     uint8_t type;
-    int seqNum;
+    uint32_t seqNum;            // cumulative ACK, low 32 bits
+    uint16_t window;            // receive window: packets past seqNum the receiver can still place
 } ack_packet_t;
 
 #pragma pack(1)
 typedef struct {
     uint8_t type;
-    int seqNum;
+    uint32_t seqNum;
+    uint16_t window;
     uint64_t flags;
 } ack_packet_wf_t;
 
 typedef struct {
     ack_packet_wf_t ack;
+    seq_t seqNum;               // ack.seqNum widened against the send window
     struct timeval time;
 } ack_process_t;
 
+// Only the wire formats above are packed; classes with mutexes and atomics need natural alignment
+#pragma pack()
+
+struct transfer_options_t {
+    bool delta = false;         // receiver: offer signatures of an existing copy
+    bool compress = false;      // sender: compress chunks that a sample says will shrink
+    bool probeMtu = false;      // sender: grow the payload to the largest size the path carries, delays the first data
+    bool stats = false;         // both: print a key=value statistics line when done
+    const char * statsPage = NULL;  // both: publish live statistics in this shared file
+    const char * tracePath = NULL;  // both: record binary events, dumped here
+    bool writerThread = true;   // receiver: write to disk on its own thread
+    bool directIO = false;      // receiver: write a single file with O_DIRECT, bypassing the page cache
+    bool busyPoll = false;      // both: spin on a non-blocking socket instead of sleeping in recvfrom
+    const char * xdpInterface = NULL;   // both: receive through AF_XDP sockets on this interface
+    bool uring = false;         // both: batch socket and file I/O through one io_uring
+    int cpu = -1;               // both: pin the transport thread to this CPU
+    bool fastOpen = false;      // sender: send the first window right behind the SYN
+    const char * localAddrs = NULL;     // sender: comma separated source addresses, one subflow per local/remote pair
+    const char * remoteAddrs = NULL;    // sender: more comma separated receiver addresses, same port
+    double rateLimit = 0;       // sender: bytes per second this connection may send, 0 for no cap
+};
+
+// A multipath subflow: a local/remote address pair and what the scheduler has learned about it
+typedef struct {
+    struct sockaddr_storage local;              // AF_UNSPEC lets the kernel pick the source
+    struct sockaddr_storage remote;
+    socklen_t remoteLen;
+    double srtt;                                // microseconds, 0 until sampled
+    double rate;                                // packets delivered per microsecond, 0 until measured
+    unsigned long long inflight;                // packets last sent on this subflow and not yet acknowledged
+    unsigned long long sent, delivered;
+    unsigned long long deliveredMark;           // delivered as of markTime
+    struct timeval markTime;
+} subflow_t;
+
+// Live connection statistics, single writer; also the layout of the shared stats page
+typedef struct {
+    unsigned long long magic;                   // STATS_MAGIC once the page is live
+    unsigned long long pid;
+    unsigned long long role;                    // STATS_ROLE_SENDER or STATS_ROLE_RECEIVER
+
+    // sender
+    unsigned long long cwnd;                    // packets
+    unsigned long long rwnd;                    // packets, last advertised by the receiver
+    unsigned long long srtt;                    // microseconds
+    unsigned long long rto;                     // microseconds, rtoNext
+    unsigned long long packetsSent;
+    unsigned long long packetsRetransmitted;
+    unsigned long long dupAcks;
+    unsigned long long timeouts;
+    unsigned long long bytesAcked;              // payload bytes cumulatively acknowledged
+
+    // receiver
+    unsigned long long packetsReceived;
+    unsigned long long bytesWritten;
+    unsigned long long bufferOccupancy;         // out of order packets held for reassembly
+    unsigned long long flushLatency;            // microseconds, last write to the sink
+    unsigned long long flushLatencyMax;
+
+    // both
+    unsigned long long socketBuffer;            // bytes the kernel gives the sized buffer, SO_SNDBUF or SO_RCVBUF
+    unsigned long long hostDrops;               // datagrams the kernel dropped on a full receive queue
+} transfer_stats_t;
+
 typedef enum : uint8_t {
     /***** Sender States *****/
     AVAILABLE, FILLED, RETRANSMIT, SENT, ACKED,
 
     /***** Receiver States *****/
-    WAITING, RECEIVED
+    WAITING, RECEIVED,
+    DELIVERED       // handed to its stream's sink ahead of a gap in another stream
 } packet_state_t;
 
 typedef enum : uint8_t {
@@ -0,0 +1,562 @@
+#include "uring.h"
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// what a completion belongs to, in the top half of its user_data; the index is the bottom half
+#define URING_RECV                  (1ULL << 32)
+#define URING_SEND                  (2ULL << 32)
+#define URING_FILE                  (3ULL << 32)
+#define URING_SYNC                  (4ULL << 32)
+
+UringIO uringIO;
+
+UringIO::UringIO()
+{
+    ringFd = -1;
+    attachedFd = -1;
+    timeout = 0;
+    enters = 0;
+    ringMap = NULL;
+    ringLength = 0;
+    sqes = NULL;
+    sqesLength = 0;
+    sqEntries = 0;
+    queuedTail = 0;
+    queuedSends = 0;
+    region = NULL;
+    regionLength = 0;
+    fileRegion = NULL;
+    syncBusy = false;
+}
+
+UringIO::~UringIO()
+{
+    if(ringFd < 0){
+        return;
+    }
+
+    // the last ACK or FIN may still be queued, and the kernel reads the datagrams from our region
+    while(freeSends.size() < sends.size()){
+        enter(true, 0);
+    }
+    close(ringFd);
+    munmap(sqes, sqesLength);
+    munmap(ringMap, ringLength);
+    arenaUnmap(region, regionLength);
+}
+
+bool UringIO::attach(int fd)
+{
+    // a single issuer that runs its own completion work only when it asks for events is cheapest; older kernels refuse the flags
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    ringFd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if(ringFd < 0 && errno == EINVAL){
+        memset(&params, 0, sizeof(params));
+        ringFd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    }
+    if(ringFd < 0){
+        perror("io_uring_setup");
+        return false;
+    }
+    if((params.features & IORING_FEAT_SINGLE_MMAP) == 0 || (params.features & IORING_FEAT_EXT_ARG) == 0){
+        fprintf(stderr, "io_uring: kernel lacks a single ring mapping or timed waits\n");
+        close(ringFd);
+        ringFd = -1;
+        return false;
+    }
+
+    sqEntries = params.sq_entries;
+    ringLength = max(params.sq_off.array + params.sq_entries*sizeof(unsigned), params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe));
+    ringMap = mmap(NULL, ringLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    sqesLength = params.sq_entries*sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *)mmap(NULL, sqesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if(ringMap == MAP_FAILED || sqes == MAP_FAILED){
+        perror("mmap io_uring");
+        exit(1);
+    }
+    char * ring = (char *)ringMap;
+    sqHead = (unsigned *)(ring + params.sq_off.head);
+    sqTail = (unsigned *)(ring + params.sq_off.tail);
+    sqMask = (unsigned *)(ring + params.sq_off.ring_mask);
+    sqArray = (unsigned *)(ring + params.sq_off.array);
+    cqHead = (unsigned *)(ring + params.cq_off.head);
+    cqTail = (unsigned *)(ring + params.cq_off.tail);
+    cqMask = (unsigned *)(ring + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+    // SQE i always sits in array slot i
+    for(unsigned i = 0; i < sqEntries; i++) {
+        sqArray[i] = i;
+    }
+    queuedTail = *sqTail;
+
+    // file blocks first so each starts on a page, then one MAX_DATAGRAM per receive and send
+    regionLength = (size_t)URING_FILE_BLOCKS*URING_FILE_BLOCK + (size_t)(URING_RECV_DEPTH + URING_SEND_DEPTH)*MAX_DATAGRAM;
+    region = (char *)arenaMap(regionLength);
+    fileRegion = region;
+    char * next = region + (size_t)URING_FILE_BLOCKS*URING_FILE_BLOCK;
+    recvs.resize(URING_RECV_DEPTH);
+    sends.resize(URING_SEND_DEPTH);
+    for(uring_msg_t & m : recvs) {
+        m.data = next;
+        next += MAX_DATAGRAM;
+    }
+    for(uint32_t i = 0; i < sends.size(); i++) {
+        sends[i].data = next;
+        next += MAX_DATAGRAM;
+        freeSends.push_back(i);
+    }
+
+    // the file blocks are pinned once, READ_FIXED and WRITE_FIXED skip mapping them per call
+    vector<struct iovec> iov(URING_FILE_BLOCKS);
+    for(uint32_t b = 0; b < URING_FILE_BLOCKS; b++) {
+        iov[b].iov_base = block(b);
+        iov[b].iov_len = URING_FILE_BLOCK;
+    }
+    if(syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, &iov[0], URING_FILE_BLOCKS) < 0){
+        perror("io_uring_register");
+        exit(1);
+    }
+    fileBusy.assign(URING_FILE_BLOCKS, false);
+    fileReserved.assign(URING_FILE_BLOCKS, false);
+    fileResult.assign(URING_FILE_BLOCKS, 0);
+
+    attachedFd = fd;
+    for(uint32_t i = 0; i < recvs.size(); i++) {
+        postRecv(i);
+    }
+    enter(false, 0);
+    return true;
+}
+
+struct io_uring_sqe * UringIO::nextSqe()
+{
+    if(queuedTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries){
+        enter(false, 0);
+    }
+    struct io_uring_sqe * sqe = &sqes[queuedTail & *sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    queuedTail++;
+    return sqe;
+}
+
+void UringIO::postRecv(uint32_t i)
+{
+    uring_msg_t & m = recvs[i];
+    memset(&m.msg, 0, sizeof(m.msg));
+    m.iov.iov_base = m.data;
+    m.iov.iov_len = MAX_DATAGRAM;
+    m.msg.msg_name = &m.name;
+    m.msg.msg_namelen = sizeof(m.name);
+    m.msg.msg_iov = &m.iov;
+    m.msg.msg_iovlen = 1;
+    m.msg.msg_control = m.control.space;
+    m.msg.msg_controllen = sizeof(m.control.space);
+
+    struct io_uring_sqe * sqe = nextSqe();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = attachedFd;
+    sqe->addr = (uint64_t)(uintptr_t)&m.msg;
+    sqe->len = 1;
+    sqe->user_data = URING_RECV | i;
+}
+
+bool UringIO::enter(bool wait, unsigned long long timeoutUs)
+{
+    // everything the kernel has not consumed yet, including what an earlier enter could not take
+    __atomic_store_n(sqTail, queuedTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = queuedTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    queuedSends = 0;
+    enters++;
+
+    int ret;
+    if(wait && timeoutUs > 0){
+        struct __kernel_timespec ts;
+        ts.tv_sec = timeoutUs/US_PER_SEC;
+        ts.tv_nsec = (timeoutUs%US_PER_SEC)*1000;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        ret = syscall(__NR_io_uring_enter, ringFd, toSubmit, 1, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }else{
+        ret = syscall(__NR_io_uring_enter, ringFd, toSubmit, wait ? 1 : 0, flags, NULL, 0);
+    }
+    if(ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN){
+        perror("io_uring_enter");
+        exit(1);
+    }
+    reap();
+    return ret >= 0;
+}
+
+void UringIO::reap()
+{
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++) {
+        struct io_uring_cqe & cqe = cqes[head & *cqMask];
+        uint32_t i = (uint32_t)cqe.user_data;
+        switch(cqe.user_data & ~0xFFFFFFFFULL){
+            case URING_RECV:
+                recvs[i].result = cqe.res;
+                ready.push_back(i);
+                break;
+            case URING_SEND:
+                // a datagram the network refused is lost like any other, the RTO covers it
+                freeSends.push_back(i);
+                break;
+            case URING_FILE:
+                fileResult[i] = cqe.res;
+                fileBusy[i] = false;
+                break;
+            case URING_SYNC:
+                syncBusy = false;
+                break;
+        }
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+ssize_t UringIO::sendTo(int fd, const void * buf, size_t len, const struct sockaddr * addr, socklen_t addrLen)
+{
+    return sendFrom(fd, buf, len, NULL, addr, addrLen);
+}
+
+ssize_t UringIO::sendFrom(int fd, const void * buf, size_t len, const struct sockaddr * local, const struct sockaddr * addr, socklen_t addrLen)
+{
+    if(fd != attachedFd || len > MAX_DATAGRAM || addrLen > sizeof(struct sockaddr_storage)){
+        return SystemIO::sendFrom(fd, buf, len, local, addr, addrLen);
+    }
+
+    while(freeSends.empty()){
+        enter(true, 0);
+    }
+    uint32_t i = freeSends.back();
+    freeSends.pop_back();
+
+    // copied out, the caller's buffer may change before the kernel gets to it
+    uring_msg_t & m = sends[i];
+    memcpy(m.data, buf, len);
+    memcpy(&m.name, addr, addrLen);
+    memset(&m.msg, 0, sizeof(m.msg));
+    m.iov.iov_base = m.data;
+    m.iov.iov_len = len;
+    m.msg.msg_name = &m.name;
+    m.msg.msg_namelen = addrLen;
+    m.msg.msg_iov = &m.iov;
+    m.msg.msg_iovlen = 1;
+    if(local != NULL && local->sa_family != AF_UNSPEC){
+        memset(&m.control, 0, sizeof(m.control));
+        m.msg.msg_control = m.control.space;
+        setSource(m.msg, local);
+    }
+
+    struct io_uring_sqe * sqe = nextSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&m.msg;
+    sqe->len = 1;
+    sqe->user_data = URING_SEND | i;
+
+    // a window's worth goes in together, without holding the first packets back for the last
+    if(++queuedSends >= URING_SEND_BATCH){
+        enter(false, 0);
+    }
+    return len;
+}
+
+ssize_t UringIO::recvFrom(int fd, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen)
+{
+    if(fd != attachedFd){
+        return SystemIO::recvFrom(fd, buf, len, addr, addrLen);
+    }
+
+    unsigned long long start = monotonicUs();
+    while(true){
+        while(ready.empty() == false){
+            uint32_t i = ready.front();
+            ready.pop_front();
+            uring_msg_t & m = recvs[i];
+            int result = m.result;
+            size_t numbytes = 0;
+            if(result >= 0){
+                numbytes = min(len, (size_t)result);
+                memcpy(buf, m.data, numbytes);
+                if(addr != NULL && addrLen != NULL){
+                    memcpy(addr, &m.name, min(*addrLen, m.msg.msg_namelen));
+                    *addrLen = m.msg.msg_namelen;
+                }
+                noteDrops(fd, m.msg);
+            }else if(result == -EBADF || result == -ENOTSOCK || result == -EINVAL || result == -EFAULT){
+                errno = -result;
+                perror("io_uring recvmsg");
+                exit(1);
+            }
+            postRecv(i);
+            if(result >= 0){
+                return numbytes;
+            }
+        }
+
+        // nothing reaped yet: hand the kernel every queued send and receive, sleep until something completes
+        unsigned long long left = 0;
+        if(timeout != 0){
+            unsigned long long elapsed = monotonicUs() - start;
+            if(elapsed >= timeout){
+                errno = EAGAIN;
+                return -1;
+            }
+            left = timeout - elapsed;
+        }
+        enter(true, left);
+    }
+}
+
+void UringIO::setRecvTimeout(int fd, const struct timeval & timeout)
+{
+    if(fd != attachedFd){
+        SystemIO::setRecvTimeout(fd, timeout);
+        return;
+    }
+    this->timeout = US_PER_SEC*timeout.tv_sec + timeout.tv_usec;
+}
+
+vector<uint32_t> UringIO::reserveBlocks(uint32_t n)
+{
+    vector<uint32_t> blocks;
+    for(uint32_t b = 0; b < fileReserved.size() && blocks.size() < n; b++) {
+        if(fileReserved[b] == false){
+            fileReserved[b] = true;
+            blocks.push_back(b);
+        }
+    }
+    if(blocks.size() < n){
+        fprintf(stderr, "io_uring: out of file blocks\n");
+        exit(1);
+    }
+    return blocks;
+}
+
+void UringIO::releaseBlocks(vector<uint32_t> & blocks)
+{
+    for(uint32_t b : blocks) {
+        if(fileBusy[b]){
+            waitFile(b);
+        }
+        fileReserved[b] = false;
+    }
+    blocks.clear();
+}
+
+void UringIO::startFile(uint32_t b, int fd, bool write, size_t len, unsigned long long offset)
+{
+    struct io_uring_sqe * sqe = nextSqe();
+    sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)block(b);
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = b;
+    sqe->user_data = URING_FILE | b;
+    fileBusy[b] = true;
+}
+
+ssize_t UringIO::waitFile(uint32_t b)
+{
+    while(fileBusy[b]){
+        enter(true, 0);
+    }
+    return fileResult[b];
+}
+
+void UringIO::startSync(int fd)
+{
+    struct io_uring_sqe * sqe = nextSqe();
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->user_data = URING_SYNC;
+    syncBusy = true;
+}
+
+unsigned long long UringIO::monotonicUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*US_PER_SEC + ts.tv_nsec/1000;
+}
+
+/*************** File Sink ***************/
+UringFileSink::UringFileSink(UringIO * ring, int fd) : FileSink(fd)
+{
+    this->ring = ring;
+    blocks = ring->reserveBlocks(URING_FILE_DEPTH);
+    lengths.assign(blocks.size(), 0);
+    current = 0;
+    used = 0;
+
+    off_t position = lseek(fd, 0, SEEK_CUR);
+    if(position < 0){
+        perror("lseek");
+        exit(1);
+    }
+    offset = position;
+}
+
+UringFileSink::~UringFileSink()
+{
+    for(uint32_t k = 0; k < blocks.size(); k++) {
+        if(lengths[k] > 0){
+            complete(k);
+        }
+    }
+    ring->releaseBlocks(blocks);
+}
+
+void UringFileSink::write(const char * buf, size_t len)
+{
+    digest = crc32c(digest, buf, len);
+    digestLength += len;
+
+    while(len > 0){
+        size_t n = min(len, (size_t)URING_FILE_BLOCK - used);
+        memcpy(ring->block(blocks[current]) + used, buf, n);
+        used += n;
+        buf += n;
+        len -= n;
+        if(used == URING_FILE_BLOCK){
+            submit();
+        }
+    }
+}
+
+void UringFileSink::finish()
+{
+    submit();
+    for(uint32_t k = 0; k < blocks.size(); k++) {
+        if(lengths[k] > 0){
+            complete(k);
+        }
+    }
+}
+
+size_t UringFileSink::pending()
+{
+    size_t bytes = used;
+    for(uint32_t k = 0; k < blocks.size(); k++) {
+        if(lengths[k] > 0 && ring->fileDone(blocks[k]) == false){
+            bytes += lengths[k];
+        }
+    }
+    return bytes;
+}
+
+void UringFileSink::submit()
+{
+    if(used == 0){
+        return;
+    }
+    ring->startFile(blocks[current], fd, true, used, offset);
+    lengths[current] = used;
+    offset += used;
+    used = 0;
+
+    // the next block is the oldest write, it has to be done before it fills again
+    current = (current + 1) % blocks.size();
+    if(lengths[current] > 0){
+        complete(current);
+    }
+}
+
+void UringFileSink::complete(uint32_t k)
+{
+    ssize_t written = ring->waitFile(blocks[k]);
+    if(written != (ssize_t)lengths[k]){
+        errno = (written < 0) ? -written : EIO;
+        perror("write");
+        exit(1);
+    }
+    lengths[k] = 0;
+}
+
+/*************** File Source ***************/
+UringFileSource::UringFileSource(UringIO * ring, int fd, unsigned long long bytes) : FileSource(fd, bytes)
+{
+    this->ring = ring;
+    blocks = ring->reserveBlocks(URING_FILE_DEPTH);
+    lengths.assign(blocks.size(), 0);
+    head = 0;
+    tail = 0;
+    consumed = 0;
+    started = false;
+    issued = 0;
+    end = 0;
+}
+
+UringFileSource::~UringFileSource()
+{
+    ring->releaseBlocks(blocks);
+}
+
+size_t UringFileSource::read(char * buf, size_t len)
+{
+    // a resumed transfer seeks the fd after this was made
+    if(started == false){
+        started = true;
+        off_t position = lseek(fd, 0, SEEK_CUR);
+        if(position < 0){
+            perror("lseek");
+            exit(1);
+        }
+        issued = position;
+        end = issued + remaining;
+        readAhead();
+    }
+
+    size_t total = 0;
+    len = min((unsigned long long)len, remaining);
+    while(total < len && lengths[head] > 0){
+        ssize_t got = ring->waitFile(blocks[head]);
+        if(got < 0){
+            errno = -got;
+            perror("read");
+            exit(1);
+        }
+        size_t n = min(len - total, (size_t)got - consumed);
+        memcpy(buf + total, ring->block(blocks[head]) + consumed, n);
+        consumed += n;
+        total += n;
+
+        if(consumed == (size_t)got){
+            // a short read is the end of the file, nothing more is asked for
+            if((size_t)got < lengths[head]){
+                end = issued;
+            }
+            lengths[head] = 0;
+            consumed = 0;
+            head = (head + 1) % blocks.size();
+            readAhead();
+        }
+    }
+
+    remaining = (total < len) ? 0 : remaining - total;
+    digest = crc32c(digest, buf, total);
+    digestLength += total;
+    return total;
+}
+
+void UringFileSource::readAhead()
+{
+    while(issued < end && lengths[tail] == 0){
+        size_t n = min((unsigned long long)URING_FILE_BLOCK, end - issued);
+        ring->startFile(blocks[tail], fd, false, n, issued);
+        lengths[tail] = n;
+        issued += n;
+        tail = (tail + 1) % blocks.size();
+    }
+}
@@ -0,0 +1,140 @@
+#ifndef URING_H
+#define URING_H
+
+#include "parameters.h"
+#include "types.h"
+#include "netio.h"
+#include "stream.h"
+#include "arena.h"
+
+// A datagram on its way through sendmsg or recvmsg, everything the kernel reads stays put until completion
+typedef struct {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_storage name;
+    union {
+        char space[CMSG_SPACE(sizeof(struct in6_pktinfo))];     // IP_PKTINFO out, SO_RXQ_OVFL in
+        size_t align;                           // cmsghdr alignment
+    } control;
+    char * data;                                // MAX_DATAGRAM in the ring's region
+    int result;                                 // recvmsg: bytes or -errno once complete
+} uring_msg_t;
+
+// One io_uring for the transport thread's socket and file I/O, set up with raw syscalls.
+// Receives are kept posted so one io_uring_enter reaps a burst of datagrams; sends are
+// copied out and queued, going in with the next wait or once URING_SEND_BATCH pile up.
+// File reads and writes use registered blocks, URING_FILE_BLOCK each
+class UringIO : public SystemIO
+{
+    public:
+        UringIO();
+        ~UringIO();
+
+        // Sets the ring up for fd's traffic; false, having said why, on a kernel without io_uring
+        bool attach(int fd);
+
+        ssize_t sendTo(int fd, const void * buf, size_t len, const struct sockaddr * addr, socklen_t addrLen);
+        ssize_t sendFrom(int fd, const void * buf, size_t len, const struct sockaddr * local, const struct sockaddr * addr, socklen_t addrLen);
+        ssize_t recvFrom(int fd, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen);
+        void setRecvTimeout(int fd, const struct timeval & timeout);
+
+        // Registered file blocks: reserve some, read or write one at an offset, wait for its byte count
+        vector<uint32_t> reserveBlocks(uint32_t n);
+        void releaseBlocks(vector<uint32_t> & blocks);
+        char * block(uint32_t b) { return fileRegion + (size_t)b*URING_FILE_BLOCK; }
+        void startFile(uint32_t b, int fd, bool write, size_t len, unsigned long long offset);
+        bool fileDone(uint32_t b) { return fileBusy[b] == false; }
+        ssize_t waitFile(uint32_t b);
+        // A background fdatasync of fd, one at a time
+        void startSync(int fd);
+        bool syncDone() { return syncBusy == false; }
+
+        // statistics
+        unsigned long long enters;
+
+    private:
+        struct io_uring_sqe * nextSqe();
+        void postRecv(uint32_t i);
+        // submits what is queued, waits for at least one completion if asked, up to timeoutUs (0 forever)
+        bool enter(bool wait, unsigned long long timeoutUs);
+        void reap();
+        unsigned long long monotonicUs();
+
+        int ringFd;
+        int attachedFd;
+        unsigned long long timeout;             // microseconds, 0 blocks forever
+
+        // the shared rings
+        void * ringMap;
+        size_t ringLength;
+        struct io_uring_sqe * sqes;
+        size_t sqesLength;
+        unsigned * sqHead, * sqTail, * sqMask, * sqArray;
+        unsigned * cqHead, * cqTail, * cqMask;
+        struct io_uring_cqe * cqes;
+        unsigned sqEntries;
+        unsigned queuedTail;                    // SQEs filled in, past *sqTail until submitted
+        unsigned queuedSends;
+
+        // datagram buffers, then the registered file blocks, in one arena mapping
+        char * region;
+        size_t regionLength;
+        vector<uring_msg_t> recvs, sends;
+        deque<uint32_t> ready;                  // completed receives in completion order
+        vector<uint32_t> freeSends;
+
+        char * fileRegion;
+        vector<bool> fileBusy, fileReserved;
+        vector<int> fileResult;
+        bool syncBusy;
+};
+
+extern UringIO uringIO;
+
+// Appends to an open file (not owned) through the ring: bytes gather in a registered block
+// that is written whole while the next fills, finish() waits for the last of them
+class UringFileSink : public FileSink
+{
+    public:
+        UringFileSink(UringIO * ring, int fd);
+        ~UringFileSink();
+
+        void write(const char * buf, size_t len);
+        void finish();
+        size_t pending();
+
+    private:
+        void submit();
+        void complete(uint32_t k);
+
+        UringIO * ring;
+        vector<uint32_t> blocks;
+        vector<size_t> lengths;                 // bytes written from each block, 0 when idle
+        uint32_t current;
+        size_t used;
+        unsigned long long offset;              // where the current block goes in the file
+};
+
+// Reads a fixed number of bytes from an open file (not owned) through the ring, keeping
+// URING_FILE_DEPTH blocks read ahead; starts wherever the fd's offset is at the first read
+class UringFileSource : public FileSource
+{
+    public:
+        UringFileSource(UringIO * ring, int fd, unsigned long long bytes);
+        ~UringFileSource();
+
+        size_t read(char * buf, size_t len);
+
+    private:
+        void readAhead();
+
+        UringIO * ring;
+        vector<uint32_t> blocks;
+        vector<size_t> lengths;                 // bytes asked of each block, 0 when idle
+        uint32_t head, tail;                    // oldest block being consumed, next block to issue
+        size_t consumed;                        // bytes of the head block already handed out
+        bool started;
+        unsigned long long issued, end;         // file offsets: next read, end of the transfer
+};
+
+#endif
@@ -0,0 +1,435 @@
+#include "xdp.h"
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/if_ether.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+
+#define XDP_HEADERS                 (ETH_HLEN + 20 + 8)               // Ethernet, IPv4 without options, UDP
+
+XdpIO xdpIO;
+
+static int bpf(int cmd, union bpf_attr & attr)
+{
+    return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+static struct bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+    struct bpf_insn i;
+    i.code = code;
+    i.dst_reg = dst;
+    i.src_reg = src;
+    i.off = off;
+    i.imm = imm;
+    return i;
+}
+
+XdpIO::XdpIO()
+{
+    attachedFd = -1;
+    family = AF_INET;
+    ifindex = 0;
+    mapFd = -1;
+    progFd = -1;
+    linkFd = -1;
+    timeout = 0;
+    receives = 0;
+    ringDrops = 0;
+}
+
+XdpIO::~XdpIO()
+{
+    detach();
+}
+
+bool XdpIO::attach(int fd, const char * ifname)
+{
+    struct sockaddr_storage local;
+    socklen_t localLen = sizeof(local);
+    if(getsockname(fd, (struct sockaddr *)&local, &localLen) < 0){
+        perror("getsockname");
+        return false;
+    }
+    family = local.ss_family;
+    uint16_t port = (family == AF_INET) ? ((struct sockaddr_in *)&local)->sin_port : ((struct sockaddr_in6 *)&local)->sin6_port;
+
+    ifindex = if_nametoindex(ifname);
+    if(ifindex == 0){
+        perror(ifname);
+        return false;
+    }
+
+    // one socket per receive queue, the program redirects to the one its packet came in on
+    uint32_t queues = 0;
+    string queuePath = string("/sys/class/net/") + ifname + "/queues";
+    DIR * dir = opendir(queuePath.c_str());
+    for(struct dirent * entry = dir ? readdir(dir) : NULL; entry != NULL; entry = readdir(dir)) {
+        queues += (strncmp(entry->d_name, "rx-", 3) == 0);
+    }
+    if(dir != NULL){
+        closedir(dir);
+    }
+    queues = max(queues, (uint32_t)1);
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = queues;
+    mapFd = bpf(BPF_MAP_CREATE, attr);
+    if(mapFd < 0){
+        perror("bpf XSKMAP");
+        detach();
+        return false;
+    }
+
+    for(uint32_t q = 0; q < queues; q++) {
+        if(openSocket(q) == false){
+            detach();
+            return false;
+        }
+    }
+
+    progFd = loadProgram(port);
+    if(progFd < 0){
+        detach();
+        return false;
+    }
+
+    // generic mode works on every driver; the link detaches the program when this process exits
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = progFd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+    linkFd = bpf(BPF_LINK_CREATE, attr);
+    if(linkFd < 0){
+        perror("bpf XDP link");
+        detach();
+        return false;
+    }
+
+    for(xdp_socket_t & xsk : sockets) {
+        struct pollfd pfd = { xsk.fd, POLLIN, 0 };
+        waitFds.push_back(pfd);
+    }
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    waitFds.push_back(pfd);
+    attachedFd = fd;
+    return true;
+}
+
+void XdpIO::detach()
+{
+    if(linkFd >= 0){
+        close(linkFd);
+    }
+    if(progFd >= 0){
+        close(progFd);
+    }
+    for(xdp_socket_t & xsk : sockets) {
+        if(xsk.rx.map != NULL){
+            munmap(xsk.rx.map, xsk.rx.mapLength);
+        }
+        if(xsk.fill.map != NULL){
+            munmap(xsk.fill.map, xsk.fill.mapLength);
+        }
+        close(xsk.fd);
+        arenaUnmap(xsk.umem, (size_t)XDP_FRAMES*XDP_FRAME_SIZE);
+    }
+    if(mapFd >= 0){
+        close(mapFd);
+    }
+    sockets.clear();
+    waitFds.clear();
+    linkFd = progFd = mapFd = -1;
+    attachedFd = -1;
+}
+
+int XdpIO::loadProgram(uint16_t port)
+{
+    vector<struct bpf_insn> prog;
+    vector<size_t> toPass;                  // jumps to patch once the pass exit is placed
+
+    // r6 = ctx, r2 = data, r3 = data_end
+    prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0));
+    prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, data), 0));
+    prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_6, offsetof(struct xdp_md, data_end), 0));
+
+    // the headers are all there, and the frame fits a UMEM chunk
+    prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0));
+    prog.push_back(insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, XDP_HEADERS));
+    toPass.push_back(prog.size());
+    prog.push_back(insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, 0));
+    prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0));
+    prog.push_back(insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, XDP_MAX_FRAME));
+    toPass.push_back(prog.size());
+    prog.push_back(insn(BPF_JMP | BPF_JLT | BPF_X, BPF_REG_4, BPF_REG_3, 0, 0));
+
+    // IPv4 without options, UDP, not a fragment, to our port; loads keep network byte order
+    struct { int size; int16_t offset; int32_t mask; int32_t value; } checks[] = {
+        { BPF_H, 12, 0, htons(ETH_P_IP) },
+        { BPF_B, ETH_HLEN, 0, 0x45 },
+        { BPF_B, ETH_HLEN + 9, 0, IPPROTO_UDP },
+        { BPF_H, ETH_HLEN + 6, htons(0x3FFF), 0 },          // more fragments, fragment offset
+        { BPF_H, ETH_HLEN + 20 + 2, 0, port },
+    };
+    for(size_t c = 0; c < sizeof(checks)/sizeof(checks[0]); c++) {
+        prog.push_back(insn(BPF_LDX | BPF_MEM | checks[c].size, BPF_REG_5, BPF_REG_2, checks[c].offset, 0));
+        if(checks[c].mask != 0){
+            prog.push_back(insn(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, checks[c].mask));
+        }
+        toPass.push_back(prog.size());
+        prog.push_back(insn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, checks[c].value));
+    }
+
+    // bpf_redirect_map(xsks, rx_queue_index, XDP_PASS): no socket on that queue passes it on
+    prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0));
+    prog.push_back(insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, mapFd));
+    prog.push_back(insn(0, 0, 0, 0, 0));
+    prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS));
+    prog.push_back(insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+    prog.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+    size_t pass = prog.size();
+    prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS));
+    prog.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+    for(size_t jump : toPass) {
+        prog[jump].off = pass - jump - 1;
+    }
+
+    vector<char> log(64*1024, 0);
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(uintptr_t)&prog[0];
+    attr.insn_cnt = prog.size();
+    attr.license = (uint64_t)(uintptr_t)"GPL";
+    attr.log_buf = (uint64_t)(uintptr_t)&log[0];
+    attr.log_size = log.size();
+    attr.log_level = 1;
+    int fd = bpf(BPF_PROG_LOAD, attr);
+    if(fd < 0){
+        perror("bpf XDP program");
+        fprintf(stderr, "%s\n", &log[0]);
+    }
+    return fd;
+}
+
+bool XdpIO::openSocket(uint32_t queue)
+{
+    xdp_socket_t xsk;
+    memset(&xsk, 0, sizeof(xsk));
+    xsk.fd = socket(AF_XDP, SOCK_RAW, 0);
+    if(xsk.fd < 0){
+        perror("socket AF_XDP");
+        return false;
+    }
+    xsk.umem = (char *)arenaMap((size_t)XDP_FRAMES*XDP_FRAME_SIZE);
+    sockets.push_back(xsk);
+    xdp_socket_t & s = sockets.back();
+
+    struct xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uint64_t)(uintptr_t)s.umem;
+    reg.len = (uint64_t)XDP_FRAMES*XDP_FRAME_SIZE;
+    reg.chunk_size = XDP_FRAME_SIZE;
+    reg.headroom = 0;
+    int fillSize = XDP_FRAMES, completionSize = XDP_RING_SIZE, rxSize = XDP_RING_SIZE;
+    if(setsockopt(s.fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0
+        || setsockopt(s.fd, SOL_XDP, XDP_UMEM_FILL_RING, &fillSize, sizeof(fillSize)) < 0
+        || setsockopt(s.fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &completionSize, sizeof(completionSize)) < 0
+        || setsockopt(s.fd, SOL_XDP, XDP_RX_RING, &rxSize, sizeof(rxSize)) < 0){
+        perror("setsockopt AF_XDP rings");
+        return false;
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t offLen = sizeof(off);
+    if(getsockopt(s.fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &offLen) < 0){
+        perror("getsockopt XDP_MMAP_OFFSETS");
+        return false;
+    }
+
+    s.rx.mapLength = off.rx.desc + rxSize*sizeof(struct xdp_desc);
+    s.rx.map = mmap(NULL, s.rx.mapLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s.fd, XDP_PGOFF_RX_RING);
+    s.fill.mapLength = off.fr.desc + fillSize*sizeof(uint64_t);
+    s.fill.map = mmap(NULL, s.fill.mapLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s.fd, XDP_UMEM_PGOFF_FILL_RING);
+    if(s.rx.map == MAP_FAILED || s.fill.map == MAP_FAILED){
+        perror("mmap AF_XDP rings");
+        s.rx.map = (s.rx.map == MAP_FAILED) ? NULL : s.rx.map;
+        s.fill.map = (s.fill.map == MAP_FAILED) ? NULL : s.fill.map;
+        return false;
+    }
+    s.rx.producer = (uint32_t *)((char *)s.rx.map + off.rx.producer);
+    s.rx.consumer = (uint32_t *)((char *)s.rx.map + off.rx.consumer);
+    s.rx.descs = (char *)s.rx.map + off.rx.desc;
+    s.rx.mask = rxSize - 1;
+    s.fill.producer = (uint32_t *)((char *)s.fill.map + off.fr.producer);
+    s.fill.consumer = (uint32_t *)((char *)s.fill.map + off.fr.consumer);
+    s.fill.descs = (char *)s.fill.map + off.fr.desc;
+    s.fill.mask = fillSize - 1;
+
+    // every chunk starts out with the kernel
+    uint64_t * fill = (uint64_t *)s.fill.descs;
+    for(uint32_t i = 0; i < XDP_FRAMES; i++) {
+        fill[i] = (uint64_t)i*XDP_FRAME_SIZE;
+    }
+    __atomic_store_n(s.fill.producer, (uint32_t)XDP_FRAMES, __ATOMIC_RELEASE);
+
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_flags = XDP_COPY;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = queue;
+    if(bind(s.fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0){
+        perror("bind AF_XDP");
+        return false;
+    }
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = mapFd;
+    attr.key = (uint64_t)(uintptr_t)&queue;
+    attr.value = (uint64_t)(uintptr_t)&s.fd;
+    if(bpf(BPF_MAP_UPDATE_ELEM, attr) < 0){
+        perror("bpf XSKMAP update");
+        return false;
+    }
+    return true;
+}
+
+ssize_t XdpIO::take(xdp_socket_t & xsk, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen)
+{
+    uint32_t consumer = *xsk.rx.consumer;
+    if(consumer == __atomic_load_n(xsk.rx.producer, __ATOMIC_ACQUIRE)){
+        return -1;
+    }
+    struct xdp_desc desc = ((struct xdp_desc *)xsk.rx.descs)[consumer & xsk.rx.mask];
+    const unsigned char * frame = (const unsigned char *)xsk.umem + desc.addr;
+
+    // the program only steers IPv4 without options; UDP's own length bounds the payload
+    const unsigned char * ip = frame + ETH_HLEN;
+    const unsigned char * udp = ip + 20;
+    size_t udpLength = (udp[4] << 8) | udp[5];
+    size_t payload = (desc.len >= XDP_HEADERS && udpLength >= 8) ? min((size_t)desc.len - XDP_HEADERS, udpLength - 8) : 0;
+    size_t numbytes = min(len, payload);
+    memcpy(buf, frame + XDP_HEADERS, numbytes);
+
+    if(addr != NULL && addrLen != NULL){
+        struct sockaddr_storage from;
+        memset(&from, 0, sizeof(from));
+        socklen_t fromLen;
+        if(family == AF_INET6){
+            // a dual stack socket names IPv4 peers by their mapped address
+            struct sockaddr_in6 * from6 = (struct sockaddr_in6 *)&from;
+            from6->sin6_family = AF_INET6;
+            memcpy(&from6->sin6_port, udp, 2);
+            from6->sin6_addr.s6_addr[10] = 0xFF;
+            from6->sin6_addr.s6_addr[11] = 0xFF;
+            memcpy(&from6->sin6_addr.s6_addr[12], ip + 12, 4);
+            fromLen = sizeof(struct sockaddr_in6);
+        }else{
+            struct sockaddr_in * from4 = (struct sockaddr_in *)&from;
+            from4->sin_family = AF_INET;
+            memcpy(&from4->sin_port, udp, 2);
+            memcpy(&from4->sin_addr, ip + 12, 4);
+            fromLen = sizeof(struct sockaddr_in);
+        }
+        memcpy(addr, &from, min(*addrLen, fromLen));
+        *addrLen = fromLen;
+    }
+
+    // the chunk goes straight back to the kernel
+    __atomic_store_n(xsk.rx.consumer, consumer + 1, __ATOMIC_RELEASE);
+    uint32_t producer = *xsk.fill.producer;
+    ((uint64_t *)xsk.fill.descs)[producer & xsk.fill.mask] = desc.addr & ~(uint64_t)(XDP_FRAME_SIZE - 1);
+    __atomic_store_n(xsk.fill.producer, producer + 1, __ATOMIC_RELEASE);
+
+    receives++;
+    return numbytes;
+}
+
+ssize_t XdpIO::recvFrom(int fd, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen)
+{
+    if(fd != attachedFd){
+        return SystemIO::recvFrom(fd, buf, len, addr, addrLen);
+    }
+
+    unsigned long long start = monotonicUs();
+    socklen_t addrSpace = (addrLen != NULL) ? *addrLen : 0;
+    while(true){
+        for(xdp_socket_t & xsk : sockets) {
+            ssize_t numbytes = take(xsk, buf, len, addr, addrLen);
+            if(numbytes >= 0){
+                return numbytes;
+            }
+        }
+
+        // whatever the program passed to the stack
+        if(addrLen != NULL){
+            *addrLen = addrSpace;
+        }
+        ssize_t numbytes = receive(fd, buf, len, addr, addrLen, MSG_DONTWAIT);
+        if(numbytes >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)){
+            return numbytes;
+        }
+
+        int wait = -1;
+        if(timeout != 0){
+            unsigned long long elapsed = monotonicUs() - start;
+            if(elapsed >= timeout){
+                errno = EAGAIN;
+                return -1;
+            }
+            wait = (timeout - elapsed + 999)/1000;
+        }
+        if(poll(&waitFds[0], waitFds.size(), wait) == 0 && timeout != 0 && monotonicUs() - start >= timeout){
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+}
+
+void XdpIO::setRecvTimeout(int fd, const struct timeval & timeout)
+{
+    if(fd != attachedFd){
+        SystemIO::setRecvTimeout(fd, timeout);
+        return;
+    }
+    this->timeout = US_PER_SEC*timeout.tv_sec + timeout.tv_usec;
+}
+
+uint32_t XdpIO::rxDropped(int fd)
+{
+    if(fd != attachedFd){
+        return SystemIO::rxDropped(fd);
+    }
+
+    // a getsockopt per socket, so only every so often
+    if(receives % XDP_STATS_EVERY == 0){
+        uint64_t drops = 0;
+        for(xdp_socket_t & xsk : sockets) {
+            struct xdp_statistics stats;
+            socklen_t statsLen = sizeof(stats);
+            if(getsockopt(xsk.fd, SOL_XDP, XDP_STATISTICS, &stats, &statsLen) == 0){
+                drops += stats.rx_dropped + stats.rx_ring_full + stats.rx_fill_ring_empty_descs;
+            }
+        }
+        ringDrops = drops;
+    }
+    return ringDrops + SystemIO::rxDropped(fd);
+}
+
+unsigned long long XdpIO::monotonicUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*US_PER_SEC + ts.tv_nsec/1000;
+}
@@ -0,0 +1,64 @@
+#ifndef XDP_H
+#define XDP_H
+
+#include "parameters.h"
+#include "types.h"
+#include "netio.h"
+#include "arena.h"
+
+// A ring shared with the kernel; producer and consumer are free running, mask wraps them
+typedef struct {
+    uint32_t * producer;
+    uint32_t * consumer;
+    void * descs;
+    uint32_t mask;
+    void * map;
+    size_t mapLength;
+} xdp_ring_t;
+
+// One AF_XDP socket, bound to one receive queue, with its own UMEM
+typedef struct {
+    int fd;
+    char * umem;
+    xdp_ring_t rx, fill;
+} xdp_socket_t;
+
+// AF_XDP receive path: an XDP program steers the IPv4 UDP datagrams addressed to one socket's
+// port into AF_XDP sockets, one per receive queue of the interface, in generic (SKB) copy mode
+// so any interface works, veth included. Sends, and whatever the program passes to the stack
+// (IPv6, fragments, frames larger than a UMEM chunk), still go through the UDP socket
+class XdpIO : public SystemIO
+{
+    public:
+        XdpIO();
+        ~XdpIO();
+
+        // Steers fd's port on the interface to this process; false, having said why, if it can't
+        bool attach(int fd, const char * ifname);
+        void detach();
+
+        ssize_t recvFrom(int fd, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen);
+        void setRecvTimeout(int fd, const struct timeval & timeout);
+        uint32_t rxDropped(int fd);
+
+    private:
+        int loadProgram(uint16_t port);
+        bool openSocket(uint32_t queue);
+        ssize_t take(xdp_socket_t & xsk, void * buf, size_t len, struct sockaddr * addr, socklen_t * addrLen);
+        unsigned long long monotonicUs();
+
+        int attachedFd;
+        int family;                             // the UDP socket's, source addresses are given in it
+        unsigned int ifindex;
+        int mapFd, progFd, linkFd;
+        vector<xdp_socket_t> sockets;
+        vector<struct pollfd> waitFds;          // the AF_XDP sockets, then the UDP socket
+        unsigned long long timeout;             // microseconds, 0 blocks forever
+
+        unsigned long long receives;
+        uint32_t ringDrops;                     // as of the last XDP_STATISTICS read
+};
+
+extern XdpIO xdpIO;
+
+#endif
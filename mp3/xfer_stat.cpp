@@ -0,0 +1,87 @@
+/*
+ *
+ * Live Transfer Statistics
+ *
+ * Maps the page a sender or receiver publishes with -m and prints one line
+ * per interval until that process exits. Reading never blocks the transfer.
+ *
+ */
+
+#include "stats.h"
+#include <sys/mman.h>
+#include <signal.h>
+
+void usage(char * name) {
+	fprintf(stderr, "usage: %s [-i interval_ms] [-1] stats_file\n", name);
+	fprintf(stderr, "  -1  print a single line and exit\n");
+	exit(1);
+}
+
+int main(int argc, char** argv) {
+	int interval = STATS_INTERVAL;
+	bool once = false;
+	int opt;
+
+	while((opt = getopt(argc, argv, "i:1")) != -1){
+		switch(opt){
+			case 'i':
+				interval = atoi(optarg);
+				break;
+			case '1':
+				once = true;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if(argc - optind != 1){
+		usage(argv[0]);
+	}
+
+	int fd = open(argv[optind], O_RDONLY);
+	if(fd < 0){
+		perror(argv[optind]);
+		return 1;
+	}
+	void * page = mmap(NULL, sizeof(transfer_stats_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(page == MAP_FAILED){
+		perror("mmap");
+		return 1;
+	}
+	const transfer_stats_t & stats = *(const transfer_stats_t *)page;
+	if(__atomic_load_n(&stats.magic, __ATOMIC_ACQUIRE) != STATS_MAGIC){
+		fprintf(stderr, "%s is not a statistics page\n", argv[optind]);
+		return 1;
+	}
+
+	// rates cover one interval, so the first line waits for one
+	unsigned long long lastBytes = statGet(stats.role == STATS_ROLE_SENDER ? stats.bytesAcked : stats.bytesWritten);
+	while(true){
+		if(!once){
+			usleep(interval*1000);
+		}
+		bool alive = kill(stats.pid, 0) == 0 || errno == EPERM;
+
+		if(stats.role == STATS_ROLE_SENDER){
+			unsigned long long bytes = statGet(stats.bytesAcked);
+			printf("cwnd=%llu rwnd=%llu srtt_us=%llu rto_us=%llu sent=%llu retransmits=%llu dup_acks=%llu timeouts=%llu acked=%llu sockbuf=%llu host_drops=%llu rate_mbit=%.1f\n",
+				statGet(stats.cwnd), statGet(stats.rwnd), statGet(stats.srtt), statGet(stats.rto), statGet(stats.packetsSent),
+				statGet(stats.packetsRetransmitted), statGet(stats.dupAcks), statGet(stats.timeouts), bytes,
+				statGet(stats.socketBuffer), statGet(stats.hostDrops),
+				once ? 0.0 : (bytes - lastBytes)*8.0/(interval*1000.0));
+			lastBytes = bytes;
+		}else{
+			unsigned long long bytes = statGet(stats.bytesWritten);
+			printf("received=%llu written=%llu occupancy=%llu flush_us=%llu flush_max_us=%llu sockbuf=%llu host_drops=%llu rate_mbit=%.1f\n",
+				statGet(stats.packetsReceived), bytes, statGet(stats.bufferOccupancy),
+				statGet(stats.flushLatency), statGet(stats.flushLatencyMax), statGet(stats.socketBuffer), statGet(stats.hostDrops),
+				once ? 0.0 : (bytes - lastBytes)*8.0/(interval*1000.0));
+			lastBytes = bytes;
+		}
+		fflush(stdout);
+
+		if(once || !alive) break;
+	}
+	return 0;
+}